@@ -0,0 +1,581 @@
+/* My includes */
+#include "batch.h"
+#include "shamir.h"
+#include "shamir_key.h"
+#include "shamir_field.h"
+#include "shamir_gf256.h"
+#include "pack.h"
+#include "stats.h"
+
+/* Standard C includes */
+#include <stdlib.h> /* for malloc(), realloc(), free(), EXIT_FAILURE */
+#include <stdio.h>  /* for getline(), fwrite(), perror() */
+#include <string.h> /* for memset(), strchr(), strcspn(), strlen() */
+#include <sys/types.h> /* for ssize_t */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+/* In batch mode, many secrets are shared, or recovered, in one run.
+ * When generating, every line of the input is a secret, read the way -s
+ * reads it. Its keys are written one per line, followed by an empty line.
+ * When combining, the input is made of such groups of keys, separated by
+ * empty lines. The first n_keys keys of every group are combined, and the
+ * secret is written on a line of its own.
+ * With pack, every pack lines are shared together, in packed keys (see
+ * pack.h), and their keys recover all of them, one per line.
+ * The random number generator, the key set, the field and all the buffers
+ * are set up once and reused from one secret to the next. */
+
+
+static int emit_key(unsigned i,
+		unsigned char x,
+		const unsigned char *y,
+		size_t len,
+		void *data)
+{
+	(void) i;
+	return gf256_fprint_key(data, x, y, len);
+}
+
+/* Make sure *buf holds at least size bytes.
+ * Returns -1 on failure. */
+static int reserve(char **buf, size_t *cap, size_t size)
+{
+	if (size > *cap) {
+		char *b = realloc(*buf, size);
+
+		if (!b) {
+			perror("realloc");
+			return -1;
+		}
+		*buf = b;
+		*cap = size;
+	}
+
+	return 0;
+}
+
+/* Share the secret in line, whose number is lineno, in prime or integer
+ * mode */
+static int generate_mpz_line(csprng *rng,
+		const char *line,
+		unsigned long lineno,
+		FILE *out,
+		unsigned keys_req,
+		unsigned num_keys,
+		enum sharemode mode,
+		int seq,
+		mpz_t secret,
+		skey_set **keys,
+		sfield_cache *fc,
+		char **buf,
+		size_t *cap)
+{
+	const sfield *field = NULL;
+	size_t i;
+
+	if (mpz_set_str(secret, line, 0) == -1) {
+		fprintf(stderr, "batch: line %lu: not a number.\n", lineno);
+		return -1;
+	}
+
+	if (mode == PRIME_MODE) {
+		const mp_bitcnt_t e = sfield_exp_for(mpz_sizeinbase(secret, 2));
+
+		if (mpz_sgn(secret) < 0) {
+			fprintf(stderr, "batch: line %lu: the secret must not be negative in prime mode.\n",
+				lineno);
+			return -1;
+		}
+		if (e == 0 || !(field = sfield_cache_get(fc, e))) {
+			fprintf(stderr, "batch: line %lu: the secret is too large for prime mode.\n",
+				lineno);
+			return -1;
+		}
+	}
+
+	if ((seq ? skey_generate_seq : skey_generate)(keys, rng, secret,
+			(unsigned short) keys_req, num_keys, field) != 0)
+		return -1;
+
+	if (reserve(buf, cap, skey_str_size(*keys, field)) == -1)
+		return -1;
+
+	for (i = 0; i < (*keys)->count; ++i)
+		fwrite(*buf, 1, skey_format(*buf, *keys, i, field), out);
+
+	return 0;
+}
+
+/* Share the count secrets of group, read from the lines before lineno, in
+ * one set of packed keys */
+static int generate_pack_group(csprng *rng,
+		const mpz_t *group,
+		unsigned count,
+		unsigned long lineno,
+		FILE *out,
+		unsigned keys_req,
+		unsigned num_keys,
+		int seq,
+		skey_set **keys,
+		sfield_cache *fc,
+		char **buf,
+		size_t *cap)
+{
+	const sfield *field;
+	mp_bitcnt_t e, bits = 1;
+	unsigned i;
+
+	/* The field of the largest secret */
+	for (i = 0; i < count; ++i)
+		if (mpz_sizeinbase(group[i], 2) > bits)
+			bits = mpz_sizeinbase(group[i], 2);
+	e = sfield_exp_for(bits);
+	if (e == 0 || !(field = sfield_cache_get(fc, e))) {
+		fprintf(stderr, "batch: line %lu: a secret is too large for prime mode.\n",
+			lineno);
+		return -1;
+	}
+
+	if (pack_generate(keys, rng, group, count, (unsigned short) keys_req,
+			num_keys, seq, field) != 0)
+		return -1;
+
+	if (reserve(buf, cap, pack_str_size(*keys, field)) == -1)
+		return -1;
+	for (i = 0; i < (*keys)->count; ++i)
+		fwrite(*buf, 1, pack_format(*buf, *keys, i, field, count), out);
+
+	return 0;
+}
+
+/* Share every line of in as a secret on its own, or every pack lines
+ * together if pack is not 0, and write the keys to out.
+ * Returns 0 on success. */
+int batch_generate(csprng *rng,
+		FILE *in,
+		FILE *out,
+		unsigned keys_req,
+		unsigned num_keys,
+		enum sharemode mode,
+		int seq,
+		unsigned pack)
+{
+	sfield_cache fc;
+	skey_set *keys = NULL;
+	char *line = NULL, *buf = NULL;
+	size_t line_cap = 0, buf_cap = 0, len;
+	unsigned long lineno = 0;
+	mpz_t secret, *group = NULL;
+	unsigned n_group = 0, i;
+	ssize_t r;
+	int ret = 0;
+
+	fc.initialized = 0;
+	mpz_init(secret);
+	if (pack) {
+		group = malloc(pack * sizeof *group);
+		if (!group) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+		for (i = 0; i < pack; ++i)
+			mpz_init(group[i]);
+	}
+
+	while (ret == 0 && (r = getline(&line, &line_cap, in)) != -1) {
+		++lineno;
+		len = strcspn(line, "\r\n");
+		line[len] = '\0';
+
+		if (len == 0) {
+			fprintf(stderr, "batch: line %lu: the secret must not be empty.\n",
+				lineno);
+			ret = EXIT_FAILURE;
+			break;
+		}
+		stats_add_bytes(len);
+
+		if (pack) {
+			if (mpz_set_str(group[n_group], line, 0) == -1
+					|| mpz_sgn(group[n_group]) < 0) {
+				fprintf(stderr, "batch: line %lu: not a non-negative number.\n",
+					lineno);
+				ret = EXIT_FAILURE;
+				break;
+			}
+			if (++n_group < pack)
+				continue;
+
+			ret = generate_pack_group(rng, (const mpz_t *) group,
+				n_group, lineno, out, keys_req, num_keys, seq,
+				&keys, &fc, &buf, &buf_cap) == -1
+				? EXIT_FAILURE : 0;
+			n_group = 0;
+		} else if (mode == GF256_MODE)
+			ret = (seq ? gf256_generate_seq : gf256_generate)(rng,
+				(const unsigned char *) line, len,
+				keys_req, num_keys, emit_key, out);
+		else if (generate_mpz_line(rng, line, lineno, out, keys_req,
+				num_keys, mode, seq, secret, &keys, &fc,
+				&buf, &buf_cap) == -1)
+			ret = EXIT_FAILURE;
+
+		/* An empty line ends the keys of every secret */
+		if (ret == 0 && fputc('\n', out) == EOF)
+			ret = EXIT_FAILURE;
+	}
+
+	if (ferror(in)) {
+		perror("getline");
+		ret = EXIT_FAILURE;
+	}
+
+	/* The last group may be short: its keys say how many secrets it has */
+	if (ret == 0 && n_group > 0) {
+		if (generate_pack_group(rng, (const mpz_t *) group, n_group,
+				lineno, out, keys_req, num_keys, seq, &keys,
+				&fc, &buf, &buf_cap) == -1
+				|| fputc('\n', out) == EOF)
+			ret = EXIT_FAILURE;
+	}
+
+	if (ret == 0 && fflush(out) == EOF) {
+		perror("fflush");
+		ret = EXIT_FAILURE;
+	}
+
+	if (line)
+		memset(line, 0, line_cap);
+	free(line);
+	free(buf);
+	skey_set_free(keys);
+	mpz_clear(secret);
+	if (group) {
+		for (i = 0; i < pack; ++i)
+			mpz_clear(group[i]);
+		free(group);
+	}
+	sfield_cache_clear(&fc);
+
+	return ret;
+}
+
+
+/* The lines of a group of keys, kept from one group to the next */
+struct group {
+	char **lines;
+	size_t *caps;
+	size_t count;  /* The number of lines in the group */
+	size_t alloc;  /* The number of lines allocated */
+};
+
+/* Read the next group of keys from in into g, counting lines in *lineno.
+ * Returns 1 if a group was read, 0 at the end of the input, and -1 on
+ * failure. */
+static int read_group(struct group *g, FILE *in, unsigned long *lineno)
+{
+	g->count = 0;
+
+	for (;;) {
+		ssize_t r;
+
+		if (g->count == g->alloc) {
+			const size_t alloc = g->alloc ? 2 * g->alloc : 16;
+			char **l = realloc(g->lines, alloc * sizeof *l);
+			size_t *c;
+
+			if (l)
+				g->lines = l;
+			c = l ? realloc(g->caps, alloc * sizeof *c) : NULL;
+			if (!c) {
+				perror("realloc");
+				return -1;
+			}
+			g->caps = c;
+			for (; g->alloc < alloc; ++g->alloc) {
+				g->lines[g->alloc] = NULL;
+				g->caps[g->alloc] = 0;
+			}
+		}
+
+		r = getline(&g->lines[g->count], &g->caps[g->count], in);
+		if (r == -1) {
+			if (ferror(in)) {
+				perror("getline");
+				return -1;
+			}
+			break;
+		}
+		++*lineno;
+
+		g->lines[g->count][strcspn(g->lines[g->count], "\r\n")] = '\0';
+		if (g->lines[g->count][0] == '\0') {
+			/* Skip the empty lines before a group */
+			if (g->count == 0)
+				continue;
+			break;
+		}
+		++g->count;
+	}
+
+	return g->count > 0;
+}
+
+static int combine_gf256_group(const struct group *g,
+		unsigned n,
+		unsigned long lineno,
+		FILE *out,
+		unsigned char **data,
+		size_t *cap)
+{
+	const size_t len = gf256_key_len(g->lines[0]);
+	unsigned char x[GF256_MAX_KEYS];
+	const unsigned char *y[GF256_MAX_KEYS];
+	unsigned i;
+
+	if (n > GF256_MAX_KEYS) {
+		fprintf(stderr, "batch: at most %u GF(2^8) keys can be combined.\n",
+			GF256_MAX_KEYS);
+		return -1;
+	}
+
+	if ((n + 1) * len > *cap) {
+		unsigned char *d = realloc(*data, (n + 1) * len);
+
+		if (!d) {
+			perror("realloc");
+			return -1;
+		}
+		*data = d;
+		*cap = (n + 1) * len;
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (len == 0 || gf256_key_len(g->lines[i]) != len
+				|| gf256_parse_key(g->lines[i], x + i,
+					*data + i * len, len) == -1) {
+			fprintf(stderr, "batch: group ending on line %lu: invalid GF(2^8) key %u.\n",
+				lineno, i + 1U);
+			return -1;
+		}
+		y[i] = *data + i * len;
+	}
+
+	if (gf256_combine(*data + n * len, x, y, len, n) == -1) {
+		fprintf(stderr, "batch: group ending on line %lu: two of the keys are the same.\n",
+			lineno);
+		return -1;
+	}
+
+	fwrite(*data + n * len, 1, len, out);
+	stats_add_bytes(len);
+	return 0;
+}
+
+static int combine_mpz_group(const struct group *g,
+		unsigned n,
+		unsigned long lineno,
+		FILE *out,
+		mpz_t secret,
+		skey_set **keys,
+		sfield_cache *fc,
+		shamir_weights_cache *wc)
+{
+	const sfield *field = NULL;
+	mp_bitcnt_t e = 0;
+	size_t parsed;
+
+	parsed = skey_set_parse(keys, (const char *const *) g->lines, n, &e);
+	if (!*keys)
+		return -1;
+	if (parsed < n) {
+		fprintf(stderr, "batch: group ending on line %lu: invalid key %lu, or not from the same field as the others.\n",
+			lineno, (unsigned long) parsed + 1UL);
+		return -1;
+	}
+
+	if (e) {
+		field = sfield_cache_get(fc, e);
+		if (!field) {
+			fprintf(stderr, "batch: 2^%lu - 1 is not a known Mersenne prime.\n",
+				(unsigned long) e);
+			return -1;
+		}
+
+		if (!skey_set_in_field(*keys, field)) {
+			fprintf(stderr, "batch: group ending on line %lu: a key is out of range.\n",
+				lineno);
+			return -1;
+		}
+	}
+
+	if (shamir_calculate_secret_cached(secret, *keys, field, wc) == -1) {
+		fprintf(stderr, "batch: group ending on line %lu: two of the keys are the same%s.\n",
+			lineno, field ? "" : ", or the keys are inconsistent");
+		return -1;
+	}
+
+	/* Same format as -d */
+	if (mpz_sgn(secret) < 0) {
+		fputc('-', out);
+		mpz_neg(secret, secret);
+	}
+	fputs("0x", out);
+	stats_add_bytes(mpz_out_str(out, 16, secret));
+
+	return 0;
+}
+
+/* The secrets of pack_combine(), kept from one group to the next */
+struct secrets {
+	mpz_t *s;
+	unsigned alloc;
+};
+
+static int combine_pack_group(const struct group *g,
+		unsigned n,
+		unsigned long lineno,
+		FILE *out,
+		struct secrets *sec,
+		skey_set **keys,
+		sfield_cache *fc)
+{
+	const sfield *field;
+	mp_bitcnt_t e = 0;
+	unsigned count = 0, j;
+	size_t parsed;
+
+	parsed = pack_parse(keys, (const char *const *) g->lines, n, &e,
+		&count);
+	if (!*keys)
+		return -1;
+	if (parsed < n) {
+		fprintf(stderr, "batch: group ending on line %lu: invalid packed key %lu, or not from the same field or group as the others.\n",
+			lineno, (unsigned long) parsed + 1UL);
+		return -1;
+	}
+	if (e == 0) {
+		fprintf(stderr, "batch: group ending on line %lu: packed keys are always in a prime field.\n",
+			lineno);
+		return -1;
+	}
+	if (n <= count) {
+		fprintf(stderr, "batch: group ending on line %lu: %u secrets are packed in the keys, more than %u keys are needed.\n",
+			lineno, count, count);
+		return -1;
+	}
+
+	field = sfield_cache_get(fc, e);
+	if (!field) {
+		fprintf(stderr, "batch: 2^%lu - 1 is not a known Mersenne prime.\n",
+			(unsigned long) e);
+		return -1;
+	}
+	if (!skey_set_in_field(*keys, field)) {
+		fprintf(stderr, "batch: group ending on line %lu: a key is out of range.\n",
+			lineno);
+		return -1;
+	}
+
+	if (count > sec->alloc) {
+		mpz_t *s = realloc(sec->s, count * sizeof *s);
+
+		if (!s) {
+			perror("realloc");
+			return -1;
+		}
+		sec->s = s;
+		for (; sec->alloc < count; ++sec->alloc)
+			mpz_init(sec->s[sec->alloc]);
+	}
+
+	if (pack_combine(sec->s, count, *keys, field) == -1) {
+		fprintf(stderr, "batch: group ending on line %lu: two of the keys are the same.\n",
+			lineno);
+		return -1;
+	}
+
+	/* One secret per line, the way they were read in */
+	for (j = 0; j < count; ++j) {
+		if (j > 0)
+			fputc('\n', out);
+		fputs("0x", out);
+		stats_add_bytes(mpz_out_str(out, 16, sec->s[j]));
+	}
+
+	return 0;
+}
+
+/* Combine every group of keys of in, and write the secrets to out, one per
+ * line.
+ * Returns 0 on success. */
+int batch_combine(FILE *in, FILE *out, unsigned n_keys)
+{
+	struct group g;
+	sfield_cache fc;
+	shamir_weights_cache wc;
+	struct secrets sec;
+	skey_set *keys = NULL;
+	unsigned char *data = NULL;
+	size_t data_cap = 0, i;
+	unsigned long lineno = 0;
+	mpz_t secret;
+	int r, ret = 0;
+
+	memset(&g, 0, sizeof g);
+	memset(&sec, 0, sizeof sec);
+	fc.initialized = 0;
+	shamir_weights_cache_init(&wc);
+	mpz_init(secret);
+
+	while (ret == 0 && (r = read_group(&g, in, &lineno)) != 0) {
+		if (r == -1) {
+			ret = EXIT_FAILURE;
+			break;
+		}
+		if (g.count < n_keys) {
+			fprintf(stderr, "batch: group ending on line %lu: %u keys are needed, only %lu were given.\n",
+				lineno, n_keys, (unsigned long) g.count);
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		if (strchr(g.lines[0], ':'))
+			r = combine_gf256_group(&g, n_keys, lineno, out,
+				&data, &data_cap);
+		else if (pack_is_key(g.lines[0]))
+			r = combine_pack_group(&g, n_keys, lineno, out, &sec,
+				&keys, &fc);
+		else
+			r = combine_mpz_group(&g, n_keys, lineno, out,
+				secret, &keys, &fc, &wc);
+
+		if (r == -1 || fputc('\n', out) == EOF)
+			ret = EXIT_FAILURE;
+	}
+
+	if (ret == 0 && fflush(out) == EOF) {
+		perror("fflush");
+		ret = EXIT_FAILURE;
+	}
+
+	for (i = 0; i < g.alloc; ++i)
+		free(g.lines[i]);
+	free(g.lines);
+	free(g.caps);
+	if (data)
+		memset(data, 0, data_cap);
+	free(data);
+	skey_set_free(keys);
+	mpz_clear(secret);
+	for (i = 0; i < sec.alloc; ++i)
+		mpz_clear(sec.s[i]);
+	free(sec.s);
+	sfield_cache_clear(&fc);
+	shamir_weights_cache_clear(&wc);
+
+	return ret;
+}
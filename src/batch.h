@@ -0,0 +1,20 @@
+#ifndef _2EE94AFE_DACC_4D77_8EF4_C21B3578BDF4
+#define _2EE94AFE_DACC_4D77_8EF4_C21B3578BDF4
+
+#include "main.h" /* enum sharemode */
+#include "csprng.h"
+
+#include <stdio.h> /* FILE */
+
+
+int batch_generate(csprng *rng,
+		FILE *in,
+		FILE *out,
+		unsigned keys_req,
+		unsigned num_keys,
+		enum sharemode mode,
+		int seq,
+		unsigned pack);
+int batch_combine(FILE *in, FILE *out, unsigned n_keys);
+
+#endif /* !_2EE94AFE_DACC_4D77_8EF4_C21B3578BDF4 */
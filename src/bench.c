@@ -0,0 +1,560 @@
+/* My includes */
+#include "libshamir.h" /* enum shamir_mode */
+#include "shamir.h"
+#include "shamir_key.h"
+#include "shamir_field.h"
+#include "shamir_gf256.h"
+#include "csprng.h"
+
+/* Standard C includes */
+#include <limits.h> /* for USHRT_MAX, UINT_MAX */
+#include <stdlib.h> /* for malloc(), free(), strtoul(), strtod() */
+#include <stdio.h>  /* for printf(), fprintf() */
+#include <string.h> /* for memcpy(), memcmp(), memset(), strcmp() */
+#include <time.h>   /* for clock_gettime() */
+#include <unistd.h> /* for getopt() */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+/* shamir-bench times the building blocks of shamir over a sweep of secret
+ * sizes, thresholds and numbers of keys, and writes one record per
+ * measurement, as CSV or JSON, for comparing one build with another.
+ *
+ * The operations timed, for every mode:
+ *   import    the bytes of the secret turned into a number (not in gf256)
+ *   generate  skey_generate(), or gf256_generate()
+ *   format    all the keys formatted as text, the way -g prints them
+ *   combine   shamir_calculate_secret() on KEYS_REQ keys, or gf256_combine()
+ *   combine-cached
+ *             shamir_calculate_secret_cached() on the same keys, again and
+ *             again, as when many secrets were shared to the same keys
+ *             (not in gf256)
+ *   export    the recovered secret turned back into bytes (not in gf256) */
+
+#define MAX_LIST 32
+
+/* An operation is run in batches, each one twice as long as the one before,
+ * until a batch takes at least this long */
+#define MIN_BATCH_NS 1e6
+
+enum format {
+	CSV,
+	JSON
+};
+
+struct params {
+	size_t sizes[MAX_LIST];
+	size_t n_sizes;
+	unsigned long ks[MAX_LIST];
+	size_t n_ks;
+	unsigned long ns[MAX_LIST];
+	size_t n_ns;
+	int modes[3];        /* Indexed by enum shamir_mode */
+	double min_time_ns;  /* How long to run every operation for */
+	enum format format;
+	unsigned threads;
+};
+
+/* Everything an operation needs, for one secret size, KEYS_REQ and N_KEYS */
+struct bench {
+	csprng rng;
+	enum shamir_mode mode;
+	size_t size;
+	unsigned k, n;
+	unsigned char *bytes;     /* The secret */
+	mpz_t secret, recovered;
+	sfield_cache fc;
+	shamir_weights_cache wc;
+	const sfield *field;
+	skey_set *keys;           /* The N_KEYS keys */
+	skey_set *subset;         /* The first KEYS_REQ of them */
+	char *text;               /* The keys, formatted */
+	size_t text_cap;
+	unsigned char x[GF256_MAX_KEYS];
+	unsigned char *y;         /* The y of the GF(2^8) keys, n * size bytes */
+	unsigned char *out;       /* The recovered GF(2^8) secret */
+};
+
+typedef int (*bench_func)(struct bench *b);
+
+static const char *const mode_names[] = { "prime", "integer", "gf256" };
+
+static unsigned long records;
+
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int op_import(struct bench *b)
+{
+	mpz_import(b->secret, b->size, 1, 1, 0, 0, b->bytes);
+	return 0;
+}
+
+static int store_gf256_key(unsigned i,
+		unsigned char x,
+		const unsigned char *y,
+		size_t len,
+		void *data)
+{
+	struct bench *const b = data;
+
+	b->x[i] = x;
+	memcpy(b->y + i * len, y, len);
+	return 0;
+}
+
+static int op_generate(struct bench *b)
+{
+	if (b->mode == SHAMIR_GF256)
+		return gf256_generate(&b->rng, b->bytes, b->size, b->k, b->n,
+			store_gf256_key, b);
+
+	return skey_generate(&b->keys, &b->rng, b->secret,
+		(unsigned short) b->k, b->n, b->field);
+}
+
+static int op_format(struct bench *b)
+{
+	char *p = b->text;
+	unsigned i;
+
+	for (i = 0; i < b->n; ++i) {
+		if (b->mode == SHAMIR_GF256)
+			p += gf256_format_key(p, b->x[i], b->y + i * b->size,
+				b->size);
+		else
+			p += skey_format(p, b->keys, i, b->field);
+	}
+
+	return 0;
+}
+
+static int op_combine(struct bench *b)
+{
+	const unsigned char *y[GF256_MAX_KEYS];
+	unsigned i;
+
+	if (b->mode != SHAMIR_GF256)
+		return shamir_calculate_secret(b->recovered, b->subset, b->field);
+
+	for (i = 0; i < b->k; ++i)
+		y[i] = b->y + i * b->size;
+	return gf256_combine(b->out, b->x, y, b->size, b->k);
+}
+
+static int op_combine_cached(struct bench *b)
+{
+	return shamir_calculate_secret_cached(b->recovered, b->subset, b->field,
+		&b->wc);
+}
+
+static int op_export(struct bench *b)
+{
+	size_t size;
+
+	mpz_export(b->bytes, &size, 1, 1, 0, 0, b->recovered);
+	return 0;
+}
+
+/* Time f on b, and write the record of operation name */
+static int measure(const struct params *p,
+		struct bench *b,
+		const char *name,
+		bench_func f)
+{
+	double total = 0, best = -1, t0, t;
+	unsigned long iterations = 0, batch = 1, i;
+	double mean;
+
+	do {
+		t0 = now_ns();
+		for (i = 0; i < batch; ++i)
+			if (f(b) != 0)
+				return -1;
+		t = now_ns() - t0;
+
+		total += t;
+		iterations += batch;
+		if (best < 0 || t / batch < best)
+			best = t / batch;
+		if (t < MIN_BATCH_NS)
+			batch *= 2;
+	} while (total < p->min_time_ns);
+
+	mean = total / iterations;
+
+	if (p->format == CSV) {
+		printf("%s,%s,%lu,%u,%u,%u,%lu,%.1f,%.1f,%.3f\n",
+			name, mode_names[b->mode], (unsigned long) b->size,
+			b->k, b->n, p->threads, iterations, mean, best,
+			b->size / mean * 1e3);
+	} else {
+		printf("%s\n  {\"op\": \"%s\", \"mode\": \"%s\", \"size\": %lu, "
+			"\"k\": %u, \"n\": %u, \"threads\": %u, "
+			"\"iterations\": %lu, \"mean_ns\": %.1f, \"min_ns\": %.1f, "
+			"\"mb_per_s\": %.3f}",
+			records ? "," : "",
+			name, mode_names[b->mode], (unsigned long) b->size,
+			b->k, b->n, p->threads, iterations, mean, best,
+			b->size / mean * 1e3);
+	}
+	++records;
+	fflush(stdout);
+
+	return 0;
+}
+
+/* Copy the first k keys of b->keys to b->subset */
+static int make_subset(struct bench *b)
+{
+	mpz_t xv, yv;
+	unsigned i;
+
+	skey_set_free(b->subset);
+	b->subset = skey_set_alloc(b->k,
+		(mp_bitcnt_t) b->keys->xlimbs * GMP_NUMB_BITS,
+		(mp_bitcnt_t) b->keys->ylimbs * GMP_NUMB_BITS);
+	if (!b->subset)
+		return -1;
+
+	for (i = 0; i < b->k; ++i)
+		skey_set_store(b->subset, i, skey_set_x(b->keys, i, xv),
+			skey_set_y(b->keys, i, yv));
+
+	return 0;
+}
+
+/* Run every operation for one secret size, k and n */
+static int run(const struct params *p, struct bench *b)
+{
+	size_t line;
+
+	/* A secret of exactly size bytes: the first one is never 0 */
+	csprng_bytes(&b->rng, b->bytes, b->size);
+	b->bytes[0] |= 0x80;
+	b->field = NULL;
+
+	if (b->mode == SHAMIR_GF256) {
+		if (b->n > GF256_MAX_KEYS) {
+			fprintf(stderr, "Skipping gf256, n = %u: at most %u keys.\n",
+				b->n, GF256_MAX_KEYS);
+			return 0;
+		}
+
+		free(b->y);
+		free(b->out);
+		b->y = malloc(b->n * b->size);
+		b->out = malloc(b->size);
+		if (!b->y || !b->out)
+			goto oom;
+	} else {
+		op_import(b);
+
+		if (b->mode == SHAMIR_PRIME) {
+			const mp_bitcnt_t e = sfield_exp_for(mpz_sizeinbase(b->secret, 2));
+
+			if (e == 0) {
+				fprintf(stderr, "Skipping prime, size = %lu: too large.\n",
+					(unsigned long) b->size);
+				return 0;
+			}
+			b->field = sfield_cache_get(&b->fc, e);
+		}
+
+		if (measure(p, b, "import", op_import) == -1)
+			return -1;
+	}
+
+	if (measure(p, b, "generate", op_generate) == -1)
+		return -1;
+
+	if (b->mode == SHAMIR_GF256) {
+		line = GF256_KEY_STR_SIZE(b->size);
+	} else {
+		line = skey_str_size(b->keys, b->field);
+		if (make_subset(b) == -1)
+			goto oom;
+	}
+
+	if ((size_t) b->n * line > b->text_cap) {
+		free(b->text);
+		b->text_cap = (size_t) b->n * line;
+		b->text = malloc(b->text_cap);
+		if (!b->text)
+			goto oom;
+	}
+	if (measure(p, b, "format", op_format) == -1)
+		return -1;
+
+	if (measure(p, b, "combine", op_combine) == -1)
+		return -1;
+
+	/* Make sure what was timed was right */
+	if (b->mode == SHAMIR_GF256
+			? memcmp(b->out, b->bytes, b->size) != 0
+			: mpz_cmp(b->recovered, b->secret) != 0) {
+		fprintf(stderr, "The secret recovered in %s mode is wrong.\n",
+			mode_names[b->mode]);
+		return -1;
+	}
+
+	if (b->mode != SHAMIR_GF256) {
+		mpz_set_ui(b->recovered, 0U);
+		if (measure(p, b, "combine-cached", op_combine_cached) == -1)
+			return -1;
+		if (mpz_cmp(b->recovered, b->secret) != 0) {
+			fprintf(stderr, "The secret recovered in %s mode with cached weights is wrong.\n",
+				mode_names[b->mode]);
+			return -1;
+		}
+
+		if (measure(p, b, "export", op_export) == -1)
+			return -1;
+	}
+
+	return 0;
+
+oom:
+	perror("malloc");
+	return -1;
+}
+
+/* Parse the comma-separated list str into list, with the suffixes K, M and
+ * G if suffixes is not 0.
+ * Returns the number of elements, or 0 if str is not a valid list. */
+static size_t parse_list(const char *str, unsigned long *list, int suffixes)
+{
+	size_t n = 0;
+	char *end;
+
+	for (;;) {
+		unsigned long v = strtoul(str, &end, 10);
+
+		if (end == str || n == MAX_LIST)
+			return 0;
+		if (suffixes && *end) {
+			const char *const suffix = strchr("KMG", *end);
+
+			if (suffix) {
+				v <<= 10 * (suffix - "KMG" + 1);
+				++end;
+			}
+		}
+		list[n++] = v;
+
+		if (*end == '\0')
+			return n;
+		if (*end != ',')
+			return 0;
+		str = end + 1;
+	}
+}
+
+static void __attribute__((noreturn)) usage_exit(const char *progname,
+		int code,
+		const char *error)
+{
+	if (error)
+		fprintf(stderr, "Error: %s.\n\n", error);
+
+	fprintf(code == EXIT_SUCCESS ? stdout : stderr,
+		"USAGE: %s [-s SIZES] [-k KEYS_REQS] [-n N_KEYS] [-m MODES]\n"
+		"       [-t SECONDS] [-j THREADS] [-f csv|json]\n"
+		"\n"
+		"Time the generation, the formatting and the combination of keys for\n"
+		"every combination of the comma-separated lists given, and write one\n"
+		"record per operation to standard output.\n",
+		progname);
+	fputs(
+		"\n"
+		"\t-s SIZES:    Secret sizes in bytes, with K, M or G. Default: 32,1K,32K.\n"
+		"\t             Up to 1G works, given the memory for N_KEYS keys.\n"
+		"\t-k KEYS_REQS: Default: 2,3,10.\n"
+		"\t-n N_KEYS:   Combinations where N_KEYS < KEYS_REQ are skipped.\n"
+		"\t             Default: 10,100.\n"
+		"\t-m MODES:    Among prime, integer and gf256. Default: all three.\n"
+		"\t-t SECONDS:  How long to run every operation for. Default: 0.2.\n"
+		"\t-j THREADS:  The number of threads to generate with. Default: 1.\n"
+		"\t-f FORMAT:   csv (the default) or json.\n",
+		code == EXIT_SUCCESS ? stdout : stderr);
+
+	exit(code);
+}
+
+static void parse_arguments(int argc, char *argv[], struct params *p)
+{
+	unsigned long list[MAX_LIST];
+	const char *m;
+	char *end;
+	size_t i;
+	int ch;
+
+	p->n_sizes = parse_list("32,1K,32K", list, 1);
+	for (i = 0; i < p->n_sizes; ++i)
+		p->sizes[i] = list[i];
+	p->n_ks = parse_list("2,3,10", p->ks, 0);
+	p->n_ns = parse_list("10,100", p->ns, 0);
+	p->modes[SHAMIR_PRIME] = p->modes[SHAMIR_INTEGER] = p->modes[SHAMIR_GF256] = 1;
+	p->min_time_ns = 0.2e9;
+	p->format = CSV;
+	p->threads = 1;
+
+	while ((ch = getopt(argc, argv, ":s:k:n:m:t:j:f:h")) != -1) {
+		switch (ch) {
+		case 's':
+			p->n_sizes = parse_list(optarg, list, 1);
+			if (!p->n_sizes)
+				usage_exit(argv[0], EXIT_FAILURE, "-s: invalid list of sizes");
+			for (i = 0; i < p->n_sizes; ++i) {
+				if (list[i] == 0)
+					usage_exit(argv[0], EXIT_FAILURE, "-s: a size must not be 0");
+				p->sizes[i] = list[i];
+			}
+			break;
+
+		case 'k':
+			p->n_ks = parse_list(optarg, p->ks, 0);
+			for (i = 0; i < p->n_ks; ++i)
+				if (p->ks[i] < 2 || p->ks[i] > USHRT_MAX)
+					p->n_ks = 0;
+			if (!p->n_ks)
+				usage_exit(argv[0], EXIT_FAILURE, "-k: invalid list of KEYS_REQ");
+			break;
+
+		case 'n':
+			p->n_ns = parse_list(optarg, p->ns, 0);
+			for (i = 0; i < p->n_ns; ++i)
+				if (p->ns[i] < 2 || p->ns[i] > UINT_MAX)
+					p->n_ns = 0;
+			if (!p->n_ns)
+				usage_exit(argv[0], EXIT_FAILURE, "-n: invalid list of N_KEYS");
+			break;
+
+		case 'm':
+			p->modes[SHAMIR_PRIME] = p->modes[SHAMIR_INTEGER] = p->modes[SHAMIR_GF256] = 0;
+			for (m = optarg; *m; m += *m == ',') {
+				const size_t len = strcspn(m, ",");
+
+				for (i = 0; i < 3; ++i)
+					if (strlen(mode_names[i]) == len
+							&& strncmp(m, mode_names[i], len) == 0)
+						break;
+				if (i == 3)
+					usage_exit(argv[0], EXIT_FAILURE, "-m: unknown mode");
+				p->modes[i] = 1;
+				m += len;
+			}
+			break;
+
+		case 't':
+			p->min_time_ns = strtod(optarg, &end) * 1e9;
+			if (end == optarg || *end || p->min_time_ns < 0)
+				usage_exit(argv[0], EXIT_FAILURE, "-t: invalid time");
+			break;
+
+		case 'j':
+			p->threads = (unsigned) strtoul(optarg, &end, 10);
+			if (end == optarg || *end || p->threads == 0)
+				usage_exit(argv[0], EXIT_FAILURE, "-j: invalid number of threads");
+			break;
+
+		case 'f':
+			if (strcmp(optarg, "csv") == 0)
+				p->format = CSV;
+			else if (strcmp(optarg, "json") == 0)
+				p->format = JSON;
+			else
+				usage_exit(argv[0], EXIT_FAILURE, "-f: unknown format");
+			break;
+
+		case 'h':
+			usage_exit(argv[0], EXIT_SUCCESS, NULL);
+
+		case ':':
+			usage_exit(argv[0], EXIT_FAILURE, "An option is missing its argument");
+
+		default:
+			usage_exit(argv[0], EXIT_FAILURE, "Unknown option");
+		}
+	}
+
+	if (optind != argc)
+		usage_exit(argv[0], EXIT_FAILURE, "No ARGUMENT is expected");
+}
+
+int main(int argc, char *argv[])
+{
+	struct params p;
+	struct bench b;
+	size_t s, ki, ni;
+	int mode, ret = EXIT_SUCCESS;
+
+	parse_arguments(argc, argv, &p);
+
+	memset(&b, 0, sizeof b);
+	if (csprng_init(&b.rng) == -1) {
+		fputs("No entropy available.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	mpz_init(b.secret);
+	mpz_init(b.recovered);
+	skey_use_threads(p.threads);
+
+	if (p.format == CSV)
+		puts("op,mode,size,k,n,threads,iterations,mean_ns,min_ns,mb_per_s");
+	else
+		fputs("[", stdout);
+
+	for (s = 0; s < p.n_sizes && ret == EXIT_SUCCESS; ++s) {
+		free(b.bytes);
+		b.size = p.sizes[s];
+		b.bytes = malloc(b.size);
+		if (!b.bytes) {
+			perror("malloc");
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		for (mode = 0; mode < 3 && ret == EXIT_SUCCESS; ++mode) {
+			if (!p.modes[mode])
+				continue;
+			b.mode = (enum shamir_mode) mode;
+
+			for (ki = 0; ki < p.n_ks && ret == EXIT_SUCCESS; ++ki) {
+				for (ni = 0; ni < p.n_ns && ret == EXIT_SUCCESS; ++ni) {
+					if (p.ns[ni] < p.ks[ki])
+						continue;
+					b.k = (unsigned) p.ks[ki];
+					b.n = (unsigned) p.ns[ni];
+					if (run(&p, &b) == -1)
+						ret = EXIT_FAILURE;
+				}
+			}
+		}
+	}
+
+	if (p.format == JSON)
+		fputs("\n]\n", stdout);
+
+	csprng_clear(&b.rng);
+	mpz_clear(b.secret);
+	mpz_clear(b.recovered);
+	sfield_cache_clear(&b.fc);
+	shamir_weights_cache_clear(&b.wc);
+	skey_set_free(b.keys);
+	skey_set_free(b.subset);
+	free(b.bytes);
+	free(b.text);
+	free(b.y);
+	free(b.out);
+
+	return ret;
+}
@@ -0,0 +1,368 @@
+/* My includes */
+#include "chacha20poly1305.h"
+
+/* Standard C includes */
+#include <string.h> /* for memcpy(), memset() */
+
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) do {                  \
+		a += b; d ^= a; d = ROTL32(d, 16);     \
+		c += d; b ^= c; b = ROTL32(b, 12);     \
+		a += b; d ^= a; d = ROTL32(d, 8);      \
+		c += d; b ^= c; b = ROTL32(b, 7);      \
+	} while (0)
+
+static uint32_t load32_le(const unsigned char *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8
+		| (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void store32_le(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char) v;
+	p[1] = (unsigned char) (v >> 8);
+	p[2] = (unsigned char) (v >> 16);
+	p[3] = (unsigned char) (v >> 24);
+}
+
+static void store64_le(unsigned char *p, uint64_t v)
+{
+	store32_le(p, (uint32_t) v);
+	store32_le(p + 4, (uint32_t) (v >> 32));
+}
+
+/* Compute the block counter of the keystream of key and nonce into out */
+void chacha20_block(const uint32_t key[8],
+		uint32_t counter,
+		const uint32_t nonce[3],
+		unsigned char out[64])
+{
+	uint32_t in[16], x[16];
+	int i;
+
+	/* "expand 32-byte k" */
+	in[0] = 0x61707865U;
+	in[1] = 0x3320646eU;
+	in[2] = 0x79622d32U;
+	in[3] = 0x6b206574U;
+	for (i = 0; i < 8; ++i)
+		in[4 + i] = key[i];
+	in[12] = counter;
+	in[13] = nonce[0];
+	in[14] = nonce[1];
+	in[15] = nonce[2];
+
+	memcpy(x, in, sizeof x);
+
+	for (i = 0; i < 10; ++i) {
+		/* Columns */
+		QUARTERROUND(x[0], x[4], x[8],  x[12]);
+		QUARTERROUND(x[1], x[5], x[9],  x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+		/* Diagonals */
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8],  x[13]);
+		QUARTERROUND(x[3], x[4], x[9],  x[14]);
+	}
+
+	for (i = 0; i < 16; ++i)
+		store32_le(out + 4 * i, x[i] + in[i]);
+
+	memset(x, 0, sizeof x);
+	memset(in, 0, sizeof in);
+}
+
+
+/* Poly1305 works modulo 2^130 - 5, on numbers held in five 26-bit limbs,
+ * so that the products of two limbs, and the sums of five of them, fit in
+ * 64 bits. */
+
+#define MASK26 0x3ffffffU
+
+void poly1305_init(struct poly1305 *st, const unsigned char key[32])
+{
+	/* r is clamped: some of its bits are always 0 */
+	st->r[0] = load32_le(key) & 0x3ffffffU;
+	st->r[1] = (load32_le(key + 3) >> 2) & 0x3ffff03U;
+	st->r[2] = (load32_le(key + 6) >> 4) & 0x3ffc0ffU;
+	st->r[3] = (load32_le(key + 9) >> 6) & 0x3f03fffU;
+	st->r[4] = (load32_le(key + 12) >> 8) & 0x00fffffU;
+
+	memset(st->h, 0, sizeof st->h);
+
+	st->pad[0] = load32_le(key + 16);
+	st->pad[1] = load32_le(key + 20);
+	st->pad[2] = load32_le(key + 24);
+	st->pad[3] = load32_le(key + 28);
+
+	st->used = 0;
+}
+
+/* h = (h + m) * r for every 16-byte block m of the len bytes of m.
+ * hibit is the bit 128 of every block: 1 << 24 in the top limb, unless the
+ * block is the last, shorter one, which carries its own padding. */
+static void poly1305_blocks(struct poly1305 *st,
+		const unsigned char *m,
+		size_t len,
+		uint32_t hibit)
+{
+	const uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+	const uint32_t r3 = st->r[3], r4 = st->r[4];
+	/* 2^130 = 5 (mod p), so the limbs that go past 2^130 wrap around
+	 * multiplied by 5 */
+	const uint32_t s1 = r1 * 5U, s2 = r2 * 5U, s3 = r3 * 5U, s4 = r4 * 5U;
+	uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+	uint32_t h3 = st->h[3], h4 = st->h[4];
+
+	for (; len >= 16; m += 16, len -= 16) {
+		uint64_t d0, d1, d2, d3, d4;
+		uint32_t c;
+
+		h0 += load32_le(m) & MASK26;
+		h1 += (load32_le(m + 3) >> 2) & MASK26;
+		h2 += (load32_le(m + 6) >> 4) & MASK26;
+		h3 += (load32_le(m + 9) >> 6) & MASK26;
+		h4 += (load32_le(m + 12) >> 8) | hibit;
+
+		d0 = (uint64_t) h0 * r0 + (uint64_t) h1 * s4 + (uint64_t) h2 * s3
+			+ (uint64_t) h3 * s2 + (uint64_t) h4 * s1;
+		d1 = (uint64_t) h0 * r1 + (uint64_t) h1 * r0 + (uint64_t) h2 * s4
+			+ (uint64_t) h3 * s3 + (uint64_t) h4 * s2;
+		d2 = (uint64_t) h0 * r2 + (uint64_t) h1 * r1 + (uint64_t) h2 * r0
+			+ (uint64_t) h3 * s4 + (uint64_t) h4 * s3;
+		d3 = (uint64_t) h0 * r3 + (uint64_t) h1 * r2 + (uint64_t) h2 * r1
+			+ (uint64_t) h3 * r0 + (uint64_t) h4 * s4;
+		d4 = (uint64_t) h0 * r4 + (uint64_t) h1 * r3 + (uint64_t) h2 * r2
+			+ (uint64_t) h3 * r1 + (uint64_t) h4 * r0;
+
+		/* Partial carry propagation */
+		c = (uint32_t) (d0 >> 26); h0 = (uint32_t) d0 & MASK26;
+		d1 += c; c = (uint32_t) (d1 >> 26); h1 = (uint32_t) d1 & MASK26;
+		d2 += c; c = (uint32_t) (d2 >> 26); h2 = (uint32_t) d2 & MASK26;
+		d3 += c; c = (uint32_t) (d3 >> 26); h3 = (uint32_t) d3 & MASK26;
+		d4 += c; c = (uint32_t) (d4 >> 26); h4 = (uint32_t) d4 & MASK26;
+		h0 += c * 5U; c = h0 >> 26; h0 &= MASK26;
+		h1 += c;
+	}
+
+	st->h[0] = h0;
+	st->h[1] = h1;
+	st->h[2] = h2;
+	st->h[3] = h3;
+	st->h[4] = h4;
+}
+
+void poly1305_update(struct poly1305 *st, const unsigned char *m, size_t len)
+{
+	const uint32_t hibit = (uint32_t) 1U << 24;
+
+	if (len == 0)
+		return;
+
+	if (st->used > 0) {
+		size_t n = sizeof st->buf - st->used;
+
+		if (n > len)
+			n = len;
+		memcpy(st->buf + st->used, m, n);
+		st->used += n;
+		m += n;
+		len -= n;
+
+		if (st->used < sizeof st->buf)
+			return;
+		poly1305_blocks(st, st->buf, sizeof st->buf, hibit);
+		st->used = 0;
+	}
+
+	poly1305_blocks(st, m, len & ~(size_t) 15U, hibit);
+	m += len & ~(size_t) 15U;
+	len &= 15U;
+
+	memcpy(st->buf, m, len);
+	st->used = len;
+}
+
+/* Compute the tag, and wipe st */
+void poly1305_finish(struct poly1305 *st, unsigned char tag[16])
+{
+	uint32_t h0, h1, h2, h3, h4, g0, g1, g2, g3, g4, c, mask;
+	uint64_t f;
+
+	if (st->used > 0) {
+		st->buf[st->used] = 1U;
+		memset(st->buf + st->used + 1, 0, sizeof st->buf - st->used - 1);
+		poly1305_blocks(st, st->buf, sizeof st->buf, 0U);
+	}
+
+	h0 = st->h[0]; h1 = st->h[1]; h2 = st->h[2];
+	h3 = st->h[3]; h4 = st->h[4];
+
+	/* Full carry propagation */
+	c = h1 >> 26; h1 &= MASK26;
+	h2 += c; c = h2 >> 26; h2 &= MASK26;
+	h3 += c; c = h3 >> 26; h3 &= MASK26;
+	h4 += c; c = h4 >> 26; h4 &= MASK26;
+	h0 += c * 5U; c = h0 >> 26; h0 &= MASK26;
+	h1 += c;
+
+	/* g = h - p, kept only if h >= p, without branching on h */
+	g0 = h0 + 5U; c = g0 >> 26; g0 &= MASK26;
+	g1 = h1 + c; c = g1 >> 26; g1 &= MASK26;
+	g2 = h2 + c; c = g2 >> 26; g2 &= MASK26;
+	g3 = h3 + c; c = g3 >> 26; g3 &= MASK26;
+	g4 = h4 + c - ((uint32_t) 1U << 26);
+
+	mask = (g4 >> 31) - 1U;  /* All ones if h >= p */
+	h0 = (h0 & ~mask) | (g0 & mask);
+	h1 = (h1 & ~mask) | (g1 & mask);
+	h2 = (h2 & ~mask) | (g2 & mask);
+	h3 = (h3 & ~mask) | (g3 & mask);
+	h4 = (h4 & ~mask) | (g4 & mask);
+
+	/* tag = (h + pad) mod 2^128 */
+	h0 = h0 | (h1 << 26);
+	h1 = (h1 >> 6) | (h2 << 20);
+	h2 = (h2 >> 12) | (h3 << 14);
+	h3 = (h3 >> 18) | (h4 << 8);
+
+	f = (uint64_t) h0 + st->pad[0];
+	store32_le(tag, (uint32_t) f);
+	f = (uint64_t) h1 + st->pad[1] + (f >> 32);
+	store32_le(tag + 4, (uint32_t) f);
+	f = (uint64_t) h2 + st->pad[2] + (f >> 32);
+	store32_le(tag + 8, (uint32_t) f);
+	f = (uint64_t) h3 + st->pad[3] + (f >> 32);
+	store32_le(tag + 12, (uint32_t) f);
+
+	memset(st, 0, sizeof *st);
+}
+
+
+/* Feed the MAC zeros up to the next multiple of 16 bytes */
+static void pad16(struct poly1305 *mac, uint64_t len)
+{
+	static const unsigned char zeros[16];
+
+	if (len % 16U)
+		poly1305_update(mac, zeros, 16U - (size_t) (len % 16U));
+}
+
+/* Start encrypting or decrypting with key and nonce. The aad_len bytes of
+ * aad are authenticated along with the text, but not encrypted. */
+void aead_init(struct aead *st,
+		const unsigned char key[AEAD_KEY_SIZE],
+		const unsigned char nonce[AEAD_NONCE_SIZE],
+		const unsigned char *aad,
+		size_t aad_len)
+{
+	unsigned char block[64];
+	unsigned i;
+
+	for (i = 0; i < 8; ++i)
+		st->key[i] = load32_le(key + 4 * i);
+	for (i = 0; i < 3; ++i)
+		st->nonce[i] = load32_le(nonce + 4 * i);
+
+	/* The one-time Poly1305 key is the start of block 0, and the text is
+	 * encrypted from block 1 on */
+	chacha20_block(st->key, 0U, st->nonce, block);
+	poly1305_init(&st->mac, block);
+	memset(block, 0, sizeof block);
+	st->counter = 1U;
+
+	poly1305_update(&st->mac, aad, aad_len);
+	pad16(&st->mac, aad_len);
+	st->aad_len = aad_len;
+	st->text_len = 0;
+}
+
+/* out = in xor the keystream */
+static void xor_keystream(struct aead *st,
+		unsigned char *out,
+		const unsigned char *in,
+		size_t len)
+{
+	unsigned char block[64];
+	size_t i, n;
+
+	while (len > 0) {
+		chacha20_block(st->key, st->counter++, st->nonce, block);
+
+		n = len < sizeof block ? len : sizeof block;
+		for (i = 0; i < n; ++i)
+			out[i] = in[i] ^ block[i];
+
+		in += n;
+		out += n;
+		len -= n;
+	}
+
+	memset(block, 0, sizeof block);
+}
+
+/* Encrypt the next len bytes of text from in to out, which may be the same */
+void aead_encrypt(struct aead *st,
+		unsigned char *out,
+		const unsigned char *in,
+		size_t len)
+{
+	xor_keystream(st, out, in, len);
+	poly1305_update(&st->mac, out, len);
+	st->text_len += len;
+}
+
+/* Authenticate the next len bytes of ciphertext, without decrypting them.
+ * Decrypting takes two passes: one to authenticate the whole ciphertext,
+ * ending with aead_finish() and aead_tag_equal(), and, only if the tags
+ * match, another with a new state to aead_decrypt() it. That way, nothing
+ * is output that hasn't been authenticated. */
+void aead_authenticate(struct aead *st, const unsigned char *in, size_t len)
+{
+	poly1305_update(&st->mac, in, len);
+	st->text_len += len;
+}
+
+/* Decrypt the next len bytes of ciphertext, already authenticated, from in
+ * to out, which may be the same */
+void aead_decrypt(struct aead *st,
+		unsigned char *out,
+		const unsigned char *in,
+		size_t len)
+{
+	xor_keystream(st, out, in, len);
+	st->text_len += len;
+}
+
+/* Compute the tag of everything encrypted or authenticated, and wipe st */
+void aead_finish(struct aead *st, unsigned char tag[AEAD_TAG_SIZE])
+{
+	unsigned char lens[16];
+
+	pad16(&st->mac, st->text_len);
+	store64_le(lens, st->aad_len);
+	store64_le(lens + 8, st->text_len);
+	poly1305_update(&st->mac, lens, sizeof lens);
+	poly1305_finish(&st->mac, tag);
+
+	memset(st, 0, sizeof *st);
+}
+
+/* Compare two tags in constant time.
+ * Returns non-zero if they are equal. */
+int aead_tag_equal(const unsigned char a[AEAD_TAG_SIZE],
+		const unsigned char b[AEAD_TAG_SIZE])
+{
+	unsigned diff = 0;
+	unsigned i;
+
+	for (i = 0; i < AEAD_TAG_SIZE; ++i)
+		diff |= (unsigned) (a[i] ^ b[i]);
+
+	return diff == 0;
+}
@@ -0,0 +1,61 @@
+#ifndef _3F6A92C1_7D4E_4B58_A0E3_C95B18D2F4A7
+#define _3F6A92C1_7D4E_4B58_A0E3_C95B18D2F4A7
+
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint32_t, uint64_t */
+
+
+/* ChaCha20, Poly1305 and AEAD_CHACHA20_POLY1305, as in RFC 8439 */
+
+#define AEAD_KEY_SIZE   32U
+#define AEAD_NONCE_SIZE 12U
+#define AEAD_TAG_SIZE   16U
+
+void chacha20_block(const uint32_t key[8],
+		uint32_t counter,
+		const uint32_t nonce[3],
+		unsigned char out[64]);
+
+struct poly1305 {
+	uint32_t r[5];   /* The key, in 26-bit limbs */
+	uint32_t h[5];   /* The accumulator */
+	uint32_t pad[4]; /* The second half of the key, added at the end */
+	unsigned char buf[16];
+	size_t used;     /* The bytes of buf not yet processed */
+};
+
+void poly1305_init(struct poly1305 *st, const unsigned char key[32]);
+void poly1305_update(struct poly1305 *st, const unsigned char *m, size_t len);
+void poly1305_finish(struct poly1305 *st, unsigned char tag[16]);
+
+/* The state of an AEAD_CHACHA20_POLY1305 encryption or decryption, which
+ * takes the text a piece at a time. Every piece but the last must be a
+ * multiple of 64 bytes long. */
+struct aead {
+	uint32_t key[8];
+	uint32_t nonce[3];
+	uint32_t counter;   /* The block of keystream the next piece starts at */
+	struct poly1305 mac;
+	uint64_t aad_len;
+	uint64_t text_len;
+};
+
+void aead_init(struct aead *st,
+		const unsigned char key[AEAD_KEY_SIZE],
+		const unsigned char nonce[AEAD_NONCE_SIZE],
+		const unsigned char *aad,
+		size_t aad_len);
+void aead_encrypt(struct aead *st,
+		unsigned char *out,
+		const unsigned char *in,
+		size_t len);
+void aead_authenticate(struct aead *st, const unsigned char *in, size_t len);
+void aead_decrypt(struct aead *st,
+		unsigned char *out,
+		const unsigned char *in,
+		size_t len);
+void aead_finish(struct aead *st, unsigned char tag[AEAD_TAG_SIZE]);
+int aead_tag_equal(const unsigned char a[AEAD_TAG_SIZE],
+		const unsigned char b[AEAD_TAG_SIZE]);
+
+#endif /* !_3F6A92C1_7D4E_4B58_A0E3_C95B18D2F4A7 */
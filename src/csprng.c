@@ -0,0 +1,137 @@
+/* My includes */
+#include "csprng.h"
+#include "getrandom.h"
+#include "chacha20poly1305.h"
+
+/* Standard C includes */
+#include <assert.h> /* for assert() */
+#include <string.h> /* for memcpy(), memset() */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+/* ChaCha20 as in RFC 8439, with a zero nonce. Since the generator changes
+ * its key every time it refills its buffer, the block counter never needs
+ * to go past CSPRNG_BLOCKS. */
+
+static const uint32_t zero_nonce[3];
+
+static uint32_t load32_le(const unsigned char *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8
+		| (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/* Compute a new buffer of keystream, and take the key for the next one out
+ * of its first 32 bytes */
+static void refill(csprng *rng)
+{
+	unsigned i;
+
+	for (i = 0; i < CSPRNG_BLOCKS; ++i)
+		chacha20_block(rng->key, i, zero_nonce, rng->buf + 64 * i);
+
+	for (i = 0; i < 8; ++i)
+		rng->key[i] = load32_le(rng->buf + 4 * i);
+	memset(rng->buf, 0, sizeof rng->key);
+	rng->pos = sizeof rng->key;
+}
+
+static void set_key(csprng *rng, const unsigned char seed[32])
+{
+	unsigned i;
+
+	for (i = 0; i < 8; ++i)
+		rng->key[i] = load32_le(seed + 4 * i);
+	rng->pos = sizeof rng->buf;
+}
+
+/* Seed rng with 32 bytes from the kernel.
+ * Returns 0 on success, and -1 if no entropy could be had. */
+int csprng_init(csprng *rng)
+{
+	unsigned char seed[32];
+
+	if (getrandom_bytes(seed, sizeof seed) == -1)
+		return -1;
+
+	set_key(rng, seed);
+	memset(seed, 0, sizeof seed);
+
+	return 0;
+}
+
+/* Seed rng from parent, for use by another thread */
+void csprng_init_from(csprng *rng, csprng *parent)
+{
+	unsigned char seed[32];
+
+	csprng_bytes(parent, seed, sizeof seed);
+	set_key(rng, seed);
+	memset(seed, 0, sizeof seed);
+}
+
+/* Wipe the state of rng */
+void csprng_clear(csprng *rng)
+{
+	memset(rng, 0, sizeof *rng);
+}
+
+/* Fill out with size random bytes. The bytes are wiped from the buffer as
+ * they are handed out. */
+void csprng_bytes(csprng *rng, void *out, size_t size)
+{
+	unsigned char *p = out;
+
+	while (size > 0) {
+		size_t n;
+
+		if (rng->pos == sizeof rng->buf)
+			refill(rng);
+
+		n = sizeof rng->buf - rng->pos;
+		if (n > size)
+			n = size;
+
+		memcpy(p, rng->buf + rng->pos, n);
+		memset(rng->buf + rng->pos, 0, n);
+		rng->pos += n;
+		p += n;
+		size -= n;
+	}
+}
+
+/* Set r to a uniformly random number in [0, 2^bits), drawn straight into
+ * its limbs */
+void csprng_urandomb(mpz_t r, csprng *rng, mp_bitcnt_t bits)
+{
+	const mp_size_t n = (mp_size_t) ((bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS);
+	const unsigned rem = (unsigned) (bits % GMP_NUMB_BITS);
+	mp_limb_t *limbs;
+
+	if (n == 0) {
+		mpz_set_ui(r, 0U);
+		return;
+	}
+
+	limbs = mpz_limbs_write(r, n);
+	csprng_bytes(rng, limbs, (size_t) n * sizeof *limbs);
+	if (rem)
+		limbs[n - 1] &= ((mp_limb_t) 1 << rem) - 1;
+	mpz_limbs_finish(r, n);
+}
+
+/* Set r to a uniformly random number in [0, n), for n > 0.
+ * Numbers of the bit length of n are drawn until one is less than n, which
+ * takes less than two draws on average. */
+void csprng_urandomm(mpz_t r, csprng *rng, const mpz_t n)
+{
+	const mp_bitcnt_t bits = mpz_sizeinbase(n, 2);
+
+	assert(mpz_sgn(n) > 0);
+
+	do
+		csprng_urandomb(r, rng, bits);
+	while (mpz_cmp(r, n) >= 0);
+}
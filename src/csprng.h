@@ -0,0 +1,33 @@
+#ifndef ADDFCE1F_A428_41E4_BE53_640FFD26714B
+#define ADDFCE1F_A428_41E4_BE53_640FFD26714B
+
+#include <gmp.h>
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint32_t */
+
+
+/* The number of ChaCha20 blocks computed at a time */
+#define CSPRNG_BLOCKS 16U
+
+/* A ChaCha20-based random number generator.
+ * The generator computes CSPRNG_BLOCKS blocks of keystream at a time. It
+ * keeps the first 32 bytes as its next key and hands out the rest, so the
+ * bytes already handed out can't be recovered from its state.
+ * A generator must only be used by one thread at a time; every thread gets
+ * its own, seeded with csprng_init_from(). */
+struct csprng {
+	uint32_t key[8];
+	unsigned char buf[64 * CSPRNG_BLOCKS];
+	size_t pos;          /* The next unused byte of buf */
+};
+typedef struct csprng csprng;
+
+int csprng_init(csprng *rng);
+void csprng_init_from(csprng *rng, csprng *parent);
+void csprng_clear(csprng *rng);
+
+void csprng_bytes(csprng *rng, void *out, size_t size);
+void csprng_urandomb(mpz_t r, csprng *rng, mp_bitcnt_t bits);
+void csprng_urandomm(mpz_t r, csprng *rng, const mpz_t n);
+
+#endif /* !ADDFCE1F_A428_41E4_BE53_640FFD26714B */
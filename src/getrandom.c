@@ -1,144 +1,87 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include "getrandom.h"
 
-#include <assert.h>
-#include <stdbool.h>
+#include <errno.h>
 #include <stdio.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <time.h>
-
 
-#ifndef _WIN32
 #include <fcntl.h>
 #include <unistd.h>
-#define DEV_URANDOM "/dev/urandom"
-#endif /* !_WIN32 */
-
-/* BASE62_DIGIT(x) returns the ascii code of the digit x in base 62
- * (0 <= x < 62).
- * Example: BASE62_DIGIT(12) => 'C' */
-#define BASE62_DIGIT(x) (\
-	((x) < 10U) \
-		? ('0' + (x)) \
-		: ((x) < 36U) \
-			? ('A' + (x) - 10) \
-			: ((x) < 62U) \
-				? ('a' + (x) - 36) \
-				: '?')
-/* HEX_DIGIT(x) returns the ascii code of the digit x in hexadecimal
- * (0 <= x < 16).
- * Example: HEX_DIGIT(12) => 'C' */
-#define HEX_DIGIT(x) (((x) < 16U) ? BASE62_DIGIT(x) : '?')
-
-
-static char *str;
-static char *buf;
-
-
-char *getrandom_str(size_t size)
-{
-	static bool srand_called = false;
-#ifdef _WIN32
-	unsigned short chunk;
-	const size_t chunksize = sizeof chunk;
+#if defined(HAVE_GETRANDOM) && defined(HAVE_SYS_RANDOM_H)
+#include <sys/random.h>
 #endif
-	const size_t strsize = size * 2 + 3;
-	size_t written = 0;
-	const char *bufit;
-	char *strit;
-
-	assert(size > 0);
 
-	if (!srand_called) {
-		srand((unsigned) time(NULL));
-		srand_called = true;
-	}
-
-	str = malloc(strsize);
-	if (!str) {
-		perror("malloc");
-		abort();
-	}
+#define DEV_URANDOM "/dev/urandom"
 
-	buf = malloc(size);
-	if (!buf) {
-		free(str);
-		perror("malloc");
-		abort();
-	}
 
-#ifdef _WIN32
-	while (written + chunksize < size) {
-		chunk = rand();
-		memcpy(buf + written, &chunk, chunksize);
-		written += chunksize;
-	}
-	if (written < size) {
-		chunk = rand();
-		memcpy(buf + written, &chunk, size - written);
-	}
-#else /* !_WIN32 */
-	{
-		const int flags = O_RDONLY
+#if !defined(HAVE_GETRANDOM) || !defined(HAVE_SYS_RANDOM_H)
+/* Fallback for systems without getrandom(2) */
+static int read_urandom(unsigned char *buf, size_t size)
+{
+	const int flags = O_RDONLY
 
 #ifdef O_NOCTTY
-			| O_NOCTTY
+		| O_NOCTTY
 #endif
 #ifdef O_NOFOLLOW
-			| O_NOFOLLOW
+		| O_NOFOLLOW
 #endif
-		;
-		ssize_t bytes_read;
+	;
+	ssize_t r;
 
-		const int fd = open(DEV_URANDOM, flags);
-		if (fd == -1) {
-			perror("Failed to open " DEV_URANDOM);
-			free(str);
-			free(buf);
-			abort();
-		}
-		bytes_read = read(fd, buf, size);
-		if (bytes_read == -1) {
+	const int fd = open(DEV_URANDOM, flags);
+	if (fd == -1) {
+		perror("Failed to open " DEV_URANDOM);
+		return -1;
+	}
+
+	while (size > 0) {
+		r = read(fd, buf, size);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r <= 0) {
 			perror("Failed to read from " DEV_URANDOM);
-			free(str);
-			free(buf);
-			if (close(fd) == -1)
-				perror("Failed to close " DEV_URANDOM);
-			abort();
-		}
-		if (close(fd) == -1) {
-			perror("Failed to close " DEV_URANDOM);
-			free(str);
-			free(buf);
-			abort();
+			close(fd);
+			return -1;
 		}
-		assert((size_t) bytes_read == size);
+		buf += r;
+		size -= (size_t) r;
 	}
-#endif
-
 
-	strncpy(str, "0x", 2);
-	strit = str + 2;
-	bufit = buf;
-	for (written = 0; written < size; ++written) {
-		const unsigned char c = *bufit++;
-		*strit++ = HEX_DIGIT((c & 0x00f0) >> 4);
-		*strit++ = HEX_DIGIT(c & 0x000f);
+	if (close(fd) == -1) {
+		perror("Failed to close " DEV_URANDOM);
+		return -1;
 	}
-	*strit = '\0';
 
-	free(buf);
-
-	return str;
+	return 0;
 }
+#endif
 
-char *test_str;
-void test_getrandom(unsigned ntests)
+/* Fill buf with size bytes from the kernel's entropy pool.
+ * Returns 0 on success, and -1 on failure. */
+int getrandom_bytes(void *buf, size_t size)
 {
-	test_str = getrandom_str(64);
-	puts(test_str);
-	free(test_str);
-	if (ntests - 1)
-		test_getrandom(ntests - 1);
+#if defined(HAVE_GETRANDOM) && defined(HAVE_SYS_RANDOM_H)
+	unsigned char *p = buf;
+	ssize_t r;
+
+	/* Large requests may be cut short, or interrupted by a signal */
+	while (size > 0) {
+		r = getrandom(p, size, 0);
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("getrandom");
+			return -1;
+		}
+		p += r;
+		size -= (size_t) r;
+	}
+
+	return 0;
+#else
+	return read_urandom(buf, size);
+#endif
 }
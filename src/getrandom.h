@@ -3,8 +3,6 @@
 
 #include <stddef.h>
 
-char *getrandom_str(size_t size);
-
-void test_getrandom(unsigned ntests);
+int getrandom_bytes(void *buf, size_t size);
 
 #endif /* D60CAC68_D96D_4295_B25D_76BD46AA4D12 */
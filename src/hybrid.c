@@ -0,0 +1,199 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h> /* for _FILE_OFFSET_BITS */
+#endif
+
+/* My includes */
+#include "hybrid.h"
+#include "chacha20poly1305.h"
+#include "stats.h"
+
+/* Standard C includes */
+#include <stdlib.h> /* for malloc(), free(), EXIT_FAILURE */
+#include <stdio.h>  /* for fread(), fwrite(), fseeko(), ftello(), perror() */
+#include <string.h> /* for memcmp(), memset() */
+#include <sys/types.h> /* for off_t */
+
+
+/* A data key is only used once */
+static const unsigned char nonce[AEAD_NONCE_SIZE];
+
+
+/* Encrypt everything in in with key, and write the payload to out.
+ * Returns 0 on success. */
+int hybrid_encrypt(FILE *in,
+		FILE *out,
+		const unsigned char key[HYBRID_KEY_SIZE])
+{
+	unsigned char *const buf = malloc(HYBRID_CHUNK_SIZE);
+	unsigned char tag[AEAD_TAG_SIZE];
+	struct aead st;
+	uint64_t total = 0;
+	size_t r;
+	int ret = EXIT_FAILURE;
+
+	if (!buf) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+
+	if (fwrite(HYBRID_MAGIC, 1, HYBRID_MAGIC_SIZE, out) != HYBRID_MAGIC_SIZE) {
+		perror("fwrite");
+		goto out;
+	}
+	aead_init(&st, key, nonce,
+		(const unsigned char *) HYBRID_MAGIC, HYBRID_MAGIC_SIZE);
+
+	/* fread() only comes up short at the end of the file, so every chunk
+	 * but the last is a whole one, as aead_encrypt() wants */
+	do {
+		r = fread(buf, 1, HYBRID_CHUNK_SIZE, in);
+		total += r;
+		if (total > HYBRID_MAX_SIZE) {
+			fputs("hybrid: the secret is too large, at most 256 GiB can be encrypted.\n",
+				stderr);
+			aead_finish(&st, tag);
+			goto out;
+		}
+		aead_encrypt(&st, buf, buf, r);
+		stats_add_bytes(r);
+
+		if (fwrite(buf, 1, r, out) != r) {
+			perror("fwrite");
+			aead_finish(&st, tag);
+			goto out;
+		}
+	} while (r == HYBRID_CHUNK_SIZE);
+
+	aead_finish(&st, tag);
+
+	if (ferror(in)) {
+		perror("fread");
+		goto out;
+	}
+	if (fwrite(tag, 1, sizeof tag, out) != sizeof tag) {
+		perror("fwrite");
+		goto out;
+	}
+	ret = 0;
+
+out:
+	memset(buf, 0, HYBRID_CHUNK_SIZE);
+	free(buf);
+	return ret;
+}
+
+/* Read the size bytes of ciphertext of in, which must be seekable, after
+ * the magic, passing every chunk to aead_authenticate(), or to
+ * aead_decrypt() and then to out if out is not NULL.
+ * Returns 0 on success. */
+static int pass(FILE *in,
+		FILE *out,
+		off_t size,
+		struct aead *st,
+		unsigned char *buf)
+{
+	size_t n;
+
+	if (fseeko(in, (off_t) HYBRID_MAGIC_SIZE, SEEK_SET) != 0) {
+		perror("fseeko");
+		return -1;
+	}
+
+	for (; size > 0; size -= (off_t) n) {
+		n = (uint64_t) size < HYBRID_CHUNK_SIZE
+			? (size_t) size : HYBRID_CHUNK_SIZE;
+
+		if (fread(buf, 1, n, in) != n) {
+			fputs("hybrid: the payload was cut short.\n", stderr);
+			return -1;
+		}
+
+		if (!out) {
+			aead_authenticate(st, buf, n);
+			continue;
+		}
+
+		aead_decrypt(st, buf, buf, n);
+		stats_add_bytes(n);
+		if (fwrite(buf, 1, n, out) != n) {
+			perror("fwrite");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Check the payload in with key, and only then decrypt it to out.
+ * in must be seekable: it is read twice, once to check it and once to
+ * decrypt it, so that nothing is written that hasn't been checked.
+ * Returns 0 on success. */
+int hybrid_decrypt(FILE *in,
+		FILE *out,
+		const unsigned char key[HYBRID_KEY_SIZE])
+{
+	unsigned char magic[HYBRID_MAGIC_SIZE];
+	unsigned char tag[AEAD_TAG_SIZE], expected[AEAD_TAG_SIZE];
+	unsigned char *buf;
+	struct aead st;
+	off_t size;
+	int ret = EXIT_FAILURE;
+
+	if (fread(magic, 1, sizeof magic, in) != sizeof magic
+			|| memcmp(magic, HYBRID_MAGIC, sizeof magic) != 0) {
+		fputs("hybrid: this is not a payload written by -g -H.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (fseeko(in, (off_t) 0, SEEK_END) != 0 || (size = ftello(in)) == -1) {
+		perror("hybrid: the payload must be a regular file");
+		return EXIT_FAILURE;
+	}
+	size -= (off_t) (HYBRID_MAGIC_SIZE + AEAD_TAG_SIZE);
+	if (size < 0) {
+		fputs("hybrid: the payload was cut short.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if ((uint64_t) size > HYBRID_MAX_SIZE) {
+		fputs("hybrid: the payload is too large to have been written by -g -H.\n",
+			stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (fseeko(in, -(off_t) AEAD_TAG_SIZE, SEEK_END) != 0
+			|| fread(tag, 1, sizeof tag, in) != sizeof tag) {
+		fputs("hybrid: failed to read the tag of the payload.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	buf = malloc(HYBRID_CHUNK_SIZE);
+	if (!buf) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+
+	aead_init(&st, key, nonce,
+		(const unsigned char *) HYBRID_MAGIC, HYBRID_MAGIC_SIZE);
+	if (pass(in, NULL, size, &st, buf) == -1) {
+		aead_finish(&st, expected);
+		goto out;
+	}
+	aead_finish(&st, expected);
+
+	if (!aead_tag_equal(tag, expected)) {
+		fputs("hybrid: the payload does not match the keys, or has been modified.\n",
+			stderr);
+		goto out;
+	}
+
+	aead_init(&st, key, nonce,
+		(const unsigned char *) HYBRID_MAGIC, HYBRID_MAGIC_SIZE);
+	if (pass(in, out, size, &st, buf) == 0)
+		ret = 0;
+	memset(&st, 0, sizeof st);
+
+out:
+	memset(buf, 0, HYBRID_CHUNK_SIZE);
+	free(buf);
+	return ret;
+}
@@ -0,0 +1,38 @@
+#ifndef _E4B71C96_28AD_4F3B_9C50_7A1D6E0B83F2
+#define _E4B71C96_28AD_4F3B_9C50_7A1D6E0B83F2
+
+#include <stdint.h> /* uint64_t */
+#include <stdio.h>  /* FILE */
+
+
+/* Hybrid sharing (-H): the secret is encrypted with a random data key, and
+ * only the data key is shared, so the keys stay small however large the
+ * secret is.
+ *
+ * The encrypted payload is:
+ *   HYBRID_MAGIC (8 bytes),
+ *   the secret encrypted with AEAD_CHACHA20_POLY1305 (RFC 8439),
+ *   the 16-byte tag.
+ * The magic is authenticated along with the secret. Since a data key is
+ * only ever used for one payload, the nonce is always zero. */
+
+#define HYBRID_MAGIC      "SHAMIRH1"
+#define HYBRID_MAGIC_SIZE 8U
+#define HYBRID_KEY_SIZE   32U
+
+/* The largest secret: the ChaCha20 block counter has 32 bits, and block 0
+ * makes the Poly1305 key, so past this, the keystream would repeat */
+#define HYBRID_MAX_SIZE ((((uint64_t) 1U << 32) - 1U) * 64U)
+
+/* The secret is encrypted and decrypted this many bytes at a time.
+ * A multiple of the 64-byte ChaCha20 block. */
+#define HYBRID_CHUNK_SIZE ((size_t) 1U << 16)
+
+int hybrid_encrypt(FILE *in,
+		FILE *out,
+		const unsigned char key[HYBRID_KEY_SIZE]);
+int hybrid_decrypt(FILE *in,
+		FILE *out,
+		const unsigned char key[HYBRID_KEY_SIZE]);
+
+#endif /* !_E4B71C96_28AD_4F3B_9C50_7A1D6E0B83F2 */
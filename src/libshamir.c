@@ -0,0 +1,342 @@
+/* My includes */
+#include "libshamir.h"
+#include "shamir.h"
+#include "shamir_key.h"
+#include "shamir_field.h"
+#include "shamir_gf256.h"
+#include "csprng.h"
+#include "stats.h"
+
+/* Standard C includes */
+#include <limits.h> /* for CHAR_BIT, USHRT_MAX */
+#include <stdlib.h> /* for malloc(), realloc(), free() */
+#include <string.h> /* for memset(), strchr() */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+struct buffer {
+	unsigned char *data;
+	size_t len;  /* The bytes in use, wiped before the buffer is reused */
+	size_t cap;
+};
+
+struct shamir_ctx {
+	csprng rng;
+	mpz_t secret;
+	skey_set *keys;
+	sfield_cache fc;
+	shamir_weights_cache wc;  /* The weights of the keys last combined */
+	struct buffer out;      /* The keys, or the secret, handed back */
+	struct buffer scratch;  /* The y of the GF(2^8) keys being combined */
+	const char *error;      /* What went wrong in the last call */
+};
+
+
+/* Make sure b holds at least size bytes, and wipe what it held */
+static int buffer_reserve(struct buffer *b, size_t size)
+{
+	unsigned char *d;
+
+	if (b->len > 0)
+		memset(b->data, 0, b->len);
+	b->len = 0;
+
+	if (size <= b->cap)
+		return 0;
+
+	d = realloc(b->data, size);
+	if (!d)
+		return -1;
+	b->data = d;
+	b->cap = size;
+
+	return 0;
+}
+
+static void buffer_free(struct buffer *b)
+{
+	if (b->data)
+		memset(b->data, 0, b->cap);
+	free(b->data);
+}
+
+static int fail(shamir_ctx *ctx, const char *error)
+{
+	ctx->error = error;
+	return -1;
+}
+
+
+/* Create a context, with its own random number generator seeded from the
+ * kernel.
+ * Returns NULL if there is not enough memory or entropy. */
+shamir_ctx *shamir_ctx_new(void)
+{
+	shamir_ctx *const ctx = malloc(sizeof *ctx);
+
+	if (!ctx)
+		return NULL;
+
+	if (csprng_init(&ctx->rng) == -1) {
+		free(ctx);
+		return NULL;
+	}
+
+	mpz_init(ctx->secret);
+	ctx->keys = NULL;
+	ctx->fc.initialized = 0;
+	shamir_weights_cache_init(&ctx->wc);
+	memset(&ctx->out, 0, sizeof ctx->out);
+	memset(&ctx->scratch, 0, sizeof ctx->scratch);
+	ctx->error = NULL;
+
+	return ctx;
+}
+
+/* Wipe and free ctx, and everything it handed back */
+void shamir_ctx_free(shamir_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	csprng_clear(&ctx->rng);
+	mpz_clear(ctx->secret);
+	skey_set_free(ctx->keys);
+	sfield_cache_clear(&ctx->fc);
+	shamir_weights_cache_clear(&ctx->wc);
+	buffer_free(&ctx->out);
+	buffer_free(&ctx->scratch);
+	free(ctx);
+}
+
+static int append_gf256_key(unsigned i,
+		unsigned char x,
+		const unsigned char *y,
+		size_t len,
+		void *data)
+{
+	struct buffer *const out = data;
+
+	(void) i;
+	out->len += gf256_format_key((char *) out->data + out->len, x, y, len);
+
+	return 0;
+}
+
+static int split_gf256(shamir_ctx *ctx,
+		const unsigned char *secret,
+		size_t len,
+		unsigned keys_req,
+		unsigned n_keys,
+		int seq)
+{
+	if (n_keys > GF256_MAX_KEYS)
+		return fail(ctx, "At most 255 GF(2^8) keys can be generated.");
+
+	if (buffer_reserve(&ctx->out, n_keys * GF256_KEY_STR_SIZE(len)) == -1)
+		return fail(ctx, "Out of memory.");
+
+	if ((seq ? gf256_generate_seq : gf256_generate)(&ctx->rng, secret, len,
+			keys_req, n_keys, append_gf256_key, &ctx->out) != 0)
+		return fail(ctx, "Failed to generate the keys.");
+
+	return 0;
+}
+
+static int split_mpz(shamir_ctx *ctx,
+		const unsigned char *secret,
+		size_t len,
+		enum shamir_mode mode,
+		unsigned keys_req,
+		unsigned n_keys,
+		int seq)
+{
+	const sfield *field = NULL;
+	size_t i;
+
+	/* A number has no leading zero bytes to give back, as -g -f */
+	if (secret[0] == 0)
+		return fail(ctx, "The secret starts with a zero byte, which a number can't keep: share it in gf256 mode.");
+
+	/* The bytes of the secret, most significant first, as -g -f */
+	mpz_import(ctx->secret, len, 1, 1, 0, 0, secret);
+
+	if (mode == SHAMIR_PRIME) {
+		const mp_bitcnt_t e = sfield_exp_for(mpz_sizeinbase(ctx->secret, 2));
+
+		if (e == 0 || !(field = sfield_cache_get(&ctx->fc, e)))
+			return fail(ctx, "The secret is too large for prime mode.");
+	}
+
+	if ((seq ? skey_generate_seq : skey_generate)(&ctx->keys, &ctx->rng,
+			ctx->secret, (unsigned short) keys_req, n_keys, field) != 0)
+		return fail(ctx, "Failed to generate the keys.");
+
+	if (buffer_reserve(&ctx->out,
+			ctx->keys->count * skey_str_size(ctx->keys, field)) == -1)
+		return fail(ctx, "Out of memory.");
+
+	for (i = 0; i < ctx->keys->count; ++i)
+		ctx->out.len += skey_format((char *) ctx->out.data + ctx->out.len,
+			ctx->keys, i, field);
+
+	return 0;
+}
+
+/* Share the len bytes of secret among n_keys keys, keys_req of which are
+ * needed to recover it. The keys are written one per line, as -g prints
+ * them, to *keys, which holds *keys_len bytes and isn't null-terminated.
+ * They are valid until the next call on ctx. In prime and integer modes,
+ * secret must not start with a zero byte.
+ * Returns 0 on success, and -1 on failure; shamir_strerror() says why. */
+int shamir_split(shamir_ctx *ctx,
+		const unsigned char *secret,
+		size_t len,
+		enum shamir_mode mode,
+		unsigned keys_req,
+		unsigned n_keys,
+		unsigned flags,
+		const char **keys,
+		size_t *keys_len)
+{
+	const int seq = (flags & SHAMIR_SEQ_X) != 0;
+	int ret;
+
+	if (mode != SHAMIR_PRIME && mode != SHAMIR_INTEGER && mode != SHAMIR_GF256)
+		return fail(ctx, "Unknown mode.");
+	if (flags & ~SHAMIR_SEQ_X)
+		return fail(ctx, "Unknown flags.");
+	if (keys_req < 2)
+		return fail(ctx, "KEYS_REQ must be at least 2.");
+	if (keys_req > USHRT_MAX)
+		return fail(ctx, "KEYS_REQ is too large.");
+	if (n_keys < keys_req)
+		return fail(ctx, "N_KEYS must not be less than KEYS_REQ.");
+	if (len == 0)
+		return fail(ctx, "The secret must not be empty.");
+
+	if (mode == SHAMIR_GF256)
+		ret = split_gf256(ctx, secret, len, keys_req, n_keys, seq);
+	else
+		ret = split_mpz(ctx, secret, len, mode, keys_req, n_keys, seq);
+
+	if (ret == -1)
+		return -1;
+	stats_add_bytes(len);
+
+	*keys = (const char *) ctx->out.data;
+	*keys_len = ctx->out.len;
+	return 0;
+}
+
+static int combine_gf256(shamir_ctx *ctx,
+		const char *const *keys,
+		unsigned n)
+{
+	const size_t len = gf256_key_len(keys[0]);
+	unsigned char x[GF256_MAX_KEYS];
+	const unsigned char *y[GF256_MAX_KEYS];
+	unsigned i;
+
+	if (n > GF256_MAX_KEYS)
+		return fail(ctx, "At most 255 GF(2^8) keys can be combined.");
+
+	if (buffer_reserve(&ctx->scratch, n * len) == -1
+			|| buffer_reserve(&ctx->out, len) == -1)
+		return fail(ctx, "Out of memory.");
+	ctx->scratch.len = n * len;
+
+	for (i = 0; i < n; ++i) {
+		if (len == 0 || gf256_key_len(keys[i]) != len
+				|| gf256_parse_key(keys[i], x + i,
+					ctx->scratch.data + i * len, len) == -1)
+			return fail(ctx, "Invalid GF(2^8) key.");
+		y[i] = ctx->scratch.data + i * len;
+	}
+
+	if (gf256_combine(ctx->out.data, x, y, len, n) == -1)
+		return fail(ctx, "Two of the keys are the same.");
+	ctx->out.len = len;
+
+	return 0;
+}
+
+static int combine_mpz(shamir_ctx *ctx,
+		const char *const *keys,
+		unsigned n)
+{
+	const sfield *field = NULL;
+	mp_bitcnt_t e = 0;
+	size_t size;
+
+	if (skey_set_parse(&ctx->keys, keys, n, &e) < n) {
+		if (!ctx->keys)
+			return fail(ctx, "Out of memory.");
+		return fail(ctx, "Invalid key, or not from the same field as the others.");
+	}
+
+	if (e) {
+		field = sfield_cache_get(&ctx->fc, e);
+		if (!field)
+			return fail(ctx, "The keys are not from a known Mersenne prime field.");
+		if (!skey_set_in_field(ctx->keys, field))
+			return fail(ctx, "A key is out of range.");
+	}
+
+	if (shamir_calculate_secret_cached(ctx->secret, ctx->keys, field,
+			&ctx->wc) == -1)
+		return fail(ctx, field ? "Two of the keys are the same."
+			: "Two of the keys are the same, or the keys are inconsistent.");
+
+	/* The bytes of the secret, as -d -o writes them */
+	if (mpz_sgn(ctx->secret) < 0)
+		return fail(ctx, "The secret is negative, and can't be written as bytes.");
+
+	size = (mpz_sizeinbase(ctx->secret, 2) + CHAR_BIT - 1) / CHAR_BIT;
+	if (buffer_reserve(&ctx->out, size) == -1)
+		return fail(ctx, "Out of memory.");
+
+	mpz_export(ctx->out.data, &size, 1, 1, 0, 0, ctx->secret);
+	ctx->out.len = size;
+
+	return 0;
+}
+
+/* Recover the secret from the first n_keys of keys, printed by -g or
+ * shamir_split(), one key per string. The mode is read from the keys.
+ * The bytes of the secret are stored in *secret, which holds *len bytes
+ * and is valid until the next call on ctx.
+ * Returns 0 on success, and -1 on failure; shamir_strerror() says why. */
+int shamir_combine(shamir_ctx *ctx,
+		const char *const *keys,
+		unsigned n_keys,
+		const unsigned char **secret,
+		size_t *len)
+{
+	int ret;
+
+	if (n_keys < 2)
+		return fail(ctx, "N_KEYS must be at least 2.");
+
+	/* "x:y" for GF(2^8), "x,y,e" for GF(2^e - 1) and "x,y" for integers */
+	if (strchr(keys[0], ':'))
+		ret = combine_gf256(ctx, keys, n_keys);
+	else
+		ret = combine_mpz(ctx, keys, n_keys);
+
+	if (ret == -1)
+		return -1;
+	stats_add_bytes(ctx->out.len);
+
+	*secret = ctx->out.data;
+	*len = ctx->out.len;
+	return 0;
+}
+
+/* What went wrong in the last call on ctx that failed */
+const char *shamir_strerror(const shamir_ctx *ctx)
+{
+	return ctx->error ? ctx->error : "No error.";
+}
@@ -0,0 +1,48 @@
+#ifndef _C41D7E08_6B2F_4A93_9E5D_0F8A3B6C27E1
+#define _C41D7E08_6B2F_4A93_9E5D_0F8A3B6C27E1
+
+#include <stddef.h> /* size_t */
+
+
+/* Shamir's secret sharing, as a library.
+ * Everything goes through a context, which holds a random number generator
+ * and the scratch space of the operations, kept from one call to the next.
+ * Contexts share nothing: any number of them can be used at the same time,
+ * from as many threads, as long as a context is only used by one thread at
+ * a time. */
+typedef struct shamir_ctx shamir_ctx;
+
+/* How the secret is shared, as with -m.
+ * In prime and integer modes, the bytes of the secret are read as a number,
+ * which has no leading zero bytes: shamir_split() refuses a secret that
+ * starts with one. GF(2^8) keeps every byte. */
+enum shamir_mode {
+	SHAMIR_PRIME,    /* Modulo the smallest Mersenne prime that holds it */
+	SHAMIR_INTEGER,  /* Over the integers */
+	SHAMIR_GF256     /* Byte by byte, in GF(2^8) */
+};
+
+/* Flags for shamir_split() */
+#define SHAMIR_SEQ_X 0x1U  /* Use the x values 1, ..., n_keys, as with -i */
+
+shamir_ctx *shamir_ctx_new(void);
+void shamir_ctx_free(shamir_ctx *ctx);
+
+int shamir_split(shamir_ctx *ctx,
+		const unsigned char *secret,
+		size_t len,
+		enum shamir_mode mode,
+		unsigned keys_req,
+		unsigned n_keys,
+		unsigned flags,
+		const char **keys,
+		size_t *keys_len);
+int shamir_combine(shamir_ctx *ctx,
+		const char *const *keys,
+		unsigned n_keys,
+		const unsigned char **secret,
+		size_t *len);
+
+const char *shamir_strerror(const shamir_ctx *ctx);
+
+#endif /* !_C41D7E08_6B2F_4A93_9E5D_0F8A3B6C27E1 */
@@ -1,23 +1,51 @@
 #include "main.h"
 #include "shamir_key.h"
 #include "shamir.h"
-
+#include "shamir_field.h"
+#include "shamir_gf256.h"
+#include "stream.h"
+#include "sharefile.h"
+#include "batch.h"
+#include "server.h"
+#include "stats.h"
+#include "hybrid.h"
+#include "vss.h"
+#include "pack.h"
+#include "robust.h"
+
+#include <limits.h> /* CHAR_BIT */
 #include <stdlib.h>
 #include <stdio.h>
-#include <string.h> /* strncmp */
+#include <string.h> /* strncmp, strcmp */
 #include <gmp.h>
-#include <unistd.h> /* getopt */
+#include <unistd.h> /* STDOUT_FILENO, close, unlink */
+#include <getopt.h> /* getopt_long */
 
 
+static csprng rng;
 static mpz_t secret;
-static shamir_key **keys;
+static skey_set *keys;
+static sfield field;
+static int field_initialized;
+static int secret_marked; /* The secret has a 0x01 byte in front, see -B */
+
+/* The value getopt_long() returns for --stats, which has no short form */
+#define STATS_OPTION 0x100
 
 void (*(op_functions[]))(const struct arg *) = {
 	NULL,
 	generate_func,
-	decrypt_func
+	decrypt_func,
+	serve_func,
+	verify_func,
+	issue_func
 };
 
+static void report_stats(void)
+{
+	stats_report(stderr);
+}
+
 int main(int argc, char *argv[])
 {
 	/*
@@ -28,6 +56,12 @@ int main(int argc, char *argv[])
 
 	parse_arguments(argc, argv, &arg);
 
+	/* Before GMP allocates anything */
+	if (arg.stats) {
+		stats_enable();
+		atexit(report_stats);
+	}
+
 	/* Call the function based on the type of operation */
 	op_functions[arg.operation.operation](&arg);
 
@@ -38,14 +72,32 @@ void parse_arguments(int argc, char *argv[], struct arg *arg)
 {
 	extern char *optarg;
 	extern int optind, opterr, optopt;
-	const char *optstring = ":g:d:hfs";
-	int ch;
+	const char *optstring = ":g:d:D:a:m:b:o:j:H:c:p:r:hvfsSBil";
+	static const struct option longopts[] = {
+		{ "stats", no_argument, NULL, STATS_OPTION },
+		{ NULL,    0,           NULL, 0 }
+	};
+	int ch, mode_given = 0;
 	char *endptr;
 
 	arg->operation.operation = UNSPECIFIED_OP;
 	arg->argument.type  = UNSPECIFIED_ARG;
-
-	while ((ch = getopt(argc, argv, optstring)) != -1) {
+	arg->mode = PRIME_MODE;
+	arg->stream = 0;
+	arg->block_size = 0;
+	arg->output = NULL;
+	arg->binary = 0;
+	arg->seq = 0;
+	arg->batch = 0;
+	arg->threads = 1;
+	arg->stats = 0;
+	arg->hybrid = NULL;
+	arg->commitments = NULL;
+	arg->new_x = NULL;
+	arg->pack = 0;
+	arg->robust = 0;
+
+	while ((ch = getopt_long(argc, argv, optstring, longopts, NULL)) != -1) {
 		switch (ch) {
 
 		/* Operations */
@@ -56,7 +108,7 @@ void parse_arguments(int argc, char *argv[], struct arg *arg)
 
 		case 'g': /* Generate */
 			if (arg->operation.operation != UNSPECIFIED_OP)
-				usage_exit(argv[0], EXIT_FAILURE, "You can only specify -g or -d once");
+				usage_exit(argv[0], EXIT_FAILURE, "You can only specify one of -g, -d, -v, -a and -D");
 			arg->operation.operation = GENERATE;
 
 			arg->operation.arg.genkeys.keys_req = (unsigned) strtol(optarg, &endptr, 10);
@@ -102,7 +154,7 @@ void parse_arguments(int argc, char *argv[], struct arg *arg)
 
 		case 'd': /* Decrypt */
 			if (arg->operation.operation != UNSPECIFIED_OP)
-				usage_exit(argv[0], EXIT_FAILURE, "You can only specify -g or -d once");
+				usage_exit(argv[0], EXIT_FAILURE, "You can only specify one of -g, -d, -v, -a and -D");
 			arg->operation.operation = DECRYPT;
 
 			arg->operation.arg.n = (unsigned) strtol(optarg, &endptr, 10);
@@ -124,6 +176,136 @@ void parse_arguments(int argc, char *argv[], struct arg *arg)
 
 			break;
 
+		case 'D': /* Serve */
+			if (arg->operation.operation != UNSPECIFIED_OP)
+				usage_exit(argv[0], EXIT_FAILURE, "You can only specify one of -g, -d, -v, -a and -D");
+			arg->operation.operation = SERVE;
+			arg->operation.arg.socket = optarg;
+			break;
+
+		case 'v': /* Verify */
+			if (arg->operation.operation != UNSPECIFIED_OP)
+				usage_exit(argv[0], EXIT_FAILURE, "You can only specify one of -g, -d, -v, -a and -D");
+			arg->operation.operation = VERIFY;
+			break;
+
+		case 'a': /* Issue new keys */
+			if (arg->operation.operation != UNSPECIFIED_OP)
+				usage_exit(argv[0], EXIT_FAILURE, "You can only specify one of -g, -d, -v, -a and -D");
+			arg->operation.operation = ISSUE;
+			arg->new_x = optarg;
+			break;
+
+
+		/* Sharing mode */
+
+		case 'm':
+			mode_given = 1;
+			if (strcmp(optarg, "prime") == 0) {
+				arg->mode = PRIME_MODE;
+			} else if (strcmp(optarg, "integer") == 0) {
+				arg->mode = INTEGER_MODE;
+			} else if (strcmp(optarg, "gf256") == 0) {
+				arg->mode = GF256_MODE;
+			} else {
+				fprintf(stderr, "%s: -m: Unknown mode: %s.\n\n",
+					argv[0], optarg);
+				usage_exit(argv[0], EXIT_FAILURE, NULL);
+			}
+			break;
+
+
+		/* Streaming */
+
+		case 'S':
+			arg->stream = 1;
+			break;
+
+		case 'b':
+			arg->block_size = (size_t) strtoul(optarg, &endptr, 10);
+			if (endptr == optarg || *endptr || arg->block_size == 0) {
+				fprintf(stderr, "%s: -b: %s is not a valid block size.\n\n",
+					argv[0], optarg);
+				usage_exit(argv[0], EXIT_FAILURE, NULL);
+			}
+			break;
+
+		case 'o':
+			arg->output = optarg;
+			break;
+
+
+		/* Key format */
+
+		case 'B':
+			arg->binary = 1;
+			break;
+
+		case 'i':
+			arg->seq = 1;
+			break;
+
+
+		/* Batch mode */
+
+		case 'l':
+			arg->batch = 1;
+			break;
+
+		case 'p':
+			arg->pack = (unsigned) strtoul(optarg, &endptr, 10);
+			if (endptr == optarg || *endptr || arg->pack < 2) {
+				fprintf(stderr, "%s: -p: %s is not a valid number of secrets (at least 2).\n\n",
+					argv[0], optarg);
+				usage_exit(argv[0], EXIT_FAILURE, NULL);
+			}
+			break;
+
+
+		/* Threads */
+
+		case 'j':
+			arg->threads = (unsigned) strtoul(optarg, &endptr, 10);
+			if (endptr == optarg || *endptr || arg->threads == 0) {
+				fprintf(stderr, "%s: -j: %s is not a valid number of threads.\n\n",
+					argv[0], optarg);
+				usage_exit(argv[0], EXIT_FAILURE, NULL);
+			}
+			break;
+
+
+		/* Hybrid sharing */
+
+		case 'H':
+			arg->hybrid = optarg;
+			break;
+
+
+		/* Verifiable sharing */
+
+		case 'c':
+			arg->commitments = optarg;
+			break;
+
+
+		/* Error correction */
+
+		case 'r':
+			arg->robust = (unsigned) strtoul(optarg, &endptr, 10);
+			if (endptr == optarg || *endptr || arg->robust == 0) {
+				fprintf(stderr, "%s: -r: %s is not a valid number of keys.\n\n",
+					argv[0], optarg);
+				usage_exit(argv[0], EXIT_FAILURE, NULL);
+			}
+			break;
+
+
+		/* Statistics */
+
+		case STATS_OPTION:
+			arg->stats = 1;
+			break;
+
 
 		/* Input types */
 
@@ -155,11 +337,104 @@ void parse_arguments(int argc, char *argv[], struct arg *arg)
 	}
 
 	if (arg->operation.operation == UNSPECIFIED_OP)
-		usage_exit(argv[0], EXIT_FAILURE, "You must specify an operation (-g or -d)");
+		usage_exit(argv[0], EXIT_FAILURE, "You must specify an operation (-g, -d, -v, -a or -D)");
+
+	/* Everything else comes with the requests */
+	if (arg->operation.operation == SERVE) {
+		if (arg->argument.type != UNSPECIFIED_ARG || arg->stream
+				|| arg->block_size || arg->output || arg->binary
+				|| arg->seq || arg->batch || arg->hybrid
+				|| arg->commitments || mode_given || arg->pack
+				|| arg->robust)
+			usage_exit(argv[0], EXIT_FAILURE, "-D only takes -j and --stats");
+		if (optind != argc)
+			usage_exit(argv[0], EXIT_FAILURE, "-D takes no ARGUMENT");
+
+		fprintf(stderr, "Operation: SERVE.\nSocket: <%s>.\n",
+			arg->operation.arg.socket);
+		if (arg->threads > 1)
+			fprintf(stderr, "Threads: %u.\n", arg->threads);
+		if (arg->stats)
+			fputs("Statistics: ON.\n", stderr);
+		fputc('\n', stderr);
+		return;
+	}
 
 	if (arg->argument.type == UNSPECIFIED_ARG)
 		usage_exit(argv[0], EXIT_FAILURE, "You must specify an input type (-f or -s)");
 
+	if (arg->stream && arg->argument.type != FILENAME)
+		usage_exit(argv[0], EXIT_FAILURE, "-S only works with files (-f)");
+
+	if (arg->stream && arg->operation.operation == GENERATE && !arg->output)
+		usage_exit(argv[0], EXIT_FAILURE, "-S -g needs an output prefix (-o)");
+
+	if (arg->block_size && !arg->stream)
+		usage_exit(argv[0], EXIT_FAILURE, "-b only makes sense with -S");
+
+	if (arg->binary && arg->operation.operation != GENERATE)
+		usage_exit(argv[0], EXIT_FAILURE, "-B only makes sense with -g, -d reads both formats");
+
+	if (arg->batch && arg->argument.type != FILENAME)
+		usage_exit(argv[0], EXIT_FAILURE, "-l only works with files (-f)");
+
+	if (arg->batch && (arg->stream || arg->binary))
+		usage_exit(argv[0], EXIT_FAILURE, "-l can't be used with -S or -B");
+
+	if (arg->pack && (arg->operation.operation != GENERATE
+			|| !arg->batch || arg->mode != PRIME_MODE))
+		usage_exit(argv[0], EXIT_FAILURE, "-p only works with -g -l, in prime mode; -d reads packed keys by themselves");
+
+	if (arg->pack && arg->pack >= arg->operation.arg.genkeys.keys_req)
+		usage_exit(argv[0], EXIT_FAILURE, "-p: PACK must be less than KEYS_REQ");
+
+	if (arg->hybrid && (arg->stream || arg->batch))
+		usage_exit(argv[0], EXIT_FAILURE, "-H can't be used with -S or -l");
+
+	if (arg->hybrid && arg->operation.operation == GENERATE
+			&& arg->argument.type != FILENAME)
+		usage_exit(argv[0], EXIT_FAILURE, "-g -H only works with files (-f)");
+
+	if (arg->hybrid && strncmp(arg->hybrid, "-", 2) == 0)
+		usage_exit(argv[0], EXIT_FAILURE, "-H needs a file, not standard input or output");
+
+	if (arg->commitments && arg->operation.operation != GENERATE
+			&& arg->operation.operation != VERIFY)
+		usage_exit(argv[0], EXIT_FAILURE, "-c only makes sense with -g and -v");
+
+	if (arg->commitments && arg->operation.operation == GENERATE
+			&& (arg->mode != PRIME_MODE || arg->stream || arg->batch))
+		usage_exit(argv[0], EXIT_FAILURE, "-g -c only works in prime mode, without -S or -l");
+
+	if (arg->operation.operation == VERIFY && !arg->commitments)
+		usage_exit(argv[0], EXIT_FAILURE, "-v needs the commitments (-c)");
+
+	if (arg->operation.operation == VERIFY
+			&& (arg->stream || arg->batch || arg->hybrid || arg->output))
+		usage_exit(argv[0], EXIT_FAILURE, "-v can't be used with -S, -l, -H or -o");
+
+	if (arg->operation.operation == ISSUE
+			&& (arg->stream || arg->batch || arg->hybrid || arg->output))
+		usage_exit(argv[0], EXIT_FAILURE, "-a can't be used with -S, -l, -H or -o");
+
+	if (arg->robust && (arg->operation.operation != DECRYPT
+			|| arg->stream || arg->batch))
+		usage_exit(argv[0], EXIT_FAILURE, "-r only works with -d, without -S or -l");
+
+	if (arg->robust && arg->operation.operation == DECRYPT
+			&& arg->robust > arg->operation.arg.n)
+		usage_exit(argv[0], EXIT_FAILURE, "-r: KEYS_REQ must be at most N_KEYS");
+
+	if (arg->seq && arg->operation.operation != GENERATE)
+		usage_exit(argv[0], EXIT_FAILURE, "-i only makes sense with -g");
+
+	if (arg->binary && !arg->output)
+		usage_exit(argv[0], EXIT_FAILURE, "-B needs an output prefix (-o)");
+
+	if (arg->output && !arg->stream && !arg->binary && !arg->batch
+			&& arg->operation.operation == GENERATE)
+		usage_exit(argv[0], EXIT_FAILURE, "-o only makes sense with -S, -B or -l when generating");
+
 	switch (arg->operation.operation) {
 		case GENERATE:
 			if (optind == argc)
@@ -172,7 +447,9 @@ void parse_arguments(int argc, char *argv[], struct arg *arg)
 		case DECRYPT:
 			if (optind == argc)
 				usage_exit(argv[0], EXIT_FAILURE, "-d needs arguments (the keys)");
-			if ((unsigned) (argc - optind) != arg->operation.arg.n) {
+			if (arg->batch && optind + 1 < argc)
+				usage_exit(argv[0], EXIT_FAILURE, "-d -l needs only one argument (the file of keys)");
+			if (!arg->batch && (unsigned) (argc - optind) != arg->operation.arg.n) {
 				fprintf(stderr, "%s: -d: argument number mismatch. Expected %u, got %d.\n\n",
 					argv[0], arg->operation.arg.n, argc - optind);
 				usage_exit(argv[0], EXIT_FAILURE, NULL);
@@ -180,6 +457,20 @@ void parse_arguments(int argc, char *argv[], struct arg *arg)
 			arg->argument.value.keys = (const char **) argv + optind;
 			break;
 
+		case VERIFY:
+			if (optind == argc)
+				usage_exit(argv[0], EXIT_FAILURE, "-v needs arguments (the keys)");
+			arg->operation.arg.n = (unsigned) (argc - optind);
+			arg->argument.value.keys = (const char **) argv + optind;
+			break;
+
+		case ISSUE:
+			if (optind == argc)
+				usage_exit(argv[0], EXIT_FAILURE, "-a needs arguments (the keys)");
+			arg->operation.arg.n = (unsigned) (argc - optind);
+			arg->argument.value.keys = (const char **) argv + optind;
+			break;
+
 		case UNSPECIFIED_OP: /* Can't happen */
 		default:
 			break;
@@ -187,17 +478,59 @@ void parse_arguments(int argc, char *argv[], struct arg *arg)
 
 	fputs("Printing argument parsing results:\n", stderr);
 	fprintf(stderr, "Operation: %s.\n",
-		arg->operation.operation == GENERATE ? "GENERATE" : "DECRYPT");
+		arg->operation.operation == GENERATE ? "GENERATE"
+		: arg->operation.operation == DECRYPT ? "DECRYPT"
+		: arg->operation.operation == VERIFY ? "VERIFY" : "ISSUE");
 
 	fputs("Operation paramaters:\n", stderr);
 	if (arg->operation.operation == GENERATE) {
 		fprintf(stderr, "\tKEYS_REQ = %u.\n\tN_KEYS   = %u.\n",
 			arg->operation.arg.genkeys.keys_req,
 			arg->operation.arg.genkeys.n_keys);
-	} else { /* DECRYPT */
+	} else if (arg->operation.operation == DECRYPT) {
 		fprintf(stderr, "N_KEYS = %u\n", arg->operation.arg.n);
+	} else if (arg->operation.operation == ISSUE) {
+		fprintf(stderr, "New x values: <%s>.\n", arg->new_x);
 	}
 
+	fprintf(stderr, "Mode: %s.\n",
+		arg->mode == PRIME_MODE ? "PRIME"
+		: arg->mode == INTEGER_MODE ? "INTEGER" : "GF256");
+
+	if (arg->stream)
+		fprintf(stderr, "Streaming, block size: %lu.\n",
+			(long unsigned) arg->block_size);
+
+	if (arg->output)
+		fprintf(stderr, "Output: <%s>.\n", arg->output);
+
+	if (arg->binary)
+		fputs("Key format: BINARY.\n", stderr);
+
+	if (arg->seq)
+		fputs("x values: 1, ..., N_KEYS.\n", stderr);
+
+	if (arg->batch)
+		fputs("Batch mode.\n", stderr);
+
+	if (arg->pack)
+		fprintf(stderr, "Packing: %u secrets per polynomial.\n", arg->pack);
+
+	if (arg->hybrid)
+		fprintf(stderr, "Hybrid, payload: <%s>.\n", arg->hybrid);
+
+	if (arg->commitments)
+		fprintf(stderr, "Commitments: <%s>.\n", arg->commitments);
+
+	if (arg->robust)
+		fprintf(stderr, "Error correction, KEYS_REQ = %u.\n", arg->robust);
+
+	if (arg->threads > 1)
+		fprintf(stderr, "Threads: %u.\n", arg->threads);
+
+	if (arg->stats)
+		fputs("Statistics: ON.\n", stderr);
+
 	fprintf(stderr, "Input type: %s.\n",
 		arg->argument.type == FILENAME ? "FILENAME" : "STRING");
 
@@ -208,9 +541,9 @@ void parse_arguments(int argc, char *argv[], struct arg *arg)
 			&& strncmp(arg->argument.value.secret, "-", 2) == 0
 				? "(STANDARD INPUT)"
 				: arg->argument.value.secret);
-	} else { /* DECRYPT */
+	} else { /* DECRYPT, VERIFY or ISSUE */
 		size_t i;
-		for (i = 0; i < arg->operation.arg.n; ++i)
+		for (i = 0; i < (arg->batch ? 1U : arg->operation.arg.n); ++i)
 			fprintf(stderr, "Argument %lu: <%s>.\n",
 				(long unsigned) i,
 				arg->argument.value.keys[i]);
@@ -227,11 +560,13 @@ void __attribute__((noreturn)) usage_exit(
 	fprintf(code == EXIT_SUCCESS ? stdout : stderr,
 		"%s%s%s"
 
-		"USAGE: %s <OPERATION> <INPUT TYPE> [--] <ARGUMENT>\n",
+		"USAGE: %s <OPERATION> [MODE] [STREAMING] [-H PAYLOAD] [-c COMMITMENTS] [-r KEYS_REQ] [--stats] <INPUT TYPE> [--] <ARGUMENT>\n"
+		"       %s -D SOCKET [-j THREADS] [--stats]\n",
 
 		error ? "Error: " : "",
 		error ? error : "",
 		error ? ".\n\n" : "",
+		progname,
 		progname);
 
 	/* Broken up into multiple calls because ISO C90 compilers are only
@@ -246,12 +581,171 @@ void __attribute__((noreturn)) usage_exit(
 
 		"\t-d N_KEYS:\n"
 		"\t\tUse the N_KEYS keys specified in the ARGUMENTs to decrypt the secret.\n"
+		"\t\tThe mode the keys were generated in is read from the keys themselves.\n"
 
 		"\t-h:\n"
 		"\t\tShow this help.\n",
 
 		stderr);
 
+	fputs(
+		"\t-D SOCKET:\n"
+		"\t\tServe split and combine requests on the Unix domain socket SOCKET,\n"
+		"\t\tuntil interrupted. The mode and the keys come with every request;\n"
+		"\t\tsee server.h for the protocol. Only -j and --stats may be given as well:\n"
+		"\t\tTHREADS requests are answered at a time.\n"
+
+		"\t-v:\n"
+		"\t\tCheck the keys in the ARGUMENTs against the commitments of -c.\n"
+		"\t\tWith -f, every line of every file is a key. The invalid keys are\n"
+		"\t\tprinted, and the exit status is 1 if there is any.\n",
+
+		stderr);
+
+	fputs(
+		"\t-a X[,X...]:\n"
+		"\t\tPrint new keys, at the given x values, for the secret the keys in the\n"
+		"\t\tARGUMENTs were generated for, without recovering it: the keys already\n"
+		"\t\thanded out stay valid. Give at least KEYS_REQ keys, or the new keys are\n"
+		"\t\twrong, and nothing can tell; -v tells, with commitments. With -f, every\n"
+		"\t\tline of every file is a key. Not with -S, -l, -H or -o.\n",
+
+		stderr);
+
+	fputs(
+		"\nMODE:\n"
+
+		"\t-m prime:\n"
+		"\t\tDo all the arithmetic modulo a Mersenne prime large enough to hold the secret.\n"
+		"\t\tThis is the default.\n"
+
+		"\t-m integer:\n"
+		"\t\tEvaluate the polynomial over the integers.\n"
+
+		"\t-m gf256:\n"
+		"\t\tShare every byte of the secret on its own, in GF(2^8). At most 255 keys.\n"
+		"\t\t-d writes the bytes of the secret rather than a number, followed by\n"
+		"\t\ta newline with -s and no -o.\n",
+
+		stderr);
+
+	fputs(
+		"\t-i:\n"
+		"\t\tWith -g, give the keys the x values 1, ..., N_KEYS instead of random ones.\n"
+		"\t\tThe keys are shorter, and faster to generate and to combine.\n",
+
+		stderr);
+
+	fputs(
+		"\nSTREAMING:\n"
+
+		"\t-S:\n"
+		"\t\tShare the secret block by block, in constant memory. Needs -f.\n"
+		"\t\tWith -g, key i is written to the file OUTPUT.i, one line per block.\n"
+		"\t\tWith -d, the key files are read in lockstep and the secret is written\n"
+		"\t\tto OUTPUT (or to standard output) block by block.\n",
+
+		stderr);
+
+	fputs(
+		"\t-b BLOCK_SIZE:\n"
+		"\t\tThe size of a block, in bytes. Defaults to 64 (65536 for gf256).\n"
+
+		"\t-o OUTPUT:\n"
+		"\t\tWhere to write the output. See -S.\n"
+		"\t\tWithout -S, -d writes the bytes of the secret to OUTPUT instead of\n"
+		"\t\tprinting it as a number, giving back the file shared with -g -f.\n"
+		"\t\tIn prime and integer modes, -g -f refuses a file that starts with a\n"
+		"\t\tzero byte, which a number can't keep: use -m gf256, -H or -B for those.\n",
+
+		stderr);
+
+	fputs(
+		"\t-B:\n"
+		"\t\tWith -g, write key i to the file OUTPUT.i in a compact binary format,\n"
+		"\t\twith a header saying how it was generated, instead of printing it.\n"
+		"\t\tWith or without -S. -d recognizes these files by themselves.\n"
+
+		"\t-j THREADS:\n"
+		"\t\tSpread the generation of the keys over THREADS threads.\n"
+		"\t\tWith -D, answer THREADS requests at a time.\n",
+
+		stderr);
+
+	fputs(
+		"\nBATCH:\n"
+
+		"\t-l:\n"
+		"\t\tProcess many secrets at once. Needs -f, and only one ARGUMENT.\n"
+		"\t\tWith -g, every line of ARGUMENT is a secret. The keys of each secret\n"
+		"\t\tare written one per line, followed by an empty line.\n"
+		"\t\tWith -d, ARGUMENT holds groups of keys separated by empty lines, and the\n"
+		"\t\tfirst N_KEYS keys of every group are combined into a line of output.\n"
+		"\t\tThe output goes to OUTPUT, or to standard output.\n",
+
+		stderr);
+
+	fputs(
+		"\t-p PACK:\n"
+		"\t\tWith -g -l, in prime mode, share every PACK lines together, in one\n"
+		"\t\tpolynomial: every key then holds PACK secrets, for the cost of one.\n"
+		"\t\tKEYS_REQ keys recover them all, and KEYS_REQ - PACK keys tell nothing\n"
+		"\t\tabout them, but in between, they tell some. PACK < KEYS_REQ.\n"
+		"\t\t-d and -d -l recognize these keys, and print one secret per line.\n",
+
+		stderr);
+
+	fputs(
+		"\nHYBRID:\n"
+
+		"\t-H PAYLOAD:\n"
+		"\t\tWith -g, encrypt the secret with ChaCha20-Poly1305 under a random key,\n"
+		"\t\twrite it to the file PAYLOAD, and share only that 32-byte key. Needs -f.\n"
+		"\t\tWith -d, recover the key, check PAYLOAD with it, and only then decrypt\n"
+		"\t\tit to OUTPUT, or to standard output. Not with -S or -l. At most 256 GiB.\n",
+
+		stderr);
+
+	fputs(
+		"\nVERIFIABLE SHARING:\n"
+
+		"\t-c COMMITMENTS:\n"
+		"\t\tWith -g, also write to the file COMMITMENTS commitments to the polynomial\n"
+		"\t\t(Feldman's scheme), which anyone can check the keys against with -v.\n"
+		"\t\tOnly in prime mode, without -S or -l. The field is then at least\n"
+		"\t\tGF(2^127 - 1), and at most GF(2^1279 - 1).\n",
+
+		stderr);
+
+	fputs(
+		"\t\tThe commitments include g^secret, so a secret that can be guessed,\n"
+		"\t\tsuch as a password, can be found from them by trying every guess.\n"
+		"\t\tOnly use -c for random secrets, or with -H, where the keys share a\n"
+		"\t\trandom data key.\n",
+
+		stderr);
+
+	fputs(
+		"\nERROR CORRECTION:\n"
+
+		"\t-r KEYS_REQ:\n"
+		"\t\tWith -d, tell the secret even if some of the keys are wrong, and which\n"
+		"\t\tthey are, given the KEYS_REQ the keys were generated with: N_KEYS keys\n"
+		"\t\tget over (N_KEYS - KEYS_REQ) / 2 wrong ones. Only for keys in a prime\n"
+		"\t\tfield or in GF(2^8), one secret per polynomial, not with -S or -l.\n",
+
+		stderr);
+
+	fputs(
+		"\nSTATISTICS:\n"
+
+		"\t--stats:\n"
+		"\t\tWhen done, print to standard error how long every phase took, how many\n"
+		"\t\tbytes of secret went through and how fast, and how many allocations GMP\n"
+		"\t\tmade and how much memory it held at most. With -D, on shutdown.\n",
+
+		stderr);
+
 	fputs(
 		"\nINPUT TYPE:\n"
 
@@ -277,161 +771,1699 @@ void __attribute__((noreturn)) usage_exit(
 
 void init(void)
 {
+	const uint64_t t = stats_start();
+
 	/* Random state initialization */
-	skey_randinit();
+	if (csprng_init(&rng) == -1) {
+		fputs("No entropy available.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	stats_stop(STATS_RNG_INIT, t);
 }
 void clear(void)
 {
-	void *const k = keys;
-	/* Free the momory held by the random state variable */
-	skey_randfree();
+	/* Wipe the random state */
+	csprng_clear(&rng);
 	mpz_clear(secret);
-	if (!keys)
-		return;
-	while (*keys)
-		skey_free(*keys++);
-	free(k);
+	if (field_initialized) {
+		sfield_clear(&field);
+		field_initialized = 0;
+	}
+	skey_set_free(keys);
+	keys = NULL;
 }
 
-void generate_func(const struct arg *arg)
+/* Open filename for reading.
+ * Accept the filename "-" to mean standard input. */
+FILE *open_input(const char *filename)
 {
-	int ret;
-	const shamir_key **k;
+	FILE *f;
 
-	if (arg->operation.operation != GENERATE)
-		return;
+	if (strncmp(filename, "-", 2) == 0)
+		return stdin;
 
-	switch (arg->argument.type) {
+	f = fopen(filename, "rb");
+	if (!f) {
+		fprintf(stderr, "Failed to open file %s.\n", filename);
+		exit(EXIT_FAILURE);
+	}
 
-	char *secret_str; /* Perfectly legal, according the Standard, */
-	FILE *f;          /* so long as I don't try to initialize it. */
+	return f;
+}
 
-	case FILENAME:
+/* Open filename for writing.
+ * Accept the filename "-" to mean standard output. */
+FILE *open_output(const char *filename)
+{
+	FILE *f;
 
-		/* Accept the filename "-" to mean standard input */
-		if (strncmp(arg->argument.value.secret, "-", 2) == 0) {
-			f = stdin;
-		} else {
-			f = fopen(arg->argument.value.secret, "rb");
-			if (!f) {
-				fprintf(stderr, "Failed to open file %s.\n",
-					arg->argument.value.secret);
-				exit(EXIT_FAILURE);
-			}
-		}
+	if (strncmp(filename, "-", 2) == 0)
+		return stdout;
 
-		secret_str = hex_encode_file(f);
+	f = fopen(filename, "wb");
+	if (!f) {
+		fprintf(stderr, "Failed to open file %s.\n", filename);
+		exit(EXIT_FAILURE);
+	}
 
-		if (f != stdin) {
-			if (fclose(f) == EOF) {
-				free(secret_str);
-				fputs("flcose() returned EOF.\n", stderr);
-				exit(EXIT_FAILURE);
-			}
-		}
+	return f;
+}
 
-		if (!secret_str) {
-			fputs("hex_encode_file() returned NULL.\n", stderr);
-			exit(EXIT_FAILURE);
-		}
+/* Open the files OUTPUT.1 to OUTPUT.N_KEYS the keys are written to */
+static FILE **open_key_files(const struct arg *arg)
+{
+	const unsigned n_keys = arg->operation.arg.genkeys.n_keys;
+	const size_t name_size = strlen(arg->output) + 3 * sizeof n_keys + 2;
+	FILE **out;
+	char *name;
+	unsigned i;
+
+	out = malloc(n_keys * sizeof *out);
+	name = malloc(name_size);
+	if (!out || !name) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
 
-		if (mpz_init_set_str(secret, secret_str, 16) == -1) {
-			fputs("mpz_init_set_str() returned -1.\n", stderr);
-			fprintf(stderr, "secret_str = %s.\n", secret_str);
-			free(secret_str);
+	for (i = 0; i < n_keys; ++i) {
+		sprintf(name, "%s.%u", arg->output, i + 1U);
+		out[i] = fopen(name, "wb");
+		if (!out[i]) {
+			fprintf(stderr, "Failed to open file %s.\n", name);
 			exit(EXIT_FAILURE);
 		}
+	}
+	free(name);
 
-		free(secret_str);
-		break;
-
-	case STRING:
-		ret = mpz_init_set_str(secret, arg->argument.value.secret, 0);
-		if (ret == -1) {
-			fputs("mpz_init_set_str() returned -1.\n", stderr);
-			fprintf(stderr, "arg->argument.value.secret = %s.\n",
-				arg->argument.value.secret);
-			exit(EXIT_FAILURE);
-		}
+	return out;
+}
 
-		break;
+/* Close and free the files opened by open_key_files().
+ * Returns 0 on success. */
+static int close_key_files(FILE **out, unsigned n_keys)
+{
+	unsigned i;
+	int ret = 0;
 
-	default: /* Can't happen */
-		exit(EXIT_FAILURE);
+	for (i = 0; i < n_keys; ++i) {
+		if (fclose(out[i]) == EOF) {
+			fputs("fclose() returned EOF.\n", stderr);
+			ret = EXIT_FAILURE;
+		}
 	}
+	free(out);
 
-	init();
+	return ret;
+}
 
-	ret = skey_generate(
-		&keys,
-		secret,
-		arg->operation.arg.genkeys.keys_req,
-		arg->operation.arg.genkeys.n_keys);
+/* Write a key holding a single block to f, in the binary format */
+static int write_sharefile(FILE *f,
+		const struct sharefile_header *h,
+		mpz_srcptr x,
+		mpz_srcptr y)
+{
+	struct sharefile sf;
 
-	if (ret != 0) {
-		clear();
-		fputs("skey_generate failed.", stderr);
-		exit(EXIT_FAILURE);
+	if (sharefile_create(&sf, f, h, x) == -1 || sharefile_put(&sf, y) == -1) {
+		sharefile_release(&sf);
+		return -1;
 	}
 
-	/* Print the generated keys */
-	for (k = (const shamir_key **) keys; *k; k++)
-		skey_print(*k);
+	return sharefile_finish(&sf);
+}
 
+static int print_gf256_key(unsigned i,
+		unsigned char x,
+		const unsigned char *y,
+		size_t len,
+		void *data)
+{
+	const uint64_t t = stats_start();
+	int ret;
 
-	/* Remember to free stuff */
-	clear();
+	(void) i;
+	ret = gf256_fprint_key(data, x, y, len);
 
+	stats_stop(STATS_OUTPUT, t);
+	return ret;
 }
-void decrypt_func(const struct arg *arg)
-{
-	if (arg->operation.operation != DECRYPT)
+
+/* Where write_gf256_sharefile() writes the keys */
+struct gf256_keyfiles {
+	FILE **out;
+	unsigned keys_req;
+};
+
+static int write_gf256_sharefile(unsigned i,
+		unsigned char x,
+		const unsigned char *y,
+		size_t len,
+		void *data)
+{
+	const struct gf256_keyfiles *const kf = data;
+	const uint64_t t = stats_start();
+	struct sharefile_header h;
+	struct sharefile sf;
+	mpz_t xz;
+	int ret = -1;
+
+	h.mode = GF256_MODE;
+	h.flags = 0;
+	h.keys_req = kf->keys_req;
+	h.index = i + 1UL;
+	h.e = 0;
+
+	mpz_init_set_ui(xz, x);
+	if (sharefile_create(&sf, kf->out[i], &h, xz) == 0
+			&& sharefile_put_bytes(&sf, y, len) == 0)
+		ret = sharefile_finish(&sf);
+	else
+		sharefile_release(&sf);
+	mpz_clear(xz);
+
+	stats_stop(STATS_OUTPUT, t);
+	return ret;
+}
+
+/* Share the len bytes of s in GF(2^8), printing the keys, or writing them
+ * to OUTPUT.i with -B. rng must be initialized.
+ * Returns 0 on success. */
+static int share_gf256(const struct arg *arg,
+		const unsigned char *s,
+		size_t len)
+{
+	int (*const generate)(csprng *, const unsigned char *, size_t,
+			unsigned, unsigned, gf256_emit_func, void *)
+		= arg->seq ? gf256_generate_seq : gf256_generate;
+	struct gf256_keyfiles kf;
+	int ret;
+
+	if (arg->binary) {
+		kf.out = open_key_files(arg);
+		kf.keys_req = arg->operation.arg.genkeys.keys_req;
+
+		ret = generate(&rng, s, len,
+			arg->operation.arg.genkeys.keys_req,
+			arg->operation.arg.genkeys.n_keys,
+			write_gf256_sharefile,
+			&kf);
+
+		if (close_key_files(kf.out, arg->operation.arg.genkeys.n_keys) != 0)
+			ret = EXIT_FAILURE;
+	} else {
+		ret = generate(&rng, s, len,
+			arg->operation.arg.genkeys.keys_req,
+			arg->operation.arg.genkeys.n_keys,
+			print_gf256_key,
+			stdout);
+	}
+
+	if (ret != 0)
+		fputs("gf256_generate failed.\n", stderr);
+	return ret;
+}
+
+/* Generate the keys in GF(2^8) mode. The secret is taken byte by byte,
+ * without going through GMP. */
+static void generate_gf256(const struct arg *arg)
+{
+	unsigned char *secret_bytes = NULL;
+	const unsigned char *s;
+	size_t len;
+	FILE *f;
+	uint64_t t;
+	int ret;
+
+	t = stats_start();
+	if (arg->argument.type == FILENAME) {
+		f = open_input(arg->argument.value.secret);
+		secret_bytes = read_file(f, &len);
+		if (f != stdin)
+			fclose(f);
+		if (!secret_bytes) {
+			fputs("read_file() returned NULL.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		s = secret_bytes;
+	} else {
+		s = (const unsigned char *) arg->argument.value.secret;
+		len = strlen(arg->argument.value.secret);
+	}
+	stats_stop(STATS_INPUT, t);
+	stats_add_bytes(len);
+
+	if (len == 0) {
+		free(secret_bytes);
+		fputs("The secret must not be empty.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	init();
+	ret = share_gf256(arg, s, len);
+
+	csprng_clear(&rng);
+	if (secret_bytes) {
+		memset(secret_bytes, 0, len);
+		free(secret_bytes);
+	}
+
+	if (ret != 0)
+		exit(EXIT_FAILURE);
+}
+
+/* Generate the keys block by block (-S), writing key i to OUTPUT.i */
+static void generate_stream(const struct arg *arg)
+{
+	const unsigned n_keys = arg->operation.arg.genkeys.n_keys;
+	size_t block_size = arg->block_size;
+	FILE **out;
+	FILE *in;
+	int ret;
+
+	if (!block_size)
+		block_size = arg->mode == GF256_MODE
+			? STREAM_GF256_BLOCK_SIZE
+			: STREAM_MPZ_BLOCK_SIZE;
+
+	out = open_key_files(arg);
+
+	in = open_input(arg->argument.value.secret);
+
+	init();
+	skey_use_threads(arg->threads);
+
+	ret = stream_generate(&rng, in, out,
+		arg->operation.arg.genkeys.keys_req,
+		n_keys,
+		arg->mode,
+		block_size,
+		(arg->binary ? STREAM_BINARY : 0U) | (arg->seq ? STREAM_SEQ_X : 0U));
+
+	csprng_clear(&rng);
+
+	if (in != stdin)
+		fclose(in);
+	if (close_key_files(out, n_keys) != 0)
+		ret = EXIT_FAILURE;
+
+	if (ret != 0) {
+		fputs("stream_generate failed.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Generate the keys of, or recover, every secret of the batch file
+ * ARGUMENT, writing to OUTPUT or to standard output */
+static void run_batch(const struct arg *arg)
+{
+	FILE *const in = open_input(arg->operation.operation == GENERATE
+		? arg->argument.value.secret
+		: arg->argument.value.keys[0]);
+	FILE *const out = arg->output ? open_output(arg->output) : stdout;
+	int ret;
+
+	if (arg->operation.operation == GENERATE) {
+		init();
+		skey_use_threads(arg->threads);
+
+		ret = batch_generate(&rng, in, out,
+			arg->operation.arg.genkeys.keys_req,
+			arg->operation.arg.genkeys.n_keys,
+			arg->mode,
+			arg->seq,
+			arg->pack);
+
+		csprng_clear(&rng);
+	} else {
+		ret = batch_combine(in, out, arg->operation.arg.n);
+	}
+
+	if (in != stdin)
+		fclose(in);
+	if (out != stdout && fclose(out) == EOF) {
+		fputs("fclose() returned EOF.\n", stderr);
+		ret = EXIT_FAILURE;
+	}
+
+	if (ret != 0)
+		exit(EXIT_FAILURE);
+}
+
+/* Share secret in arg->mode, printing the keys, or writing them to
+ * OUTPUT.i with -B. rng must be initialized; everything is cleared once
+ * the keys are out. */
+static void share_secret(const struct arg *arg)
+{
+	mp_bitcnt_t bits = mpz_sizeinbase(secret, 2);
+	FILE *commit_out = NULL;
+	vss commit;
+	uint64_t t;
+	int ret = 0;
+	size_t i;
+
+	if (arg->mode == PRIME_MODE) {
+		if (mpz_sgn(secret) < 0) {
+			clear();
+			fputs("The secret must not be negative in prime mode.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		/* The commitments are only binding in a large enough field */
+		if (arg->commitments && bits < VSS_MIN_E - 1)
+			bits = VSS_MIN_E - 1;
+		if (sfield_init(&field, bits) == -1) {
+			clear();
+			fputs("The secret is too large for prime mode.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		field_initialized = 1;
+	}
+
+	if (arg->commitments) {
+		if (vss_init(&commit, &field,
+				arg->operation.arg.genkeys.keys_req) == -1) {
+			clear();
+			fputs("The secret is too large for -c.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		commit_out = open_output(arg->commitments);
+	}
+
+	skey_use_threads(arg->threads);
+
+	if (arg->commitments)
+		ret = skey_generate_vss(
+			&keys,
+			&rng,
+			secret,
+			arg->operation.arg.genkeys.keys_req,
+			arg->operation.arg.genkeys.n_keys,
+			arg->seq,
+			&field,
+			&commit);
+	else
+		ret = (arg->seq ? skey_generate_seq : skey_generate)(
+			&keys,
+			&rng,
+			secret,
+			arg->operation.arg.genkeys.keys_req,
+			arg->operation.arg.genkeys.n_keys,
+			field_initialized ? &field : NULL);
+
+	if (ret != 0) {
+		clear();
+		fputs("skey_generate failed.", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	t = stats_start();
+	if (arg->binary) {
+		FILE **out = open_key_files(arg);
+		struct sharefile_header h;
+		mpz_t xv, yv;
+
+		h.mode = arg->mode;
+		h.flags = secret_marked ? SHAREFILE_MARKED : 0U;
+		h.keys_req = arg->operation.arg.genkeys.keys_req;
+		h.e = field_initialized ? (unsigned long) field.e : 0UL;
+
+		for (i = 0; i < keys->count; ++i) {
+			h.index = i + 1UL;
+			if (write_sharefile(out[i], &h, skey_set_x(keys, i, xv),
+					skey_set_y(keys, i, yv)) == -1) {
+				fprintf(stderr, "Failed to write key %lu.\n",
+					(long unsigned) i + 1U);
+				ret = EXIT_FAILURE;
+			}
+		}
+
+		if (close_key_files(out, (unsigned) keys->count) != 0)
+			ret = EXIT_FAILURE;
+	} else {
+		/* Print the generated keys, bypassing stdio */
+		fflush(stdout);
+		if (skey_write(STDOUT_FILENO, keys,
+				field_initialized ? &field : NULL) != 0)
+			ret = EXIT_FAILURE;
+	}
+
+	if (commit_out) {
+		if (vss_write(commit_out, &commit) == -1
+				|| (commit_out != stdout && fclose(commit_out) == EOF)) {
+			fprintf(stderr, "Failed to write the commitments to %s.\n",
+				arg->commitments);
+			ret = EXIT_FAILURE;
+		}
+		vss_clear(&commit);
+	}
+	stats_stop(STATS_OUTPUT, t);
+
+
+	/* Remember to free stuff */
+	clear();
+
+	if (ret != 0)
+		exit(EXIT_FAILURE);
+}
+
+/* Encrypt the secret to PAYLOAD under a random data key, and share the
+ * data key instead of the secret (-H) */
+static void generate_hybrid(const struct arg *arg)
+{
+	unsigned char key[HYBRID_KEY_SIZE];
+	FILE *in, *payload;
+	uint64_t t;
+	int ret;
+
+	in = open_input(arg->argument.value.secret);
+	payload = open_output(arg->hybrid);
+
+	init();
+	csprng_bytes(&rng, key, sizeof key);
+
+	t = stats_start();
+	ret = hybrid_encrypt(in, payload, key);
+	stats_stop(STATS_INPUT, t);
+
+	if (in != stdin)
+		fclose(in);
+	if (fclose(payload) == EOF) {
+		perror("fclose");
+		ret = EXIT_FAILURE;
+	}
+
+	if (ret != 0) {
+		memset(key, 0, sizeof key);
+		csprng_clear(&rng);
+		fprintf(stderr, "Failed to write the payload %s.\n", arg->hybrid);
+		exit(EXIT_FAILURE);
+	}
+
+	if (arg->mode == GF256_MODE) {
+		ret = share_gf256(arg, key, sizeof key);
+		memset(key, 0, sizeof key);
+		csprng_clear(&rng);
+		if (ret != 0)
+			exit(EXIT_FAILURE);
+		return;
+	}
+
+	/* The key, most significant byte first, the way -g -f reads files */
+	mpz_init(secret);
+	mpz_import(secret, sizeof key, 1, 1, 0, 0, key);
+	memset(key, 0, sizeof key);
+	share_secret(arg);
+}
+
+void generate_func(const struct arg *arg)
+{
+	uint64_t t;
+	int ret;
+
+	if (arg->operation.operation != GENERATE)
+		return;
+
+	if (arg->stream) {
+		generate_stream(arg);
+		return;
+	}
+
+	if (arg->batch) {
+		run_batch(arg);
+		return;
+	}
+
+	if (arg->hybrid) {
+		generate_hybrid(arg);
 		return;
+	}
+
+	if (arg->mode == GF256_MODE) {
+		generate_gf256(arg);
+		return;
+	}
+
+	t = stats_start();
+	switch (arg->argument.type) {
+
+	unsigned char *data; /* Perfectly legal, according the Standard, */
+	size_t size;         /* so long as I don't try to initialize them. */
+	FILE *f;
+
+	case FILENAME:
+
+		f = open_input(arg->argument.value.secret);
+
+		data = read_file(f, &size);
+
+		if (f != stdin) {
+			if (fclose(f) == EOF) {
+				free(data);
+				fputs("flcose() returned EOF.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		if (!data) {
+			fputs("read_file() returned NULL.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+
+		/* A number has no leading zero bytes: -d -o would lose them.
+		 * Key files keep them, behind the 0x01 byte of -S, which
+		 * combining them strips. */
+		if (size > 0 && data[0] == 0 && !arg->binary) {
+			memset(data, 0, size);
+			free(data);
+			fputs("The file starts with a zero byte, which a number can't keep: share it with -m gf256, -H or -B.\n",
+				stderr);
+			exit(EXIT_FAILURE);
+		}
+
+		/* The bytes of the file are the secret, most significant first */
+		mpz_init(secret);
+		mpz_import(secret, size, 1, 1, 0, 0, data);
+		if (arg->binary) {
+			mpz_setbit(secret, (mp_bitcnt_t) size * CHAR_BIT);
+			secret_marked = 1;
+		}
+		stats_add_bytes(size);
+
+		memset(data, 0, size);
+		free(data);
+		break;
+
+	case STRING:
+		ret = mpz_init_set_str(secret, arg->argument.value.secret, 0);
+		if (ret == -1) {
+			fputs("mpz_init_set_str() returned -1.\n", stderr);
+			fprintf(stderr, "arg->argument.value.secret = %s.\n",
+				arg->argument.value.secret);
+			exit(EXIT_FAILURE);
+		}
+		stats_add_bytes(strlen(arg->argument.value.secret));
+
+		break;
+
+	default: /* Can't happen */
+		exit(EXIT_FAILURE);
+	}
+	stats_stop(STATS_INPUT, t);
+
+	init();
+	share_secret(arg);
+}
 
-	/* TODO: write me! */
+/* Get the text of the i-th key: the argument itself, or the first line of
+ * the file it names.
+ * The returned string must be freed. */
+static char *get_key_str(const struct arg *arg, size_t i)
+{
+	const char *const a = arg->argument.value.keys[i];
+	unsigned char *data;
+	char *str, *nl;
+	size_t len;
+	FILE *f;
+
+	if (arg->argument.type == STRING) {
+		len = strlen(a);
+		data = malloc(len + 1);
+		if (!data) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(data, a, len);
+	} else {
+		f = open_input(a);
+		data = read_file(f, &len);
+		if (f != stdin)
+			fclose(f);
+		if (!data) {
+			fprintf(stderr, "Failed to read key file %s.\n", a);
+			exit(EXIT_FAILURE);
+		}
+		str = realloc(data, len + 1);
+		if (!str) {
+			free(data);
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		data = (unsigned char *) str;
+	}
+
+	str = (char *) data;
+	str[len] = '\0';
+	nl = strpbrk(str, "\r\n");
+	if (nl)
+		*nl = '\0';
+
+	return str;
 }
 
-/* Do a hexdump of f */
-char *hex_encode_file(FILE *f)
+/* Tell which of the keys robust_combine() or robust_combine_gf256() found
+ * to be wrong, by their place among the ARGUMENTs, from 1: the keys can be
+ * far too long to print */
+static void report_bad(const unsigned char *bad, size_t n)
 {
-	static const char *hex_chars = "0123456789ABCDEF";
-	char buf[BUFSIZ];
-	char *hexdump = NULL;
-	size_t size = 0; /* The total size of hexdump */
-	size_t r;        /* The number of bytes read into the buffer */
+	size_t i;
 
-	while ((r = fread(buf, 1, sizeof buf, f)) > 0) {
-		/* If r < sizeof buf then this is the last iteration,
-		 * so allocate one extra byte to null-terminate the output
-		 * string */
-		const size_t new_size = size + 2 * r + (r < sizeof buf);
-		char *hd = realloc(hexdump, new_size);
-		size_t i;
+	for (i = 0; i < n; ++i)
+		if (bad[i])
+			fprintf(stderr, "Key %lu is corrupted.\n",
+				(long unsigned) i + 1);
+}
 
-		if (!hd) {
-			/* No need to check if hexdump is NULL.
-			 * ISO/IEC 9899:TC2 7.20.3.2-2 says so. */
-			free(hexdump);
-			return NULL;
+/* Combine keys printed by print_gf256_key(), and write the secret's bytes
+ * to out. If robust is not 0, it is the KEYS_REQ of the keys, and the wrong
+ * ones are corrected, and reported. */
+static int decrypt_gf256(char *const *key_strs, size_t n, unsigned robust,
+		FILE *out)
+{
+	const size_t len = gf256_key_len(key_strs[0]);
+	unsigned char x[GF256_MAX_KEYS], bad[GF256_MAX_KEYS];
+	unsigned char *data, *secret_bytes;
+	const unsigned char **y;
+	size_t i;
+	uint64_t t;
+	int ret = EXIT_FAILURE;
+
+	if (n > GF256_MAX_KEYS) {
+		fprintf(stderr, "At most %u GF(2^8) keys can be combined.\n",
+			GF256_MAX_KEYS);
+		return EXIT_FAILURE;
+	}
+
+	/* One buffer for the n keys and the secret */
+	data = malloc((n + 1) * len + 1);
+	y = malloc(n * sizeof *y);
+	if (!data || !y) {
+		perror("malloc");
+		free(data);
+		free(y);
+		return EXIT_FAILURE;
+	}
+	secret_bytes = data + n * len;
+
+	t = stats_start();
+	for (i = 0; i < n; ++i) {
+		if (gf256_key_len(key_strs[i]) != len
+				|| gf256_parse_key(key_strs[i], x + i,
+					data + i * len, len) == -1) {
+			fprintf(stderr, "Invalid GF(2^8) key: %s.\n", key_strs[i]);
+			goto out;
+		}
+		y[i] = data + i * len;
+	}
+	stats_stop(STATS_INPUT, t);
+
+	if (robust) {
+		if (robust_combine_gf256(secret_bytes, bad, x, y, len,
+				(unsigned) n, robust) == -1) {
+			fputs("Too many keys are corrupted, or two of them are the same.\n",
+				stderr);
+			goto out;
 		}
-		hexdump = hd;
-		hd = hexdump + size;
-		size = new_size;
+		report_bad(bad, n);
+	} else if (gf256_combine(secret_bytes, x, y, len, (unsigned) n) == -1) {
+		fputs("Two of the keys are the same.\n", stderr);
+		goto out;
+	}
+
+	t = stats_start();
+	if (fwrite(secret_bytes, 1, len, out) != len) {
+		perror("fwrite");
+		goto out;
+	}
+	stats_stop(STATS_OUTPUT, t);
+	stats_add_bytes(len);
+	ret = 0;
+
+out:
+	memset(data, 0, (n + 1) * len);
+	free(data);
+	free(y);
+	return ret;
+}
+
+/* Write the bytes of the non-negative secret to out, most significant first,
+ * the way -g -f read them in */
+static int write_secret(mpz_srcptr secret, FILE *out)
+{
+	size_t size = (mpz_sizeinbase(secret, 2) + CHAR_BIT - 1) / CHAR_BIT;
+	unsigned char *bytes;
+	int ret = 0;
+
+	if (mpz_sgn(secret) < 0) {
+		fputs("The secret is negative, and can't be written as bytes.\n",
+			stderr);
+		return EXIT_FAILURE;
+	}
 
-		for (i = 0; i < r; ++i) {
-			*hd++ = hex_chars[(buf[i] & 0xf0) >> 4];
-			*hd++ = hex_chars[buf[i] & 0x0f];
+	bytes = malloc(size);
+	if (!bytes) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+
+	mpz_export(bytes, &size, 1, 1, 0, 0, secret);
+	if (fwrite(bytes, 1, size, out) != size) {
+		perror("fwrite");
+		ret = EXIT_FAILURE;
+	}
+	stats_add_bytes(size);
+
+	memset(bytes, 0, size);
+	free(bytes);
+	return ret;
+}
+
+/* The robust part of decrypt_mpz(): correct the wrong keys of k, and write
+ * or print the secret as it does */
+static int decrypt_robust(const skey_set *k,
+		unsigned robust,
+		const sfield *fieldp,
+		FILE *out)
+{
+	unsigned char *bad;
+	mpz_t s;
+	uint64_t t;
+	int ret = EXIT_FAILURE;
+
+	if (!fieldp) {
+		fputs("-r only works with keys in a prime field or GF(2^8).\n",
+			stderr);
+		return EXIT_FAILURE;
+	}
+
+	bad = malloc(k->count);
+	if (!bad) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	mpz_init(s);
+
+	if (robust_combine(s, bad, k, robust, fieldp) == -1) {
+		fputs("Too many keys are corrupted, or two of them are the same.\n",
+			stderr);
+		goto out;
+	}
+	report_bad(bad, k->count);
+
+	t = stats_start();
+	if (out) {
+		ret = write_secret(s, out);
+	} else {
+		fputs("0x", stdout);
+		stats_add_bytes(mpz_out_str(stdout, 16, s));
+		putchar('\n');
+		ret = 0;
+	}
+	stats_stop(STATS_OUTPUT, t);
+
+out:
+	mpz_clear(s);
+	free(bad);
+	return ret;
+}
+
+/* Combine keys printed by skey_print(). The secret is written to out as
+ * bytes, or printed as a hexadecimal number if out is NULL. robust is as in
+ * decrypt_gf256(). */
+static int decrypt_mpz(char *const *key_strs, size_t n, unsigned robust,
+		FILE *out)
+{
+	skey_set *k = NULL;
+	mp_bitcnt_t e = 0;
+	sfield *fieldp = NULL;
+	mpz_t s;
+	char *secret_str = NULL;
+	size_t parsed;
+	uint64_t t;
+	int ret = EXIT_FAILURE;
+
+	t = stats_start();
+	parsed = skey_set_parse(&k, (const char *const *) key_strs, n, &e);
+	stats_stop(STATS_INPUT, t);
+	if (!k)
+		return EXIT_FAILURE;
+	if (parsed < n) {
+		fprintf(stderr, "Invalid key, or not from the same field as the others: %s.\n",
+			key_strs[parsed]);
+		goto out;
+	}
+
+	if (e) {
+		if (sfield_init_exp(&field, e) == -1) {
+			fprintf(stderr, "2^%lu - 1 is not a known Mersenne prime.\n",
+				(unsigned long) e);
+			goto out;
+		}
+		field_initialized = 1;
+		fieldp = &field;
+
+		/* -r finds the keys out of range among the wrong ones */
+		if (!robust && !skey_set_in_field(k, &field)) {
+			fputs("A key is out of range.\n", stderr);
+			goto out;
+		}
+	}
+
+	if (robust) {
+		ret = decrypt_robust(k, robust, fieldp, out);
+		goto out;
+	}
+
+	if (out) {
+		mpz_init(s);
+		if (shamir_calculate_secret(s, k, fieldp) == -1) {
+			fputs(fieldp ? "Two of the keys are the same.\n"
+				: "Two of the keys are the same, or the keys are inconsistent.\n",
+				stderr);
+		} else {
+			t = stats_start();
+			ret = write_secret(s, out);
+			stats_stop(STATS_OUTPUT, t);
 		}
+		mpz_clear(s);
+		goto out;
+	}
+
+	secret_str = shamir_calculate_secret_str(k, fieldp);
+	if (!secret_str) {
+		fputs(fieldp ? "Two of the keys are the same.\n"
+			: "Two of the keys are the same, or the keys are inconsistent.\n",
+			stderr);
+		goto out;
 	}
 
-	/* Check for errors */
+	t = stats_start();
+	puts(secret_str);
+	stats_stop(STATS_OUTPUT, t);
+	stats_add_bytes(strlen(secret_str));
+	ret = 0;
+
+out:
+	free(secret_str);
+	skey_set_free(k);
+	if (field_initialized) {
+		sfield_clear(&field);
+		field_initialized = 0;
+	}
+	return ret;
+}
+
+/* Combine keys printed by pack_fprint(), and write the secrets packed in
+ * them to out, one per line, the way -g -l -p read them in */
+static int decrypt_pack(char *const *key_strs, size_t n, FILE *out)
+{
+	skey_set *k = NULL;
+	mp_bitcnt_t e = 0;
+	unsigned count = 0, j;
+	mpz_t *s = NULL;
+	size_t parsed;
+	uint64_t t;
+	int ret = EXIT_FAILURE;
+
+	t = stats_start();
+	parsed = pack_parse(&k, (const char *const *) key_strs, n, &e, &count);
+	stats_stop(STATS_INPUT, t);
+	if (!k)
+		return EXIT_FAILURE;
+	if (parsed < n) {
+		fprintf(stderr, "Invalid key, or not from the same field or group as the others: %s.\n",
+			key_strs[parsed]);
+		goto out;
+	}
+	if (!e) {
+		fputs("Packed keys are always in a prime field.\n", stderr);
+		goto out;
+	}
+	if (n <= count) {
+		fprintf(stderr, "%u secrets are packed in these keys: more than %u keys are needed.\n",
+			count, count);
+		goto out;
+	}
+
+	if (sfield_init_exp(&field, e) == -1) {
+		fprintf(stderr, "2^%lu - 1 is not a known Mersenne prime.\n",
+			(unsigned long) e);
+		goto out;
+	}
+	field_initialized = 1;
+	if (!skey_set_in_field(k, &field)) {
+		fputs("A key is out of range.\n", stderr);
+		goto out;
+	}
+
+	s = malloc(count * sizeof *s);
+	if (!s) {
+		perror("malloc");
+		goto out;
+	}
+	for (j = 0; j < count; ++j)
+		mpz_init(s[j]);
+
+	if (pack_combine(s, count, k, &field) == -1) {
+		fputs("Two of the keys are the same.\n", stderr);
+	} else {
+		t = stats_start();
+		for (j = 0; j < count; ++j) {
+			fputs("0x", out);
+			stats_add_bytes(mpz_out_str(out, 16, s[j]));
+			fputc('\n', out);
+		}
+		stats_stop(STATS_OUTPUT, t);
+		ret = 0;
+	}
+
+	for (j = 0; j < count; ++j)
+		mpz_clear(s[j]);
+	free(s);
+
+out:
+	skey_set_free(k);
+	if (field_initialized) {
+		sfield_clear(&field);
+		field_initialized = 0;
+	}
+	return ret;
+}
+
+/* Tell whether the key file filename is in the binary format */
+static int is_sharefile(const char *filename)
+{
+	FILE *const f = open_input(filename);
+	const int ret = sharefile_probe(f);
+
+	if (f != stdin)
+		fclose(f);
+
+	return ret;
+}
+
+/* Combine key files with combine, stream_combine() for files generated with
+ * -S or stream_combine_binary() for files generated with -B, writing the
+ * secret to out.
+ * Returns 0 on success. */
+static int combine_files(const struct arg *arg,
+		int (*combine)(FILE *const *, unsigned, FILE *),
+		FILE *out)
+{
+	const unsigned n = arg->operation.arg.n;
+	FILE **in;
+	unsigned i;
+	int ret;
+
+	if (n == 0) {
+		fputs("There are no keys to combine.\n", stderr);
+		return -1;
+	}
+
+	in = malloc(n * sizeof *in);
+	if (!in) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < n; ++i)
+		in[i] = open_input(arg->argument.value.keys[i]);
+
+	ret = combine(in, n, out);
+
+	for (i = 0; i < n; ++i)
+		if (in[i] != stdin)
+			fclose(in[i]);
+	free(in);
+
+	if (ret != 0)
+		fputs("Failed to combine the keys.\n", stderr);
+	return ret;
+}
+
+/* Combine the keys of arg, whatever their format, and write the bytes of
+ * the secret to out. If out is NULL, keys printed by -g give the secret as
+ * a number, and key files write its bytes to standard output.
+ * Returns 0 on success. */
+static int combine_keys(const struct arg *arg, FILE *out)
+{
+	const size_t n = arg->operation.arg.n;
+	char **key_strs;
+	size_t i;
+	uint64_t t;
+	int ret;
+
+	if (arg->argument.type == FILENAME
+			&& is_sharefile(arg->argument.value.keys[0])) {
+		if (arg->robust) {
+			fputs("-r doesn't work with key files in the binary format.\n",
+				stderr);
+			return EXIT_FAILURE;
+		}
+		return combine_files(arg, stream_combine_binary,
+			out ? out : stdout);
+	}
+
+	if (arg->stream)
+		return combine_files(arg, stream_combine, out ? out : stdout);
+
+	key_strs = malloc(n * sizeof *key_strs);
+	if (!key_strs) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	t = stats_start();
+	for (i = 0; i < n; ++i)
+		key_strs[i] = get_key_str(arg, i);
+	stats_stop(STATS_INPUT, t);
+
+	/* The keys say which mode they were generated in:
+	 * "x:y" for GF(2^8), "x,y,e" for GF(2^e - 1), "x,y" for integers
+	 * and "x,y,e,count" for packed secrets */
+	if (strchr(key_strs[0], ':')) {
+		ret = decrypt_gf256(key_strs, n, arg->robust,
+			out ? out : stdout);
+		/* Keys typed in get the line the other modes print; the bytes
+		 * of key files are left as they are, for redirecting */
+		if (ret == 0 && !out && arg->argument.type == STRING)
+			putchar('\n');
+	} else if (pack_is_key(key_strs[0]) && arg->robust) {
+		fputs("-r doesn't work with packed keys.\n", stderr);
+		ret = EXIT_FAILURE;
+	} else if (pack_is_key(key_strs[0]))
+		ret = decrypt_pack(key_strs, n, out ? out : stdout);
+	else
+		ret = decrypt_mpz(key_strs, n, arg->robust, out);
+
+	for (i = 0; i < n; ++i)
+		free(key_strs[i]);
+	free(key_strs);
+
+	return ret;
+}
+
+/* Recover the data key of -H from the keys, and use it to check PAYLOAD and
+ * decrypt it to OUTPUT, or to standard output */
+static void decrypt_hybrid(const struct arg *arg)
+{
+	unsigned char key[HYBRID_KEY_SIZE];
+	char *buf = NULL, *tmp_name = NULL;
+	size_t size = 0;
+	FILE *m, *payload, *out;
+	int fd, ret;
+
+	/* Whatever the mode, the keys give back the bytes of the data key */
+	m = open_memstream(&buf, &size);
+	if (!m) {
+		perror("open_memstream");
+		exit(EXIT_FAILURE);
+	}
+	ret = combine_keys(arg, m);
+	if (fclose(m) == EOF)
+		ret = EXIT_FAILURE;
+
+	if (ret == 0 && size > sizeof key) {
+		fputs("These keys don't hold a data key: they weren't generated with -H.\n",
+			stderr);
+		ret = EXIT_FAILURE;
+	}
+	if (ret == 0) {
+		/* A number loses its leading zero bytes */
+		memset(key, 0, sizeof key - size);
+		memcpy(key + sizeof key - size, buf, size);
+	}
+	if (buf) {
+		memset(buf, 0, size);
+		free(buf);
+	}
+	if (ret != 0)
+		exit(EXIT_FAILURE);
+
+	payload = open_input(arg->hybrid);
+
+	/* OUTPUT only appears once the payload is checked and decrypted:
+	 * until then, it is a temporary file next to it */
+	if (arg->output && strncmp(arg->output, "-", 2) != 0) {
+		tmp_name = malloc(strlen(arg->output) + sizeof ".XXXXXX");
+		if (!tmp_name) {
+			perror("malloc");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(tmp_name, arg->output);
+		strcat(tmp_name, ".XXXXXX");
+
+		fd = mkstemp(tmp_name);
+		out = fd == -1 ? NULL : fdopen(fd, "wb");
+		if (!out) {
+			fprintf(stderr, "Failed to open file %s.\n", tmp_name);
+			if (fd != -1) {
+				close(fd);
+				unlink(tmp_name);
+			}
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		out = stdout;
+	}
+
+	ret = hybrid_decrypt(payload, out, key);
+	memset(key, 0, sizeof key);
+
+	fclose(payload);
+	if (out != stdout && fclose(out) == EOF) {
+		fputs("fclose() returned EOF.\n", stderr);
+		ret = EXIT_FAILURE;
+	}
+
+	if (tmp_name) {
+		if (ret == 0 && rename(tmp_name, arg->output) != 0) {
+			perror("rename");
+			ret = EXIT_FAILURE;
+		}
+		if (ret != 0)
+			unlink(tmp_name);
+		free(tmp_name);
+	}
+
+	if (ret != 0)
+		exit(EXIT_FAILURE);
+}
+
+void decrypt_func(const struct arg *arg)
+{
+	FILE *out = NULL;
+	int ret;
+
+	if (arg->operation.operation != DECRYPT)
+		return;
+
+	if (arg->batch) {
+		run_batch(arg);
+		return;
+	}
+
+	if (arg->hybrid) {
+		decrypt_hybrid(arg);
+		return;
+	}
+
+	if (arg->output)
+		out = open_output(arg->output);
+
+	ret = combine_keys(arg, out);
+
+	if (out && out != stdout && fclose(out) == EOF) {
+		fputs("fclose() returned EOF.\n", stderr);
+		ret = EXIT_FAILURE;
+	}
+
+	if (ret != 0)
+		exit(EXIT_FAILURE);
+}
+
+/* Serve requests on SOCKET until told to stop, on THREADS workers, each
+ * with a context kept warm from one request to the next */
+void serve_func(const struct arg *arg)
+{
+	if (arg->operation.operation != SERVE)
+		return;
+
+	/* The threads answer requests, rather than generate the keys of one */
+	if (server_run(arg->operation.arg.socket, arg->threads) != 0)
+		exit(EXIT_FAILURE);
+}
+
+/* The keys of -v and -a: the ARGUMENTs themselves, or every non-empty line
+ * of the files they name */
+struct key_list {
+	const char **strs;
+	size_t count;
+	size_t alloc;
+	char **files;   /* The contents of the files, which strs points into */
+	size_t n_files;
+};
+
+static void key_list_add(struct key_list *l, const char *str)
+{
+	if (l->count == l->alloc) {
+		const char **s;
+
+		l->alloc = l->alloc ? 2 * l->alloc : 64U;
+		s = realloc(l->strs, l->alloc * sizeof *s);
+		if (!s) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		l->strs = s;
+	}
+	l->strs[l->count++] = str;
+}
+
+static void read_key_list(const struct arg *arg, struct key_list *l)
+{
+	const unsigned n = arg->operation.arg.n;
+	unsigned i;
+
+	memset(l, 0, sizeof *l);
+
+	if (arg->argument.type == STRING) {
+		for (i = 0; i < n; ++i)
+			key_list_add(l, arg->argument.value.keys[i]);
+		return;
+	}
+
+	l->files = calloc(n, sizeof *l->files);
+	if (!l->files) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < n; ++i) {
+		FILE *const f = open_input(arg->argument.value.keys[i]);
+		unsigned char *data;
+		char *str, *line, *end;
+		size_t len;
+
+		data = read_file(f, &len);
+		if (f != stdin)
+			fclose(f);
+		str = data ? realloc(data, len + 1) : NULL;
+		if (!str) {
+			free(data);
+			fprintf(stderr, "Failed to read key file %s.\n",
+				arg->argument.value.keys[i]);
+			exit(EXIT_FAILURE);
+		}
+		str[len] = '\0';
+		l->files[l->n_files++] = str;
+
+		for (line = str; *line; line = end) {
+			end = line + strcspn(line, "\r\n");
+			if (*end)
+				*end++ = '\0';
+			if (*line)
+				key_list_add(l, line);
+		}
+	}
+}
+
+static void key_list_free(struct key_list *l)
+{
+	size_t i;
+
+	for (i = 0; i < l->n_files; ++i)
+		free(l->files[i]);
+	free(l->files);
+	free(l->strs);
+}
+
+/* Check keys against the commitments written by -g -c, and print the
+ * invalid ones */
+void verify_func(const struct arg *arg)
+{
+	struct key_list l;
+	unsigned char *bad;
+	size_t parsed, n_bad, i;
+	mp_bitcnt_t e = 0;
+	FILE *in;
+	vss commit;
+	uint64_t t;
+	int ret;
+
+	if (arg->operation.operation != VERIFY)
+		return;
+
+	t = stats_start();
+	in = open_input(arg->commitments);
+	ret = vss_read(in, &commit);
+	if (in != stdin)
+		fclose(in);
+	if (ret == -1) {
+		fprintf(stderr, "Failed to read the commitments from %s.\n",
+			arg->commitments);
+		exit(EXIT_FAILURE);
+	}
+
+	read_key_list(arg, &l);
+	if (l.count == 0) {
+		fputs("There are no keys to verify.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	parsed = skey_set_parse(&keys, l.strs, l.count, &e);
+	if (!keys) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	if (parsed < l.count) {
+		fprintf(stderr, "Invalid key %lu, or not from the same field as the others: %s.\n",
+			(unsigned long) parsed + 1UL, l.strs[parsed]);
+		exit(EXIT_FAILURE);
+	}
+	if (e != commit.field.e) {
+		fputs("The keys are not from the field of the commitments.\n",
+			stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (!skey_set_in_field(keys, &commit.field)) {
+		fputs("A key is out of range.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	stats_stop(STATS_INPUT, t);
+
+	bad = malloc(l.count);
+	if (!bad) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	/* The weights of the batches must be out of the dealer's reach */
+	init();
+	t = stats_start();
+	n_bad = vss_verify(&commit, keys, &rng, bad);
+	stats_stop(STATS_VERIFY, t);
+	csprng_clear(&rng);
+
+	if (n_bad == 0)
+		printf("%lu key%s valid.\n", (unsigned long) l.count,
+			l.count == 1 ? " is" : "s are");
+	for (i = 0; i < l.count; ++i)
+		if (bad[i])
+			printf("Key %lu is invalid: %s\n", (unsigned long) i + 1UL,
+				l.strs[i]);
+
+	free(bad);
+	key_list_free(&l);
+	skey_set_free(keys);
+	keys = NULL;
+	vss_clear(&commit);
+
+	if (n_bad != 0)
+		exit(EXIT_FAILURE);
+}
+
+/* Parse the comma-separated x values of -a into *x, which must be freed
+ * with free_new_x().
+ * Returns how many there are, or 0 if one of them is not a positive number,
+ * or comes twice. */
+static size_t parse_new_x(const char *str, mpz_t **x)
+{
+	size_t n = 1, i, j;
+	const char *p;
+	char *copy, *tok, *comma;
+
+	for (p = str; *p; ++p)
+		if (*p == ',')
+			++n;
+
+	copy = malloc(strlen(str) + 1);
+	*x = malloc(n * sizeof **x);
+	if (!copy || !*x) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(copy, str);
+
+	for (i = 0, tok = copy; i < n; ++i, tok = comma + 1) {
+		comma = strchr(tok, ',');
+		if (comma)
+			*comma = '\0';
+
+		mpz_init((*x)[i]);
+		if (mpz_set_str((*x)[i], tok, 0) == -1
+				|| mpz_sgn((*x)[i]) <= 0) {
+			fprintf(stderr, "-a: %s is not a positive number.\n", tok);
+			n = i + 1;
+			goto fail;
+		}
+		for (j = 0; j < i; ++j) {
+			if (mpz_cmp((*x)[j], (*x)[i]) == 0) {
+				fprintf(stderr, "-a: %s is given twice.\n", tok);
+				n = i + 1;
+				goto fail;
+			}
+		}
+	}
+
+	free(copy);
+	return n;
+
+fail:
+	for (i = 0; i < n; ++i)
+		mpz_clear((*x)[i]);
+	free(*x);
+	free(copy);
+	return 0;
+}
+
+static void free_new_x(mpz_t *x, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		mpz_clear(x[i]);
+	free(x);
+}
+
+/* -a for keys printed by print_gf256_key() */
+static int issue_gf256(const struct key_list *l, const mpz_t *at, size_t n_at)
+{
+	const size_t n = l->count;
+	const size_t len = gf256_key_len(l->strs[0]);
+	unsigned char x[GF256_MAX_KEYS];
+	unsigned char *data, *new_y;
+	const unsigned char **y;
+	size_t i, j;
+	uint64_t t;
+	int ret = EXIT_FAILURE;
+
+	if (n > GF256_MAX_KEYS) {
+		fprintf(stderr, "At most %u GF(2^8) keys can be combined.\n",
+			GF256_MAX_KEYS);
+		return EXIT_FAILURE;
+	}
+
+	/* One buffer for the n keys and the new y */
+	data = malloc((n + 1) * len + 1);
+	y = malloc(n * sizeof *y);
+	if (!data || !y) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	new_y = data + n * len;
+
+	t = stats_start();
+	for (i = 0; i < n; ++i) {
+		if (gf256_key_len(l->strs[i]) != len
+				|| gf256_parse_key(l->strs[i], x + i,
+					data + i * len, len) == -1) {
+			fprintf(stderr, "Invalid GF(2^8) key, or not the same length as the others: %s.\n",
+				l->strs[i]);
+			goto out;
+		}
+		y[i] = data + i * len;
+	}
+	stats_stop(STATS_INPUT, t);
+
+	for (j = 0; j < n_at; ++j) {
+		if (mpz_cmp_ui(at[j], 255U) > 0) {
+			fputs("-a: in GF(2^8), the x values go from 1 to 255.\n",
+				stderr);
+			goto out;
+		}
+		for (i = 0; i < n; ++i) {
+			if (mpz_cmp_ui(at[j], x[i]) == 0) {
+				fprintf(stderr, "-a: 0x%02x is already the x of key %lu.\n",
+					x[i], (unsigned long) i + 1UL);
+				goto out;
+			}
+		}
+	}
+
+	for (j = 0; j < n_at; ++j) {
+		const unsigned char xj = (unsigned char) mpz_get_ui(at[j]);
+
+		t = stats_start();
+		if (gf256_interpolate(new_y, xj, x, y, len, (unsigned) n) == -1) {
+			fputs("Two of the keys are the same.\n", stderr);
+			goto out;
+		}
+		stats_stop(STATS_EVAL, t);
+
+		t = stats_start();
+		if (gf256_fprint_key(stdout, xj, new_y, len) == -1) {
+			perror("gf256_fprint_key");
+			goto out;
+		}
+		stats_stop(STATS_OUTPUT, t);
+	}
+	ret = 0;
+
+out:
+	memset(data, 0, (n + 1) * len);
+	free(data);
+	free(y);
+	return ret;
+}
+
+/* -a for keys printed by skey_print(), or by pack_fprint() */
+static int issue_mpz(const struct key_list *l, const mpz_t *at, size_t n_at)
+{
+	skey_set *new_keys;
+	mp_bitcnt_t e = 0;
+	sfield *fieldp = NULL;
+	unsigned count = 0;
+	size_t parsed, i, j;
+	mpz_t view, last;
+	uint64_t t;
+
+	t = stats_start();
+	if (pack_is_key(l->strs[0]))
+		parsed = pack_parse(&keys, l->strs, l->count, &e, &count);
+	else
+		parsed = skey_set_parse(&keys, l->strs, l->count, &e);
+	if (!keys)
+		exit(EXIT_FAILURE);
+	if (parsed < l->count) {
+		fprintf(stderr, "Invalid key, or not from the same field as the others: %s.\n",
+			l->strs[parsed]);
+		return EXIT_FAILURE;
+	}
+	if (count && !e) {
+		fputs("Packed keys are always in a prime field.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	stats_stop(STATS_INPUT, t);
+
+	if (e) {
+		if (sfield_init_exp(&field, e) == -1) {
+			fprintf(stderr, "2^%lu - 1 is not a known Mersenne prime.\n",
+				(unsigned long) e);
+			return EXIT_FAILURE;
+		}
+		field_initialized = 1;
+		fieldp = &field;
+
+		if (!skey_set_in_field(keys, &field)) {
+			fputs("A key is out of range.\n", stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (j = 0; j < n_at; ++j) {
+		if (fieldp && mpz_cmp(at[j], field.p) >= 0) {
+			fprintf(stderr, "-a: the x values must be less than 2^%lu - 1.\n",
+				(unsigned long) e);
+			return EXIT_FAILURE;
+		}
+		for (i = 0; i < keys->count; ++i) {
+			if (mpz_cmp(at[j], skey_set_x(keys, i, view)) == 0) {
+				gmp_fprintf(stderr, "-a: %#Zx is already the x of key %lu.\n",
+					at[j], (unsigned long) i + 1UL);
+				return EXIT_FAILURE;
+			}
+		}
+
+		/* The packed secrets are at 0, -1, ..., -(count - 1) */
+		if (count) {
+			int secret_x;
+
+			mpz_init(last);
+			mpz_add_ui(last, at[j], count - 1U);
+			secret_x = mpz_cmp(last, field.p) >= 0;
+			mpz_clear(last);
+			if (secret_x) {
+				gmp_fprintf(stderr, "-a: a key at %#Zx would give away a secret.\n",
+					at[j]);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	t = stats_start();
+	if (shamir_issue_keys(&new_keys, keys, at, n_at, fieldp) == -1) {
+		fputs(fieldp ? "Two of the keys are the same.\n"
+			: "Two of the keys are the same, or the keys are inconsistent.\n",
+			stderr);
+		return EXIT_FAILURE;
+	}
+	stats_stop(STATS_EVAL, t);
+
+	t = stats_start();
+	for (j = 0; j < n_at; ++j) {
+		if (count)
+			pack_fprint(stdout, new_keys, j, fieldp, count);
+		else
+			skey_print(new_keys, j, fieldp);
+	}
+	stats_stop(STATS_OUTPUT, t);
+
+	skey_set_free(new_keys);
+	return 0;
+}
+
+/* Print keys at the x values of -a for the secret of the keys, and
+ * nothing else: the secret itself is never calculated */
+void issue_func(const struct arg *arg)
+{
+	struct key_list l;
+	mpz_t *at;
+	size_t n_at;
+	int ret;
+
+	if (arg->operation.operation != ISSUE)
+		return;
+
+	n_at = parse_new_x(arg->new_x, &at);
+	if (n_at == 0)
+		exit(EXIT_FAILURE);
+
+	read_key_list(arg, &l);
+	if (l.count < 2) {
+		fputs("-a needs at least two keys.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	/* As with -d, the keys say which mode they were generated in */
+	if (strchr(l.strs[0], ':'))
+		ret = issue_gf256(&l, (const mpz_t *) at, n_at);
+	else
+		ret = issue_mpz(&l, (const mpz_t *) at, n_at);
+
+	free_new_x(at, n_at);
+	key_list_free(&l);
+	if (ret != 0)
+		exit(EXIT_FAILURE);
+}
+
+/* Read the whole contents of f.
+ * The number of bytes read is stored in *size.
+ * Returns NULL on failure. */
+unsigned char *read_file(FILE *f, size_t *size)
+{
+	unsigned char *data = NULL;
+	size_t cap = 0;  /* The allocated size of data */
+	size_t len = 0;  /* The number of bytes read so far */
+	size_t r;
+
+	do {
+		if (len == cap) {
+			unsigned char *d;
+
+			cap = cap ? 2 * cap : BUFSIZ;
+			d = realloc(data, cap);
+			if (!d) {
+				free(data);
+				return NULL;
+			}
+			data = d;
+		}
+		r = fread(data + len, 1, cap - len, f);
+		len += r;
+	} while (r > 0);
+
 	if (ferror(f)) {
-		free(hexdump); /* Ditto */
+		free(data);
 		return NULL;
 	}
 
-	if (hexdump)
-		hexdump[size - 1] = '\0';
-
-	return hexdump;
+	*size = len;
+	return data;
 }
@@ -1,23 +1,35 @@
 #ifndef E83E48D9_697C_4182_9D23_A3C90333E250
 #define E83E48D9_697C_4182_9D23_A3C90333E250
 
+#include <stddef.h> /* size_t */
 #include <stdio.h> /* FILE */
 
 enum operationtype {
 	UNSPECIFIED_OP,
 	GENERATE,
-	DECRYPT
+	DECRYPT,
+	SERVE,
+	VERIFY,
+	ISSUE
 };
 struct operation {
 	enum operationtype operation;
 	union {
-		unsigned n; /* Number of keys required for decryption */
+		unsigned n; /* Number of keys required for decryption, or to
+		               verify or issue new keys from */
 		struct {    /* Number of keys (and type) for generation */
 			unsigned keys_req;
 			unsigned n_keys;
 		} genkeys;
+		const char *socket; /* The socket to serve on */
 	} arg;
 };
+/* How the secret is shared */
+enum sharemode {
+	PRIME_MODE,   /* In a prime field GF(p) (the default) */
+	INTEGER_MODE, /* Over the integers */
+	GF256_MODE    /* Byte by byte, in GF(2^8) */
+};
 enum argtype {
 	UNSPECIFIED_ARG,
 	FILENAME,
@@ -36,6 +48,20 @@ struct argument {
 struct arg {
 	struct operation operation;
 	struct argument  argument;
+	enum sharemode   mode;
+	int              stream;     /* Process the secret block by block */
+	size_t           block_size; /* The size of a block, 0 for the default */
+	const char      *output;     /* Where to write the output, or NULL */
+	int              binary;     /* Write the keys in the binary format */
+	int              seq;        /* Use the x values 1, ..., N_KEYS */
+	int              batch;      /* One secret, or group of keys, per line */
+	unsigned         pack;       /* The secrets per polynomial, 0 for one */
+	unsigned         threads;    /* The number of threads to generate with */
+	int              stats;      /* Report where the time and memory went */
+	const char      *hybrid;     /* The encrypted payload of -H, or NULL */
+	const char      *commitments; /* The commitments of -c, or NULL */
+	const char      *new_x;      /* The x values of the keys -a issues */
+	unsigned         robust;     /* The KEYS_REQ of -r, 0 to trust the keys */
 };
 
 void parse_arguments(int argc, char *argv[], struct arg *arg);
@@ -49,8 +75,13 @@ void clear(void);
 
 void generate_func(const struct arg *arg);
 void decrypt_func(const struct arg *arg);
+void serve_func(const struct arg *arg);
+void verify_func(const struct arg *arg);
+void issue_func(const struct arg *arg);
 
-char *hex_encode_file(FILE *f);
+unsigned char *read_file(FILE *f, size_t *size);
+FILE *open_input(const char *filename);
+FILE *open_output(const char *filename);
 
 extern void (*(op_functions[]))(const struct arg *);
 
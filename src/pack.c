@@ -0,0 +1,321 @@
+/* My includes */
+#include "pack.h"
+#include "shamir.h"
+#include "shamir_key.h"
+#include "shamir_field.h"
+#include "csprng.h"
+#include "stats.h"
+
+/* Standard C includes */
+#include <assert.h>
+#include <limits.h> /* for UINT_MAX */
+#include <stdlib.h> /* for malloc(), free(), strtoul(), abort() */
+#include <stdio.h>  /* for sprintf(), fwrite(), perror() */
+#include <string.h> /* for strchr(), strrchr(), strlen(), memcpy() */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+static mpz_t *alloc_array(size_t n)
+{
+	mpz_t *a = malloc(n * sizeof *a);
+	size_t i;
+
+	if (!a) {
+		perror("malloc");
+		abort();
+	}
+	for (i = 0; i < n; ++i)
+		mpz_init(a[i]);
+
+	return a;
+}
+
+static void free_array(mpz_t *a, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		mpz_clear(a[i]);
+	free(a);
+}
+
+/* Expand f = I + Z * r into poly, where poly[i] is the coefficient of x^i,
+ * for i = 0, ..., keys_req - 1.
+ *
+ * Z is built one factor (x + j) at a time. The Lagrange basis polynomial of
+ * the j-th secret is
+ *
+ *   L[j](x) = Z(x) / (x + j) / prod(i - j, i != j)
+ *
+ * where Z(x) / (x + j) is a synthetic division, and
+ * prod(i - j, i != j) = (-1)^j j! (count - 1 - j)!: the inverses of the
+ * factorials all come from the inverse of (count - 1)!. */
+static void build_poly(mpz_t *poly,
+		csprng *rng,
+		const mpz_t *secrets,
+		unsigned count,
+		unsigned keys_req,
+		const sfield *field)
+{
+	const unsigned m = count, nr = keys_req - count;
+	mpz_t *const z = alloc_array(m + 1);
+	mpz_t *const q = alloc_array(m);
+	mpz_t *const ifact = alloc_array(m);
+	mpz_t r, c, tmp;
+	unsigned i, j;
+	uint64_t t;
+
+	mpz_inits(r, c, tmp, NULL);
+
+	/* z = Z(x) */
+	mpz_set_ui(z[0], 1U);
+	for (j = 0; j < m; ++j) {
+		/* Times (x + j) */
+		for (i = j + 1; i > 0; --i) {
+			mpz_mul_ui(z[i], z[i], j);
+			mpz_add(z[i], z[i], z[i - 1]);
+			sfield_reduce(field, z[i], tmp);
+		}
+		mpz_mul_ui(z[0], z[0], j);
+	}
+
+	/* poly = Z * r */
+	for (i = 0; i < keys_req; ++i)
+		mpz_set_ui(poly[i], 0U);
+	t = stats_start();
+	for (i = 0; i < nr; ++i) {
+		csprng_urandomm(r, rng, field->p);
+		for (j = 0; j <= m; ++j)
+			mpz_addmul(poly[i + j], r, z[j]);
+	}
+	stats_stop(STATS_COEFFS, t);
+
+	/* ifact[i] = 1 / i! */
+	mpz_set_ui(ifact[0], 1U);
+	for (i = 1; i < m; ++i) {
+		mpz_mul_ui(ifact[i], ifact[i - 1], i);
+		sfield_reduce(field, ifact[i], tmp);
+	}
+	/* (count - 1)! is not a multiple of p, which is larger than count */
+	mpz_invert(ifact[m - 1], ifact[m - 1], field->p);
+	for (i = m - 1; i > 0; --i) {
+		mpz_mul_ui(ifact[i - 1], ifact[i], i);
+		sfield_reduce(field, ifact[i - 1], tmp);
+	}
+
+	/* poly += secrets[j] * L[j] */
+	for (j = 0; j < m; ++j) {
+		mpz_mul(c, secrets[j], ifact[j]);
+		sfield_reduce(field, c, tmp);
+		mpz_mul(c, c, ifact[m - 1 - j]);
+		sfield_reduce(field, c, tmp);
+		if ((j & 1U) && mpz_sgn(c) != 0)
+			mpz_sub(c, field->p, c);
+
+		/* q = Z / (x + j) */
+		mpz_set(q[m - 1], z[m]);
+		for (i = m - 1; i > 0; --i) {
+			mpz_mul_ui(tmp, q[i], j);
+			mpz_sub(q[i - 1], z[i], tmp);
+			mpz_mod(q[i - 1], q[i - 1], field->p);
+		}
+
+		for (i = 0; i < m; ++i)
+			mpz_addmul(poly[i], c, q[i]);
+	}
+
+	for (i = 0; i < keys_req; ++i)
+		sfield_reduce(field, poly[i], tmp);
+
+	mpz_clears(r, c, tmp, NULL);
+	free_array(z, m + 1);
+	free_array(q, m);
+	free_array(ifact, m);
+}
+
+/* Share the count secrets, all less than field->p, in num_keys keys, of
+ * which keys_req recover all of them, and keys_req - count tell nothing.
+ * The keys are at x = 1, ..., num_keys if seq is not 0, and at random x
+ * values, away from the x values of the secrets, otherwise.
+ * *keys is reused if it is large enough, as in skey_generate().
+ * Returns 0 on success. */
+int pack_generate(skey_set **keys,
+		csprng *rng,
+		const mpz_t *secrets,
+		unsigned count,
+		unsigned short keys_req,
+		unsigned num_keys,
+		int seq,
+		const sfield *field)
+{
+	mpz_t *const poly = alloc_array(keys_req);
+	mpz_t *x = NULL;
+	mpz_t last;
+	unsigned i;
+	int ret;
+
+	assert(count > 0 && count < keys_req && keys_req <= num_keys);
+
+	build_poly(poly, rng, secrets, count, keys_req, field);
+
+	/* The secrets are at 0, p - 1, ..., p - (count - 1) */
+	if (!seq) {
+		x = alloc_array(num_keys);
+		mpz_init(last);
+		for (i = 0; i < num_keys; ++i) {
+			do {
+				csprng_urandomm(x[i], rng, field->p);
+				mpz_add_ui(last, x[i], count - 1U);
+			} while (mpz_sgn(x[i]) == 0
+				|| mpz_cmp(last, field->p) >= 0);
+		}
+		mpz_clear(last);
+	}
+
+	ret = skey_generate_poly(keys, (const mpz_t *) poly, keys_req,
+		(const mpz_t *) x, num_keys, field);
+
+	if (x)
+		free_array(x, num_keys);
+	free_array(poly, keys_req);
+	return ret;
+}
+
+/* Recover the count secrets of keys, of which there must be at least
+ * KEYS_REQ, into secrets, whose elements must be initialized: they are the
+ * values of the polynomial at 0, -1, ..., -(count - 1), see
+ * shamir_issue_keys().
+ * Returns -1 if two keys have the same x, or a key is at the x of a
+ * secret. */
+int pack_combine(mpz_t *secrets,
+		unsigned count,
+		const skey_set *keys,
+		const sfield *field)
+{
+	const uint64_t t = stats_start();
+	mpz_t *const at = alloc_array(count);
+	skey_set *out;
+	mpz_t view;
+	unsigned j;
+	int ret;
+
+	for (j = 1; j < count; ++j)
+		mpz_sub_ui(at[j], field->p, j);
+
+	ret = shamir_issue_keys(&out, keys, (const mpz_t *) at, count, field);
+	if (ret == 0) {
+		for (j = 0; j < count; ++j)
+			mpz_set(secrets[j], skey_set_y(out, j, view));
+		skey_set_free(out);
+	}
+
+	free_array(at, count);
+	stats_stop(STATS_COMBINE, t);
+	return ret;
+}
+
+/* Returns non-zero if str looks like a packed key, with three commas */
+int pack_is_key(const char *str)
+{
+	unsigned commas = 0;
+
+	for (; *str; ++str)
+		if (*str == ',')
+			++commas;
+
+	return commas == 3;
+}
+
+/* Same as skey_set_parse(), for packed keys. *count is set to the number of
+ * secrets of the keys, which must be the same for all of them. */
+size_t pack_parse(skey_set **set,
+		const char *const *strs,
+		size_t n,
+		mp_bitcnt_t *e,
+		unsigned *count)
+{
+	const char **prefix = malloc((n ? n : 1) * sizeof *prefix);
+	size_t i, len, total = 0, parsed;
+	char *buf, *p;
+
+	for (i = 0; i < n; ++i)
+		total += strlen(strs[i]) + 1;
+	buf = malloc(total ? total : 1);
+	if (!prefix || !buf) {
+		perror("malloc");
+		abort();
+	}
+
+	/* Cut the count off, and let skey_set_parse() do the rest */
+	for (i = 0, p = buf; i < n; ++i) {
+		const char *const comma = strrchr(strs[i], ',');
+		unsigned long c;
+		char *end;
+
+		if (!comma || !pack_is_key(strs[i]))
+			break;
+		c = strtoul(comma + 1, &end, 0);
+		if (end == comma + 1 || *end || c == 0 || c > UINT_MAX)
+			break;
+		if (i == 0)
+			*count = (unsigned) c;
+		else if (c != *count)
+			break;
+
+		len = (size_t) (comma - strs[i]);
+		memcpy(p, strs[i], len);
+		p[len] = '\0';
+		prefix[i] = p;
+		p += len + 1;
+	}
+
+	parsed = skey_set_parse(set, prefix, i, e);
+
+	free(buf);
+	free(prefix);
+	return parsed;
+}
+
+/* The size of a buffer large enough for pack_format() */
+size_t pack_str_size(const skey_set *keys, const sfield *field)
+{
+	/* ",0x" and the digits of an unsigned */
+	return skey_str_size(keys, field) + 3 + 2 * sizeof(unsigned);
+}
+
+/* Same as skey_format(), with the count of the secrets after the field */
+size_t pack_format(char *buf,
+		const skey_set *keys,
+		size_t i,
+		const sfield *field,
+		unsigned count)
+{
+	/* Over the newline */
+	const size_t len = skey_format(buf, keys, i, field) - 1;
+
+	return len + (size_t) sprintf(buf + len, ",0x%x\n", count);
+}
+
+/* Same as skey_fprint(), for a packed key */
+void pack_fprint(FILE *out,
+		const skey_set *keys,
+		size_t i,
+		const sfield *field,
+		unsigned count)
+{
+	char small[512];
+	const size_t size = pack_str_size(keys, field);
+	char *const buf = size <= sizeof small ? small : malloc(size);
+
+	if (!buf) {
+		perror("malloc");
+		return;
+	}
+
+	fwrite(buf, 1, pack_format(buf, keys, i, field, count), out);
+
+	if (buf != small)
+		free(buf);
+}
@@ -0,0 +1,61 @@
+#ifndef _A94D727F_98CF_4773_BA72_67D059B70A70
+#define _A94D727F_98CF_4773_BA72_67D059B70A70
+
+#include "shamir_key.h"
+#include "shamir_field.h"
+#include "csprng.h"
+
+#include <gmp.h>
+#include <stddef.h> /* size_t */
+#include <stdio.h>  /* FILE */
+
+
+/* Packed secret sharing (-p), after Franklin and Yung: count secrets share
+ * one polynomial f of degree KEYS_REQ - 1, the j-th one being f(-j), for
+ * j = 0, ..., count - 1, so that every key carries all of them at once.
+ *
+ *   f = I + Z * r
+ *
+ * where I is the polynomial of degree count - 1 through the secrets,
+ * Z(x) = x (x + 1) ... (x + count - 1), and r is random, of degree
+ * KEYS_REQ - 1 - count. Any KEYS_REQ - count keys say nothing about the
+ * secrets, and KEYS_REQ keys give all of them; in between, they give part
+ * of them away: this is a ramp scheme.
+ *
+ * f is expanded once, and every key then costs a single evaluation of it,
+ * as in skey_generate(), instead of one per secret.
+ *
+ * Only in prime fields. A packed key is printed as "x,y,e,count". */
+
+int pack_generate(skey_set **keys,
+		csprng *rng,
+		const mpz_t *secrets,
+		unsigned count,
+		unsigned short keys_req,
+		unsigned num_keys,
+		int seq,
+		const sfield *field);
+int pack_combine(mpz_t *secrets,
+		unsigned count,
+		const skey_set *keys,
+		const sfield *field);
+
+int pack_is_key(const char *str);
+size_t pack_parse(skey_set **set,
+		const char *const *strs,
+		size_t n,
+		mp_bitcnt_t *e,
+		unsigned *count);
+size_t pack_str_size(const skey_set *keys, const sfield *field);
+size_t pack_format(char *buf,
+		const skey_set *keys,
+		size_t i,
+		const sfield *field,
+		unsigned count);
+void pack_fprint(FILE *out,
+		const skey_set *keys,
+		size_t i,
+		const sfield *field,
+		unsigned count);
+
+#endif /* !_A94D727F_98CF_4773_BA72_67D059B70A70 */
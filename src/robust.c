@@ -0,0 +1,536 @@
+/* My includes */
+#include "robust.h"
+#include "shamir_key.h"
+#include "shamir_field.h"
+#include "shamir_gf256.h"
+#include "stats.h"
+
+/* Standard C includes */
+#include <assert.h>
+#include <stdlib.h> /* for malloc(), calloc(), free(), abort() */
+#include <stdio.h>  /* for perror() */
+#include <string.h> /* for memset() */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+/* A polynomial in GF(p): c[i] is the coefficient of x^i, and deg is -1 for
+ * the zero polynomial. There is room for n + 1 coefficients. */
+struct poly {
+	mpz_t *c;
+	int deg;
+};
+
+/* The same in GF(2^8) */
+struct bpoly {
+	unsigned char c[GF256_MAX_KEYS + 1U];
+	int deg;
+};
+
+static void poly_init(struct poly *a, unsigned n)
+{
+	unsigned i;
+
+	a->c = malloc((n + 1) * sizeof *a->c);
+	if (!a->c) {
+		perror("malloc");
+		abort();
+	}
+	for (i = 0; i <= n; ++i)
+		mpz_init(a->c[i]);
+	a->deg = -1;
+}
+
+static void poly_clear(struct poly *a, unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i <= n; ++i)
+		mpz_clear(a->c[i]);
+	free(a->c);
+}
+
+static void poly_swap(struct poly *a, struct poly *b)
+{
+	const struct poly t = *a;
+
+	*a = *b;
+	*b = t;
+}
+
+static void poly_normalize(struct poly *a)
+{
+	while (a->deg >= 0 && mpz_sgn(a->c[a->deg]) == 0)
+		--a->deg;
+}
+
+/* r = r - c * s, with c, s and r less than p */
+static void sub_mul(mpz_t r, const mpz_t c, const mpz_t s,
+		const sfield *field,
+		mpz_t tmp, mpz_t tmp2)
+{
+	mpz_mul(tmp, c, s);
+	sfield_reduce(field, tmp, tmp2);
+	mpz_sub(r, r, tmp);
+	if (mpz_sgn(r) < 0)
+		mpz_add(r, r, field->p);
+}
+
+/* Divide r by b, which is not zero: q gets the quotient, and r the
+ * remainder */
+static void poly_divmod(struct poly *q, struct poly *r, const struct poly *b,
+		const sfield *field,
+		mpz_t tmp, mpz_t tmp2)
+{
+	mpz_t inv;
+	int i, j;
+
+	assert(b->deg >= 0);
+
+	q->deg = r->deg - b->deg;
+	if (q->deg < 0) {
+		q->deg = -1;
+		return;
+	}
+
+	mpz_init(inv);
+	mpz_invert(inv, b->c[b->deg], field->p);
+
+	for (i = q->deg; i >= 0; --i) {
+		mpz_mul(q->c[i], r->c[i + b->deg], inv);
+		sfield_reduce(field, q->c[i], tmp);
+		for (j = 0; j < b->deg; ++j)
+			sub_mul(r->c[i + j], q->c[i], b->c[j], field, tmp, tmp2);
+		mpz_set_ui(r->c[i + b->deg], 0U);
+	}
+	r->deg = b->deg - 1;
+	poly_normalize(r);
+	poly_normalize(q);
+
+	mpz_clear(inv);
+}
+
+/* a = a - q * b */
+static void poly_submul(struct poly *a, const struct poly *q,
+		const struct poly *b,
+		const sfield *field,
+		mpz_t tmp, mpz_t tmp2)
+{
+	int i, j;
+
+	if (q->deg < 0 || b->deg < 0)
+		return;
+	for (i = a->deg + 1; i <= q->deg + b->deg; ++i)
+		mpz_set_ui(a->c[i], 0U);
+	if (a->deg < q->deg + b->deg)
+		a->deg = q->deg + b->deg;
+
+	for (i = 0; i <= q->deg; ++i)
+		for (j = 0; j <= b->deg; ++j)
+			sub_mul(a->c[i + j], q->c[i], b->c[j], field, tmp, tmp2);
+	poly_normalize(a);
+}
+
+/* f(x), in GF(p) */
+static void poly_eval(mpz_t r, const struct poly *f, const mpz_t x,
+		const sfield *field,
+		mpz_t tmp)
+{
+	int i;
+
+	mpz_set_ui(r, 0U);
+	for (i = f->deg; i >= 0; --i) {
+		mpz_mul(r, r, x);
+		mpz_add(r, r, f->c[i]);
+		sfield_reduce(field, r, tmp);
+	}
+}
+
+/* Recover the secret of keys, which come from a polynomial of degree
+ * keys_req - 1 in field, even if up to (keys->count - keys_req) / 2 of them
+ * are wrong. bad[i] is set to 1 if the i-th key is wrong, and to 0
+ * otherwise. Keys out of field are wrong too, and only cost half as much as
+ * the others: there is no need to find them.
+ * The result is stored in secret, which must be initialized.
+ * Returns the number of wrong keys, or -1 if two keys have the same x, or
+ * there are too many wrong keys to tell which. */
+int robust_combine(mpz_t secret,
+		unsigned char *bad,
+		const skey_set *keys,
+		unsigned keys_req,
+		const sfield *field)
+{
+	const uint64_t t = stats_start();
+	const unsigned n_keys = (unsigned) keys->count;
+	struct poly r0, r1, v0, v1, q;
+	mpz_t *x, *y, *w, *d;
+	mpz_t xv, yv, c, tmp, tmp2;
+	unsigned *idx;
+	unsigned i, j, n = n_keys, n_bad = 0;
+	int ret = -1;
+
+	assert(keys_req > 0 && keys_req <= n);
+
+	x = malloc(4 * n * sizeof *x);
+	idx = malloc(n * sizeof *idx);
+	if (!x || !idx) {
+		perror("malloc");
+		abort();
+	}
+	y = x + n;
+	w = y + n;
+	d = w + n;
+	for (i = 0; i < 4 * n; ++i)
+		mpz_init(x[i]);
+	mpz_inits(c, tmp, tmp2, NULL);
+	poly_init(&r0, n);
+	poly_init(&r1, n);
+	poly_init(&v0, n);
+	poly_init(&v1, n);
+	poly_init(&q, n);
+
+	/* A key out of the field is wrong for sure, and is dropped: the other
+	 * n keys still get over (n - keys_req) / 2 wrong ones. idx[i] is the
+	 * index in keys of the i-th key kept. */
+	for (i = 0, n = 0; i < n_keys; ++i) {
+		mpz_srcptr xi = skey_set_x(keys, i, xv);
+		mpz_srcptr yi = skey_set_y(keys, i, yv);
+
+		bad[i] = mpz_sgn(xi) < 0 || mpz_cmp(xi, field->p) >= 0
+			|| mpz_sgn(yi) < 0 || mpz_cmp(yi, field->p) >= 0;
+		if (bad[i])
+			continue;
+		mpz_set(x[n], xi);
+		mpz_set(y[n], yi);
+		idx[n++] = i;
+	}
+	if (n < keys_req)
+		goto out;
+
+	/* w[i] = 1 / d[i], with d[i] = prod(x[i] - x[j], j != i), all with one
+	 * inversion: w[i] first holds the product of the d before i */
+	mpz_set_ui(c, 1U);
+	for (i = 0; i < n; ++i) {
+		mpz_set_ui(d[i], 1U);
+		for (j = 0; j < n; ++j) {
+			if (j == i)
+				continue;
+			mpz_sub(tmp, x[i], x[j]);
+			if (mpz_sgn(tmp) < 0)
+				mpz_add(tmp, tmp, field->p);
+			mpz_mul(d[i], d[i], tmp);
+			sfield_reduce(field, d[i], tmp2);
+		}
+		if (mpz_sgn(d[i]) == 0)
+			goto out;
+		mpz_set(w[i], c);
+		mpz_mul(c, c, d[i]);
+		sfield_reduce(field, c, tmp);
+	}
+	mpz_invert(c, c, field->p);
+	for (i = n; i-- > 0;) {
+		mpz_mul(w[i], w[i], c);
+		sfield_reduce(field, w[i], tmp);
+		mpz_mul(c, c, d[i]);
+		sfield_reduce(field, c, tmp);
+	}
+
+	/* r0 = g0 = prod(x - x[i]) */
+	mpz_set_ui(r0.c[0], 1U);
+	r0.deg = 0;
+	for (j = 0; j < n; ++j) {
+		mpz_sub(c, field->p, x[j]);
+		mpz_set_ui(r0.c[j + 1], 0U);
+		for (i = j + 1; i > 0; --i) {
+			mpz_mul(tmp, r0.c[i], c);
+			mpz_add(r0.c[i], r0.c[i - 1], tmp);
+			sfield_reduce(field, r0.c[i], tmp2);
+		}
+		mpz_mul(r0.c[0], r0.c[0], c);
+		sfield_reduce(field, r0.c[0], tmp2);
+	}
+	r0.deg = (int) n;
+
+	/* r1 = g1 = sum(y[i] w[i] g0 / (x - x[i])), the polynomial through
+	 * all the keys; q holds g0 / (x - x[i]) */
+	for (i = 0; i < n; ++i)
+		mpz_set_ui(r1.c[i], 0U);
+	for (i = 0; i < n; ++i) {
+		mpz_mul(c, y[i], w[i]);
+		sfield_reduce(field, c, tmp);
+		if (mpz_sgn(c) == 0)
+			continue;
+
+		mpz_set(q.c[n - 1], r0.c[n]);
+		for (j = n - 1; j > 0; --j) {
+			mpz_mul(tmp, q.c[j], x[i]);
+			mpz_add(q.c[j - 1], r0.c[j], tmp);
+			sfield_reduce(field, q.c[j - 1], tmp2);
+		}
+		for (j = 0; j < n; ++j)
+			mpz_addmul(r1.c[j], c, q.c[j]);
+	}
+	for (i = 0; i < n; ++i)
+		sfield_reduce(field, r1.c[i], tmp);
+	r1.deg = (int) n - 1;
+	poly_normalize(&r1);
+
+	/* v0 = 0 and v1 = 1, so that r = u g0 + v g1 all along */
+	v0.deg = -1;
+	mpz_set_ui(v1.c[0], 1U);
+	v1.deg = 0;
+
+	while (2 * r1.deg >= (int) (n + keys_req)) {
+		poly_divmod(&q, &r0, &r1, field, tmp, tmp2);
+		poly_swap(&r0, &r1);
+		poly_submul(&v0, &q, &v1, field, tmp, tmp2);
+		poly_swap(&v0, &v1);
+	}
+
+	/* The polynomial of the keys is r1 / v1 */
+	poly_divmod(&q, &r1, &v1, field, tmp, tmp2);
+	if (r1.deg >= 0 || q.deg >= (int) keys_req)
+		goto out;
+
+	for (i = 0; i < n; ++i) {
+		poly_eval(c, &q, x[i], field, tmp);
+		bad[idx[i]] = mpz_cmp(c, y[i]) != 0;
+		n_bad += bad[idx[i]];
+	}
+	if (2 * n_bad > n - keys_req)
+		goto out;
+
+	if (q.deg >= 0)
+		mpz_set(secret, q.c[0]);
+	else
+		mpz_set_ui(secret, 0U);
+	ret = (int) (n_bad + n_keys - n);
+
+out:
+	poly_clear(&r0, n_keys);
+	poly_clear(&r1, n_keys);
+	poly_clear(&v0, n_keys);
+	poly_clear(&v1, n_keys);
+	poly_clear(&q, n_keys);
+	mpz_clears(c, tmp, tmp2, NULL);
+	for (i = 0; i < 4 * n_keys; ++i)
+		mpz_clear(x[i]);
+	free(x);
+	free(idx);
+	stats_stop(STATS_COMBINE, t);
+	return ret;
+}
+
+static void bpoly_normalize(struct bpoly *a)
+{
+	while (a->deg >= 0 && a->c[a->deg] == 0)
+		--a->deg;
+}
+
+/* Same as poly_divmod(), in GF(2^8) */
+static void bpoly_divmod(struct bpoly *q, struct bpoly *r,
+		const struct bpoly *b)
+{
+	unsigned char inv;
+	int i, j;
+
+	assert(b->deg >= 0);
+
+	q->deg = r->deg - b->deg;
+	if (q->deg < 0) {
+		q->deg = -1;
+		return;
+	}
+
+	inv = gf256_inv(b->c[b->deg]);
+	for (i = q->deg; i >= 0; --i) {
+		const unsigned char c = gf256_mul(r->c[i + b->deg], inv);
+
+		q->c[i] = c;
+		for (j = 0; j < b->deg; ++j)
+			r->c[i + j] ^= gf256_mul(c, b->c[j]);
+		r->c[i + b->deg] = 0U;
+	}
+	r->deg = b->deg - 1;
+	bpoly_normalize(r);
+	bpoly_normalize(q);
+}
+
+/* Same as poly_submul(), in GF(2^8), where it is an addition */
+static void bpoly_addmul(struct bpoly *a, const struct bpoly *q,
+		const struct bpoly *b)
+{
+	int i, j;
+
+	if (q->deg < 0 || b->deg < 0)
+		return;
+	for (i = a->deg + 1; i <= q->deg + b->deg; ++i)
+		a->c[i] = 0U;
+	if (a->deg < q->deg + b->deg)
+		a->deg = q->deg + b->deg;
+
+	for (i = 0; i <= q->deg; ++i)
+		for (j = 0; j <= b->deg; ++j)
+			a->c[i + j] ^= gf256_mul(q->c[i], b->c[j]);
+	bpoly_normalize(a);
+}
+
+static unsigned char bpoly_eval(const struct bpoly *f, unsigned char x)
+{
+	unsigned char r = 0U;
+	int i;
+
+	for (i = f->deg; i >= 0; --i)
+		r = (unsigned char) (gf256_mul(r, x) ^ f->c[i]);
+	return r;
+}
+
+/* Decode one byte of the secret, of which g0 and g1 are set up as in
+ * robust_combine(), setting bad[i] for the keys that are wrong.
+ * Returns -1 if there are too many of them. */
+static int decode_byte(unsigned char *secret,
+		unsigned char *bad,
+		const struct bpoly *g0,
+		const struct bpoly *g1,
+		const unsigned char *x,
+		const unsigned char *y,
+		unsigned n_keys,
+		unsigned keys_req)
+{
+	struct bpoly r0 = *g0, r1 = *g1, v0, v1, q, tmp;
+	unsigned i, n_bad = 0;
+
+	v0.deg = -1;
+	v1.c[0] = 1U;
+	v1.deg = 0;
+
+	while (2 * r1.deg >= (int) (n_keys + keys_req)) {
+		bpoly_divmod(&q, &r0, &r1);
+		tmp = r0;
+		r0 = r1;
+		r1 = tmp;
+		bpoly_addmul(&v0, &q, &v1);
+		tmp = v0;
+		v0 = v1;
+		v1 = tmp;
+	}
+
+	bpoly_divmod(&q, &r1, &v1);
+	if (r1.deg >= 0 || q.deg >= (int) keys_req)
+		return -1;
+
+	for (i = 0; i < n_keys; ++i)
+		if (bpoly_eval(&q, x[i]) != y[i]) {
+			bad[i] = 1U;
+			++n_bad;
+		}
+	if (2 * n_bad > n_keys - keys_req)
+		return -1;
+
+	*secret = q.deg >= 0 ? q.c[0] : 0U;
+	return 0;
+}
+
+/* Same as robust_combine(), for the len bytes of the secret of n_keys keys
+ * in GF(2^8), each byte being shared on its own. A key is wrong if any of
+ * its bytes is.
+ * The polynomial through all the keys is computed for all the bytes at
+ * once, and only the bytes where it is not of degree less than keys_req
+ * need decoding. */
+int robust_combine_gf256(unsigned char *secret,
+		unsigned char *bad,
+		const unsigned char *x,
+		const unsigned char *const *y,
+		size_t len,
+		unsigned n_keys,
+		unsigned keys_req)
+{
+	const uint64_t t = stats_start();
+	const unsigned n = n_keys;
+	struct bpoly g0, g1;
+	unsigned char w[GF256_MAX_KEYS], col[GF256_MAX_KEYS];
+	unsigned char *rows, *q;
+	unsigned i, j, n_bad = 0;
+	size_t b;
+	int ret = -1;
+
+	assert(keys_req > 0 && keys_req <= n && n <= GF256_MAX_KEYS);
+
+	/* rows + j * len holds the coefficients of x^j in g1 for all the
+	 * bytes; q + i * n those of g0 / (x - x[i]) */
+	rows = calloc(n * len + 1, 1);
+	q = malloc(n * n);
+	if (!rows || !q) {
+		perror("malloc");
+		abort();
+	}
+	memset(bad, 0, n);
+
+	/* w[i] = 1 / prod(x[i] - x[j], j != i) */
+	for (i = 0; i < n; ++i) {
+		unsigned char den = 1U;
+
+		for (j = 0; j < n; ++j)
+			if (j != i)
+				den = gf256_mul(den, (unsigned char) (x[i] ^ x[j]));
+		if (den == 0)
+			goto out;
+		w[i] = gf256_inv(den);
+	}
+
+	/* g0 = prod(x - x[i]) */
+	memset(g0.c, 0, sizeof g0.c);
+	g0.c[0] = 1U;
+	for (j = 0; j < n; ++j) {
+		for (i = j + 1; i > 0; --i)
+			g0.c[i] = (unsigned char) (g0.c[i - 1]
+				^ gf256_mul(g0.c[i], x[j]));
+		g0.c[0] = gf256_mul(g0.c[0], x[j]);
+	}
+	g0.deg = (int) n;
+
+	for (i = 0; i < n; ++i) {
+		unsigned char *const qi = q + i * n;
+
+		qi[n - 1] = g0.c[n];
+		for (j = n - 1; j > 0; --j)
+			qi[j - 1] = (unsigned char) (g0.c[j]
+				^ gf256_mul(qi[j], x[i]));
+		for (j = 0; j < n; ++j)
+			gf256_muladd(rows + j * len, y[i],
+				gf256_mul(w[i], qi[j]), len);
+	}
+
+	for (b = 0; b < len; ++b) {
+		int clean = 1;
+
+		for (j = keys_req; j < n && clean; ++j)
+			clean = rows[j * len + b] == 0;
+		if (clean) {
+			secret[b] = rows[b];
+			continue;
+		}
+
+		for (j = 0; j < n; ++j)
+			g1.c[j] = rows[j * len + b];
+		g1.deg = (int) n - 1;
+		bpoly_normalize(&g1);
+		for (i = 0; i < n; ++i)
+			col[i] = y[i][b];
+		if (decode_byte(secret + b, bad, &g0, &g1, x, col, n,
+				keys_req) == -1)
+			goto out;
+	}
+
+	for (i = 0; i < n; ++i)
+		n_bad += bad[i];
+	ret = (int) n_bad;
+
+out:
+	memset(rows, 0, n * len);
+	free(rows);
+	free(q);
+	stats_stop(STATS_COMBINE, t);
+	return ret;
+}
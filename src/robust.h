@@ -0,0 +1,40 @@
+#ifndef _8F0C4FE4_0A68_42CC_AE25_4D67576302AC
+#define _8F0C4FE4_0A68_42CC_AE25_4D67576302AC
+
+#include "shamir_key.h"
+#include "shamir_field.h"
+
+#include <gmp.h>
+#include <stddef.h> /* size_t */
+
+
+/* Robust combination (-r): the y values of n keys of a polynomial of degree
+ * keys_req - 1 are a codeword of a Reed-Solomon code, so up to
+ * (n - keys_req) / 2 of them can be wrong, and the secret still comes out,
+ * along with which keys were wrong.
+ *
+ * The decoding is Gao's: with g0 = prod(x - x[i]) and g1 the polynomial of
+ * degree < n through all the keys, the extended Euclidean algorithm is run
+ * on g0 and g1 until the remainder g = u g0 + v g1 has a degree below
+ * (n + keys_req) / 2. The polynomial of the keys is then g / v, and v
+ * vanishes at the x of the wrong keys. That is O(n^2) operations, and when
+ * no key is wrong, g1 already has a degree below keys_req, and it is the
+ * polynomial.
+ *
+ * Only in prime fields and in GF(2^8): over the integers, the keys are no
+ * code. */
+
+int robust_combine(mpz_t secret,
+		unsigned char *bad,
+		const skey_set *keys,
+		unsigned keys_req,
+		const sfield *field);
+int robust_combine_gf256(unsigned char *secret,
+		unsigned char *bad,
+		const unsigned char *x,
+		const unsigned char *const *y,
+		size_t len,
+		unsigned n_keys,
+		unsigned keys_req);
+
+#endif /* !_8F0C4FE4_0A68_42CC_AE25_4D67576302AC */
@@ -0,0 +1,728 @@
+/* My includes */
+#include "server.h"
+#include "libshamir.h"
+
+/* Standard C includes */
+#include <errno.h>  /* for errno, EINTR, EAGAIN */
+#include <limits.h> /* for CHAR_BIT */
+#include <signal.h> /* for sigaction(), pthread_sigmask() */
+#include <stdlib.h> /* for realloc(), free(), EXIT_FAILURE */
+#include <stdio.h>  /* for perror(), snprintf() */
+#include <string.h> /* for memcpy(), memmove(), memset(), strcspn() */
+#include <fcntl.h>  /* for fcntl() */
+#include <poll.h>   /* for poll() */
+#include <pthread.h> /* for pthread_* */
+#include <sys/socket.h> /* for socket(), bind(), accept(), send(), recv() */
+#include <sys/stat.h>   /* for lstat(), umask() */
+#include <sys/un.h>     /* for struct sockaddr_un */
+#include <unistd.h> /* for close(), unlink(), pipe(), read(), write() */
+
+
+/* The length in front of every message */
+#define LEN_SIZE 4U
+/* The length and the status in front of every reply */
+#define REPLY_HEADER (LEN_SIZE + 1U)
+/* How much is read from a client at a time */
+#define READ_SIZE ((size_t) 16384U)
+
+
+struct buffer {
+	unsigned char *data;
+	size_t len;
+	size_t cap;
+};
+
+struct client {
+	int fd;             /* -1 if the slot is free */
+	struct buffer in;   /* What the client sent, and we haven't answered */
+	struct buffer out;  /* The reply being sent, if len > 0 */
+	size_t sent;        /* The bytes of out sent so far */
+	int busy;           /* A worker is answering a request of the client:
+	                       in and out are the worker's until it is done */
+	int failed;         /* The worker ran out of memory */
+};
+
+/* A worker answers one request at a time, with its own context. Everything
+ * is kept from one request to the next, so a request only allocates when it
+ * is larger than the ones before it. */
+struct worker {
+	pthread_t thread;
+	struct server *s;
+	shamir_ctx *ctx;
+	struct buffer text;   /* The keys of a combine request */
+	const char **lines;   /* The keys of a combine request, one by one */
+	size_t lines_cap;
+};
+
+/* The main thread does all the I/O, and hands every request that has come
+ * in full to the workers, through queue. A client only has one request in
+ * the queue or with a worker at a time, which keeps the replies in order.
+ * busy, failed and the queue are only touched with lock held. */
+struct server {
+	int fd;
+	struct client clients[SERVER_MAX_CLIENTS];
+	unsigned n_clients;
+	struct worker *workers;
+	unsigned n_workers;
+
+	pthread_mutex_t lock;
+	pthread_cond_t ready;       /* Signaled when the queue gets a client */
+	struct client *queue[SERVER_MAX_CLIENTS];
+	unsigned head, queued;
+	int stopping;
+	int wake[2];                /* A pipe the workers write to when they
+	                               are done, to wake poll() up */
+};
+
+static volatile sig_atomic_t stop;
+
+
+static void on_signal(int sig)
+{
+	(void) sig;
+	stop = 1;
+}
+
+static void put_be(unsigned char *p, unsigned long v, unsigned n)
+{
+	while (n-- > 0) {
+		p[n] = (unsigned char) (v & 0xffU);
+		v >>= CHAR_BIT;
+	}
+}
+
+static unsigned long get_be(const unsigned char *p, unsigned n)
+{
+	unsigned long v = 0;
+	unsigned i;
+
+	for (i = 0; i < n; ++i)
+		v = (v << CHAR_BIT) | p[i];
+
+	return v;
+}
+
+/* Make sure b holds at least size bytes */
+static int buffer_reserve(struct buffer *b, size_t size)
+{
+	unsigned char *d;
+	size_t cap;
+
+	if (size <= b->cap)
+		return 0;
+
+	cap = b->cap ? 2 * b->cap : READ_SIZE;
+	if (cap < size)
+		cap = size;
+
+	d = realloc(b->data, cap);
+	if (!d) {
+		perror("realloc");
+		return -1;
+	}
+	b->data = d;
+	b->cap = cap;
+
+	return 0;
+}
+
+static void buffer_free(struct buffer *b)
+{
+	if (b->data)
+		memset(b->data, 0, b->cap);
+	free(b->data);
+	b->data = NULL;
+	b->len = b->cap = 0;
+}
+
+
+/* Start a reply with a body of at most body_size bytes. The body is
+ * written at c->out.data + c->out.len. */
+static int reply_begin(struct client *c, size_t body_size)
+{
+	if (buffer_reserve(&c->out, REPLY_HEADER + body_size) == -1)
+		return -1;
+
+	c->out.len = REPLY_HEADER;
+	return 0;
+}
+
+static void reply_end(struct client *c, unsigned status)
+{
+	put_be(c->out.data, (unsigned long) (c->out.len - LEN_SIZE), LEN_SIZE);
+	c->out.data[LEN_SIZE] = (unsigned char) status;
+}
+
+/* Reply with the error message msg.
+ * Returns 0, since the client can go on with its next request, unless we
+ * ran out of memory. */
+static int reply_error(struct client *c, const char *msg)
+{
+	const size_t len = strlen(msg);
+
+	if (reply_begin(c, len) == -1)
+		return -1;
+
+	memcpy(c->out.data + c->out.len, msg, len);
+	c->out.len += len;
+	reply_end(c, SERVER_ERROR);
+
+	return 0;
+}
+
+/* 'G', mode, flags, KEYS_REQ, N_KEYS, secret */
+static int split(struct worker *w,
+		struct client *c,
+		const unsigned char *req,
+		size_t len)
+{
+	unsigned n_keys;
+	const char *keys;
+	size_t keys_len;
+
+	if (len < 7)
+		return reply_error(c, "Truncated split request.");
+
+	n_keys = (unsigned) get_be(req + 5, 2);
+
+	/* Every key takes about two hexadecimal digits per byte of secret */
+	if ((unsigned long) n_keys * (len - 7) > SERVER_MAX_REPLY / 2)
+		return reply_error(c, "The keys would be too large.");
+
+	if (shamir_split(w->ctx, req + 7, len - 7,
+			(enum shamir_mode) req[1],
+			(unsigned) get_be(req + 3, 2),
+			n_keys,
+			req[2],
+			&keys, &keys_len) == -1)
+		return reply_error(c, shamir_strerror(w->ctx));
+
+	if (reply_begin(c, keys_len) == -1)
+		return -1;
+	memcpy(c->out.data + c->out.len, keys, keys_len);
+	c->out.len += keys_len;
+
+	reply_end(c, SERVER_OK);
+	return 0;
+}
+
+/* 'D', N_KEYS, keys */
+static int combine(struct worker *w,
+		struct client *c,
+		const unsigned char *req,
+		size_t len)
+{
+	const unsigned char *secret;
+	size_t secret_len, count = 0;
+	char msg[64];
+	unsigned n;
+	char *p;
+
+	if (len < 3)
+		return reply_error(c, "Truncated combine request.");
+
+	n = (unsigned) get_be(req + 1, 2);
+	req += 3;
+	len -= 3;
+
+	/* A null-terminated copy of the keys, cut up into lines */
+	if (buffer_reserve(&w->text, len + 1) == -1)
+		return -1;
+	memcpy(w->text.data, req, len);
+	w->text.data[len] = '\0';
+	w->text.len = len + 1;
+
+	if (n > w->lines_cap) {
+		const char **l = realloc(w->lines, n * sizeof *l);
+
+		if (!l) {
+			perror("realloc");
+			return -1;
+		}
+		w->lines = l;
+		w->lines_cap = n;
+	}
+
+	for (p = (char *) w->text.data; count < n && *p; ) {
+		char *const eol = p + strcspn(p, "\r\n");
+		const int last = *eol == '\0';
+
+		*eol = '\0';
+		if (*p)
+			w->lines[count++] = p;
+		if (last)
+			break;
+		p = eol + 1;
+	}
+
+	if (count < n) {
+		snprintf(msg, sizeof msg, "%u keys are needed, only %lu were given.",
+			n, (unsigned long) count);
+		return reply_error(c, msg);
+	}
+
+	if (shamir_combine(w->ctx, w->lines, n, &secret, &secret_len) == -1)
+		return reply_error(c, shamir_strerror(w->ctx));
+
+	if (reply_begin(c, secret_len) == -1)
+		return -1;
+	memcpy(c->out.data + c->out.len, secret, secret_len);
+	c->out.len += secret_len;
+
+	reply_end(c, SERVER_OK);
+	return 0;
+}
+
+/* Answer the request req, of len bytes, into c->out.
+ * Returns -1 if the connection must be closed. */
+static int handle(struct worker *w,
+		struct client *c,
+		const unsigned char *req,
+		size_t len)
+{
+	if (len == 0)
+		return reply_error(c, "Empty request.");
+
+	switch (req[0]) {
+	case 'G': return split(w, c, req, len);
+	case 'D': return combine(w, c, req, len);
+	default:  return reply_error(c, "Unknown request.");
+	}
+}
+
+
+/* Send what we can of the reply to c. Once it is all sent, it is wiped.
+ * Returns -1 if the connection must be closed. */
+static int flush(struct client *c)
+{
+	while (c->sent < c->out.len) {
+		const ssize_t r = send(c->fd, c->out.data + c->sent,
+			c->out.len - c->sent, 0);
+
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		c->sent += (size_t) r;
+	}
+
+	memset(c->out.data, 0, c->out.len);
+	c->out.len = 0;
+	c->sent = 0;
+
+	return 0;
+}
+
+/* Read what c has sent so far.
+ * Returns -1 if the connection must be closed. */
+static int receive(struct client *c)
+{
+	ssize_t r;
+
+	if (buffer_reserve(&c->in, c->in.len + READ_SIZE) == -1)
+		return -1;
+
+	do
+		r = recv(c->fd, c->in.data + c->in.len, c->in.cap - c->in.len, 0);
+	while (r == -1 && errno == EINTR);
+
+	if (r == -1)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+	if (r == 0)
+		return -1;
+
+	c->in.len += (size_t) r;
+	return 0;
+}
+
+/* Send what is left of the reply to c, and hand its next request, once it
+ * has come in full, to the workers. A client whose reply is still being
+ * sent, or whose request is with a worker, isn't read from, which bounds
+ * what it can make us buffer. c must not be busy.
+ * Returns 1 if c is now busy, and -1 if the connection must be closed. */
+static int serve(struct server *s, struct client *c)
+{
+	unsigned long len;
+
+	if (c->out.len > 0) {
+		if (flush(c) == -1)
+			return -1;
+		if (c->out.len > 0)
+			return 0;
+	}
+
+	if (c->in.len < LEN_SIZE)
+		return 0;
+	len = get_be(c->in.data, LEN_SIZE);
+	if (len > SERVER_MAX_REQUEST)
+		return -1;
+	if (c->in.len - LEN_SIZE < len)
+		return 0;
+
+	pthread_mutex_lock(&s->lock);
+	c->busy = 1;
+	s->queue[(s->head + s->queued++) % SERVER_MAX_CLIENTS] = c;
+	pthread_cond_signal(&s->ready);
+	pthread_mutex_unlock(&s->lock);
+
+	return 1;
+}
+
+/* Answer the requests of the queue until the server stops */
+static void *worker_main(void *arg)
+{
+	struct worker *const w = arg;
+	struct server *const s = w->s;
+	const char done = 0;
+
+	for (;;) {
+		struct client *c;
+		unsigned long len;
+		int r;
+
+		pthread_mutex_lock(&s->lock);
+		while (s->queued == 0 && !s->stopping)
+			pthread_cond_wait(&s->ready, &s->lock);
+		if (s->queued == 0) {
+			pthread_mutex_unlock(&s->lock);
+			return NULL;
+		}
+		c = s->queue[s->head];
+		s->head = (s->head + 1) % SERVER_MAX_CLIENTS;
+		--s->queued;
+		pthread_mutex_unlock(&s->lock);
+
+		/* serve() checked that the request is all there */
+		len = get_be(c->in.data, LEN_SIZE);
+		r = handle(w, c, c->in.data + LEN_SIZE, (size_t) len);
+
+		/* Drop the request, and wipe what is left of it */
+		len += LEN_SIZE;
+		c->in.len -= (size_t) len;
+		memmove(c->in.data, c->in.data + len, c->in.len);
+		memset(c->in.data + c->in.len, 0, (size_t) len);
+
+		pthread_mutex_lock(&s->lock);
+		c->busy = 0;
+		c->failed = r == -1;
+		pthread_mutex_unlock(&s->lock);
+
+		/* If the pipe is full, poll() has been woken up already */
+		while (write(s->wake[1], &done, 1) == -1 && errno == EINTR)
+			;
+	}
+}
+
+static int set_nonblocking(int fd)
+{
+	const int flags = fcntl(fd, F_GETFL);
+
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -1;
+
+	return 0;
+}
+
+static void accept_clients(struct server *s)
+{
+	while (s->n_clients < SERVER_MAX_CLIENTS) {
+		struct client *c;
+		const int fd = accept(s->fd, NULL, NULL);
+
+		if (fd == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK
+					&& errno != EINTR && errno != ECONNABORTED)
+				perror("accept");
+			return;
+		}
+		if (set_nonblocking(fd) == -1) {
+			perror("fcntl");
+			close(fd);
+			continue;
+		}
+
+		/* The slots stay put, since the workers hold on to them */
+		for (c = s->clients; c->fd != -1; ++c)
+			;
+		memset(c, 0, sizeof *c);
+		c->fd = fd;
+		++s->n_clients;
+	}
+}
+
+/* Close the connection to c, which must not be busy, and free its slot */
+static void drop(struct server *s, struct client *c)
+{
+	close(c->fd);
+	buffer_free(&c->in);
+	buffer_free(&c->out);
+	c->fd = -1;
+	--s->n_clients;
+}
+
+/* Tell whether addr is a socket left behind by a server that is gone */
+static int is_stale(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd, stale;
+
+	if (lstat(addr->sun_path, &st) == -1 || !S_ISSOCK(st.st_mode))
+		return 0;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return 0;
+	stale = connect(fd, (const struct sockaddr *) addr, sizeof *addr) == -1
+		&& errno == ECONNREFUSED;
+	close(fd);
+
+	return stale;
+}
+
+/* Create the socket path, and listen on it.
+ * Returns the socket, or -1 on failure. */
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr;
+	mode_t mask;
+	int fd, r;
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "The socket path %s is too long.\n", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (is_stale(&addr))
+		unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		perror("socket");
+		return -1;
+	}
+
+	/* The requests and the replies hold secrets: only our own user may
+	 * connect */
+	mask = umask(077);
+	r = bind(fd, (const struct sockaddr *) &addr, sizeof addr);
+	umask(mask);
+	if (r == -1) {
+		fprintf(stderr, "Failed to bind to %s: %s.\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (listen(fd, SOMAXCONN) == -1 || set_nonblocking(fd) == -1) {
+		perror("listen");
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Start n workers, each with its own context.
+ * Returns 0 on success. */
+static int start_workers(struct server *s, unsigned n)
+{
+	sigset_t all, old;
+	unsigned i;
+	int ret = 0;
+
+	s->workers = calloc(n, sizeof *s->workers);
+	if (!s->workers) {
+		perror("calloc");
+		return -1;
+	}
+
+	/* The signals go to the main thread, so that they wake poll() up */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (i = 0; i < n; ++i) {
+		struct worker *const w = &s->workers[i];
+
+		w->s = s;
+		w->ctx = shamir_ctx_new();
+		if (!w->ctx) {
+			fputs("Failed to create a context.\n", stderr);
+			ret = -1;
+			break;
+		}
+		if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+			fputs("Failed to start a worker.\n", stderr);
+			shamir_ctx_free(w->ctx);
+			ret = -1;
+			break;
+		}
+		++s->n_workers;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	return ret;
+}
+
+/* Let the workers finish the requests they are answering, and free them */
+static void stop_workers(struct server *s)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&s->lock);
+	s->stopping = 1;
+	s->queued = 0;
+	pthread_cond_broadcast(&s->ready);
+	pthread_mutex_unlock(&s->lock);
+
+	for (i = 0; i < s->n_workers; ++i) {
+		struct worker *const w = &s->workers[i];
+
+		pthread_join(w->thread, NULL);
+		shamir_ctx_free(w->ctx);
+		buffer_free(&w->text);
+		free(w->lines);
+	}
+	free(s->workers);
+}
+
+/* Serve split and combine requests on the Unix domain socket path, with
+ * threads workers, until SIGINT or SIGTERM.
+ * Returns 0 on success. */
+int server_run(const char *path, unsigned threads)
+{
+	struct pollfd pfd[2 + SERVER_MAX_CLIENTS];
+	struct client *polled[SERVER_MAX_CLIENTS];
+	struct sigaction sa;
+	struct server s;
+	char drain[64];
+	unsigned i;
+	int ret = 0;
+
+	memset(&s, 0, sizeof s);
+	for (i = 0; i < SERVER_MAX_CLIENTS; ++i)
+		s.clients[i].fd = -1;
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.ready, NULL);
+
+	if (pipe(s.wake) == -1) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+	if (set_nonblocking(s.wake[0]) == -1
+			|| set_nonblocking(s.wake[1]) == -1) {
+		perror("fcntl");
+		ret = EXIT_FAILURE;
+		goto out_pipe;
+	}
+
+	s.fd = listen_on(path);
+	if (s.fd == -1) {
+		ret = EXIT_FAILURE;
+		goto out_pipe;
+	}
+
+	/* No SA_RESTART, so that poll() returns when we are told to stop */
+	memset(&sa, 0, sizeof sa);
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	/* A client that goes away is noticed when send() fails */
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &sa, NULL);
+
+	if (start_workers(&s, threads ? threads : 1U) == -1) {
+		stop = 1;
+		ret = EXIT_FAILURE;
+	}
+
+	while (!stop) {
+		nfds_t n = 2, k;
+
+		pfd[0].fd = s.fd;
+		pfd[0].events = s.n_clients < SERVER_MAX_CLIENTS ? POLLIN : 0;
+		pfd[1].fd = s.wake[0];
+		pfd[1].events = POLLIN;
+
+		/* The clients the workers are done with first: they may have a
+		 * reply to send, or a request to hand on */
+		for (i = 0; i < SERVER_MAX_CLIENTS; ++i) {
+			struct client *const c = &s.clients[i];
+			int busy, failed, r;
+
+			if (c->fd == -1)
+				continue;
+			/* Once a worker is done with c, it doesn't touch it again
+			 * until serve() hands it on */
+			pthread_mutex_lock(&s.lock);
+			busy = c->busy;
+			failed = c->failed;
+			pthread_mutex_unlock(&s.lock);
+			if (busy)
+				continue;
+
+			r = failed ? -1 : serve(&s, c);
+			if (r == -1)
+				drop(&s, c);
+			if (r != 0)
+				continue;
+
+			polled[n - 2] = c;
+			pfd[n].fd = c->fd;
+			pfd[n].events = c->out.len > 0 ? POLLOUT : POLLIN;
+			++n;
+		}
+
+		if (poll(pfd, n, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		if (pfd[1].revents & POLLIN)
+			while (read(s.wake[0], drain, sizeof drain) > 0)
+				;
+
+		for (k = 2; k < n; ++k) {
+			struct client *const c = polled[k - 2];
+			const short revents = pfd[k].revents;
+			int r = 0;
+
+			if (!revents)
+				continue;
+
+			if (revents & POLLNVAL)
+				r = -1;
+			else if (c->out.len == 0 && (revents & (POLLIN | POLLHUP | POLLERR)))
+				r = receive(c);
+			if (r == -1)
+				drop(&s, c);
+		}
+
+		if (pfd[0].revents & POLLIN)
+			accept_clients(&s);
+	}
+
+	stop_workers(&s);
+
+	for (i = 0; i < SERVER_MAX_CLIENTS; ++i)
+		if (s.clients[i].fd != -1)
+			drop(&s, &s.clients[i]);
+	close(s.fd);
+	unlink(path);
+out_pipe:
+	close(s.wake[0]);
+	close(s.wake[1]);
+	pthread_mutex_destroy(&s.lock);
+	pthread_cond_destroy(&s.ready);
+
+	return ret;
+}
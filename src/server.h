@@ -0,0 +1,43 @@
+#ifndef _5A0F3C2E_91B4_4E7D_A6C8_2D17E4B9F053
+#define _5A0F3C2E_91B4_4E7D_A6C8_2D17E4B9F053
+
+
+/* The server answers requests on a Unix domain socket, for clients that
+ * would otherwise start a process for every secret. A client may send
+ * request after request on the same connection; the replies come back in
+ * the same order.
+ *
+ * The requests are answered by a pool of worker threads, each with its own
+ * context, so a large request only holds up the requests sent after it on
+ * the same connection. One connection's requests are answered one at a
+ * time, in order.
+ *
+ * Every message is a 32-bit length followed by that many bytes of body.
+ * All the numbers are big-endian.
+ *
+ * Split request:
+ *   'G', mode (enum shamir_mode), flags, KEYS_REQ (2 bytes), N_KEYS (2 bytes),
+ *   then the bytes of the secret, as -g -f reads them.
+ *   The flags are those of shamir_split(). In prime and integer modes, a
+ *   secret that starts with a zero byte is refused, as with shamir_split().
+ * Combine request:
+ *   'D', N_KEYS (2 bytes), then the keys, one per line, as -g prints them.
+ *   The first N_KEYS keys are combined.
+ *
+ * Reply:
+ *   SERVER_OK, then the keys, one per line, or the bytes of the secret;
+ *   or SERVER_ERROR, then a message saying what was wrong. */
+
+#define SERVER_OK    0x00U
+#define SERVER_ERROR 0x01U
+
+/* Requests larger than this close the connection */
+#define SERVER_MAX_REQUEST ((unsigned long) 1U << 20)
+/* Split requests whose keys would take more than this are refused */
+#define SERVER_MAX_REPLY   ((unsigned long) 64U << 20)
+/* The number of clients served at the same time */
+#define SERVER_MAX_CLIENTS 64U
+
+int server_run(const char *path, unsigned threads);
+
+#endif /* !_5A0F3C2E_91B4_4E7D_A6C8_2D17E4B9F053 */
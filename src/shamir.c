@@ -1,6 +1,8 @@
 #include "shamir.h"
+#include "stats.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -9,9 +11,12 @@
 
 static char *get_str_secret(mpz_t *secret);
 
-char *shamir2_calculate_secret_str(shamir_key **const keys)
+char *shamir2_calculate_secret_str(const skey_set *keys)
 {
 	mpz_t ydiff, xdiff, b;
+	mpz_t x0v, x1v, y0v, y1v;
+	mpz_srcptr x0 = skey_set_x(keys, 0, x0v), x1 = skey_set_x(keys, 1, x1v);
+	mpz_srcptr y0 = skey_set_y(keys, 0, y0v), y1 = skey_set_y(keys, 1, y1v);
 
 	/* f(x) = ax + b
 	 *
@@ -37,13 +42,13 @@ char *shamir2_calculate_secret_str(shamir_key **const keys)
 	mpz_inits(xdiff, ydiff, b, NULL);
 
 	/* Calculate xdiff */
-	mpz_sub(xdiff, keys[1]->x, keys[0]->x);
+	mpz_sub(xdiff, x1, x0);
 
 	/* Calculate ydiff */
-	mpz_sub(ydiff, keys[1]->y, keys[0]->y);
+	mpz_sub(ydiff, y1, y0);
 
 	/* Calculate keys[0]->x * ydiff */
-	mpz_mul(b, keys[0]->x, ydiff);
+	mpz_mul(b, x0, ydiff);
 
 	/* Make sure we can divide */
 	assert(mpz_divisible_p(b, xdiff));
@@ -52,7 +57,7 @@ char *shamir2_calculate_secret_str(shamir_key **const keys)
 	mpz_divexact(b, b, xdiff);
 
 	/* Negate keys[0]->x * ydiff / xdiff - keys[0]->y (which is -b) */
-	mpz_sub(b, b, keys[0]->y);
+	mpz_sub(b, b, y0);
 
 	/* Calculate the final b (which is the secret) */
 	mpz_neg(b, b);
@@ -63,10 +68,13 @@ char *shamir2_calculate_secret_str(shamir_key **const keys)
 	return get_str_secret(&b);
 }
 
-char *shamir2_calculate_secret_str2(shamir_key **const keys)
+char *shamir2_calculate_secret_str2(const skey_set *keys)
 {
 	mpz_t ydiff, xdiff, b;
 	mpq_t a, a_times_k0x;
+	mpz_t x0v, x1v, y0v, y1v;
+	mpz_srcptr x0 = skey_set_x(keys, 0, x0v), x1 = skey_set_x(keys, 1, x1v);
+	mpz_srcptr y0 = skey_set_y(keys, 0, y0v), y1 = skey_set_y(keys, 1, y1v);
 
 	/* f(x) = ax + b
 	 *
@@ -92,10 +100,10 @@ char *shamir2_calculate_secret_str2(shamir_key **const keys)
 	mpz_inits(xdiff, ydiff, b, NULL);
 
 	/* Calculate xdiff */
-	mpz_sub(xdiff, keys[1]->x, keys[0]->x);
+	mpz_sub(xdiff, x1, x0);
 
 	/* Calculate ydiff */
-	mpz_sub(ydiff, keys[1]->y, keys[0]->y);
+	mpz_sub(ydiff, y1, y0);
 
 	/* Calculate a = ydiff / xdiff */
 	mpq_init(a);
@@ -106,14 +114,14 @@ char *shamir2_calculate_secret_str2(shamir_key **const keys)
 	/* Calculate a * keys[0]->x */
 	mpq_init(a_times_k0x);
 	mpq_set(a_times_k0x, a);
-	mpz_mul(mpq_numref(a_times_k0x), mpq_numref(a_times_k0x), keys[0]->x);
+	mpz_mul(mpq_numref(a_times_k0x), mpq_numref(a_times_k0x), x0);
 	mpq_canonicalize(a_times_k0x);
 
 	/* a * keys[0]->x must be an integer */
 	assert(mpz_get_ui(mpq_denref(a_times_k0x)) == 1);
 
 	/* Calculate b */
-	mpz_sub(b, keys[0]->y, mpq_numref(a_times_k0x));
+	mpz_sub(b, y0, mpq_numref(a_times_k0x));
 
 	/* Clear no longer needed variables */
 	mpz_clears(xdiff, ydiff, NULL);
@@ -122,27 +130,908 @@ char *shamir2_calculate_secret_str2(shamir_key **const keys)
 	return get_str_secret(&b);
 }
 
-/* Note: after I finished writing this here function, I realized that I could have
- * done without it and used mpz_get_str().
- * But it's too late now.
- * I wrote it, and I damn well sure better use it. */
-static char *get_str_secret(mpz_t *secret)
+static int weights_compute(shamir_weights *wt,
+		const skey_set *keys,
+		const size_t *order,
+		const sfield *field);
+static int weights_apply(mpz_t secret,
+		const shamir_weights *wt,
+		const skey_set *keys,
+		const size_t *order,
+		const sfield *field);
+static void weights_free(shamir_weights *wt);
+static void lagrange_terms(mpz_t *num, mpz_t *den,
+		const skey_set *keys,
+		const size_t *order,
+		const sfield *field,
+		mpz_t tmp);
+static mpz_t *alloc_mpz_array(size_t n);
+static void free_mpz_array(mpz_t *a, size_t n);
+
+/* Recover the secret from the keys, for any threshold, by Lagrange
+ * interpolation at x = 0:
+ *
+ *          keys->count-1     ____      x[j]
+ *             ____           |  |  -----------
+ * secret  =   \       y[i]   |  |  x[j] - x[i]
+ *             /___         j != i
+ *             i = 0
+ *
+ * The products only depend on the x values: they are the weights, and the
+ * secret is their dot product with the y values. See
+ * shamir_calculate_secret_cached() to keep them for the next secret.
+ *
+ * If field is not NULL, the keys were generated in that field and so is all
+ * the arithmetic. Otherwise the keys were generated over the integers.
+ * The result is stored in secret, which must be initialized.
+ * Returns 0 on success, and -1 if two keys have the same x, if a key isn't
+ * an element of field, or if, over the integers, the keys are inconsistent:
+ * one of them is wrong. */
+int shamir_calculate_secret(mpz_t secret,
+		const skey_set *keys,
+		const sfield *field)
 {
-	static const char *const format = "%#Zx";
-	char *str;
-	size_t size;
-	const int ret = gmp_snprintf(NULL, 0U, format, *secret);
+	const uint64_t t = stats_start();
+	shamir_weights wt;
+	int ret;
 
-	if (ret < 0)
-		return NULL;
+	assert(keys->count > 0);
 
-	size = (size_t) ret + 1;
+	ret = weights_compute(&wt, keys, NULL, field);
+	if (ret == 0)
+		ret = weights_apply(secret, &wt, keys, NULL, field);
+	weights_free(&wt);
 
-	str = malloc(size);
-	if (!str)
+	stats_stop(STATS_COMBINE, t);
+	return ret;
+}
+
+/* Same as shamir_calculate_secret(), but return the secret as a string,
+ * like shamir2_calculate_secret_str() does.
+ * Returns NULL on failure. */
+char *shamir_calculate_secret_str(const skey_set *keys,
+		const sfield *field)
+{
+	mpz_t secret;
+
+	mpz_init(secret);
+	if (shamir_calculate_secret(secret, keys, field) == -1) {
+		mpz_clear(secret);
 		return NULL;
+	}
+
+	return get_str_secret(&secret);
+}
+
+void shamir_weights_cache_init(shamir_weights_cache *cache)
+{
+	memset(cache, 0, sizeof *cache);
+}
+
+void shamir_weights_cache_clear(shamir_weights_cache *cache)
+{
+	unsigned i;
+
+	for (i = 0; i < SHAMIR_WEIGHTS_CACHE_SIZE; ++i)
+		if (cache->entry[i].count)
+			weights_free(&cache->entry[i]);
+	free(cache->order);
+	memset(cache, 0, sizeof *cache);
+}
+
+/* Put the indices of the keys in cache->order, in increasing order of x.
+ * This is an insertion sort that starts from the order of the last call,
+ * which is already the right one when the keys keep coming in the same
+ * order, as they do from the same files.
+ * Returns -1 if two keys have the same x. */
+static int sort_keys(shamir_weights_cache *cache, const skey_set *keys)
+{
+	const size_t n = keys->count;
+	size_t i, j, k;
+	mpz_t view, prev;
+	int dup = 0;
+
+	if (cache->order_count != n) {
+		if (n > cache->order_cap) {
+			size_t *o = realloc(cache->order, n * sizeof *o);
+
+			if (!o) {
+				perror("realloc");
+				abort();
+			}
+			cache->order = o;
+			cache->order_cap = n;
+		}
+		for (i = 0; i < n; ++i)
+			cache->order[i] = i;
+		cache->order_count = n;
+	}
+
+	for (i = 1; i < n; ++i) {
+		mpz_srcptr x;
+
+		k = cache->order[i];
+		x = skey_set_x(keys, k, view);
+
+		for (j = i; j > 0; --j) {
+			const int c = mpz_cmp(skey_set_x(keys, cache->order[j - 1],
+				prev), x);
+
+			if (c <= 0) {
+				dup = c == 0;
+				break;
+			}
+			cache->order[j] = cache->order[j - 1];
+		}
+		/* Even then, so that order stays a permutation */
+		cache->order[j] = k;
+		if (dup)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Returns the weights of cache for the x values of keys, sorted by
+ * sort_keys(), or NULL if they aren't there */
+static shamir_weights *find_weights(shamir_weights_cache *cache,
+		const skey_set *keys,
+		mp_bitcnt_t e)
+{
+	const size_t n = keys->count;
+	mpz_t view;
+	unsigned i;
+	size_t p;
+
+	for (i = 0; i < SHAMIR_WEIGHTS_CACHE_SIZE; ++i) {
+		shamir_weights *const wt = &cache->entry[i];
+
+		if (wt->count != n || wt->e != e)
+			continue;
+
+		for (p = 0; p < n; ++p)
+			if (mpz_cmp(wt->x[p], skey_set_x(keys, cache->order[p],
+					view)) != 0)
+				break;
+		if (p == n)
+			return wt;
+	}
+
+	return NULL;
+}
+
+/* Same as shamir_calculate_secret(), but keep the weights of the x values
+ * of keys in cache, where the next secrets with the same x values, in any
+ * order, find them: each of them then only costs keys->count
+ * multiplications, instead of keys->count^2.
+ * cache must have been initialized with shamir_weights_cache_init(). */
+int shamir_calculate_secret_cached(mpz_t secret,
+		const skey_set *keys,
+		const sfield *field,
+		shamir_weights_cache *cache)
+{
+	const uint64_t t = stats_start();
+	const mp_bitcnt_t e = field ? field->e : 0;
+	shamir_weights *wt;
+	unsigned i;
+	int ret = -1;
+
+	assert(keys->count > 0);
+
+	if (sort_keys(cache, keys) == -1)
+		goto out;
+
+	wt = find_weights(cache, keys, e);
+	if (!wt) {
+		/* Replace the weights that went unused the longest */
+		wt = &cache->entry[0];
+		for (i = 1; i < SHAMIR_WEIGHTS_CACHE_SIZE; ++i)
+			if (cache->entry[i].used < wt->used)
+				wt = &cache->entry[i];
+		if (wt->count)
+			weights_free(wt);
+
+		if (weights_compute(wt, keys, cache->order, field) == -1) {
+			weights_free(wt);
+			goto out;
+		}
+	}
+	wt->used = ++cache->clock;
+
+	ret = weights_apply(secret, wt, keys, cache->order, field);
+
+out:
+	stats_stop(STATS_COMBINE, t);
+	return ret;
+}
+
+/* The y of the key at x = at in GF(p), from the keys and their
+ * denominators d: y = m * sum(y[i] / u[i]), with u[i] = (x[i] - at) * d[i]
+ * and m = prod(x[i] - at). All the u[i] are inverted at once with
+ * Montgomery's trick, as in weights_field().
+ * Returns -1 if at is the x of one of the keys. */
+static int issue_field(mpz_t y,
+		const mpz_t at,
+		const skey_set *keys,
+		mpz_t *d,
+		mpz_t *u,
+		mpz_t *pre,
+		const sfield *field)
+{
+	const size_t n = keys->count;
+	mpz_t m, inv, w, tmp, view;
+	size_t i;
+	int ret = 0;
+
+	mpz_inits(m, inv, w, tmp, NULL);
+
+	mpz_set_ui(m, 1U);
+	for (i = 0; i < n; ++i) {
+		mpz_sub(u[i], skey_set_x(keys, i, view), at);
+		if (mpz_sgn(u[i]) < 0)
+			mpz_add(u[i], u[i], field->p);
+		mpz_mul(m, m, u[i]);
+		sfield_reduce(field, m, tmp);
+		mpz_mul(u[i], u[i], d[i]);
+		sfield_reduce(field, u[i], tmp);
+
+		if (i > 0) {
+			mpz_mul(pre[i], pre[i - 1], u[i]);
+			sfield_reduce(field, pre[i], tmp);
+		} else {
+			mpz_set(pre[i], u[i]);
+		}
+	}
+
+	if (!mpz_invert(inv, pre[n - 1], field->p)) {
+		ret = -1;
+		goto out;
+	}
+
+	mpz_set_ui(y, 0U);
+	for (i = n; i-- > 0; ) {
+		/* w = 1 / u[i] */
+		if (i > 0) {
+			mpz_mul(w, inv, pre[i - 1]);
+			sfield_reduce(field, w, tmp);
+			mpz_mul(inv, inv, u[i]);
+			sfield_reduce(field, inv, tmp);
+		} else {
+			mpz_set(w, inv);
+		}
+		mpz_addmul(y, w, skey_set_y(keys, i, view));
+	}
+	sfield_reduce(field, y, tmp);
+	mpz_mul(y, y, m);
+	sfield_reduce(field, y, tmp);
+
+out:
+	mpz_clears(m, inv, w, tmp, NULL);
+	return ret;
+}
+
+/* issue_field() over the integers: the sum is put over the common
+ * denominator prod(u[i]), with the cofactors of weights_integer(), and
+ * y = m * sum(y[i] * prod(u[j], j != i)) / prod(u[i]) is exact.
+ * Returns -1 if at is the x of one of the keys, or if the division is not
+ * exact: the keys are inconsistent. */
+static int issue_integer(mpz_t y,
+		const mpz_t at,
+		const skey_set *keys,
+		mpz_t *d,
+		mpz_t *u,
+		mpz_t *pre)
+{
+	const size_t n = keys->count;
+	mpz_t m, suf, tmp, view;
+	size_t i;
+	int ret = 0;
+
+	mpz_inits(m, suf, tmp, NULL);
+
+	mpz_set_ui(m, 1U);
+	for (i = 0; i < n; ++i) {
+		mpz_sub(u[i], skey_set_x(keys, i, view), at);
+		mpz_mul(m, m, u[i]);
+		mpz_mul(u[i], u[i], d[i]);
+
+		if (i > 0)
+			mpz_mul(pre[i], pre[i - 1], u[i]);
+		else
+			mpz_set(pre[i], u[i]);
+	}
+
+	if (mpz_sgn(pre[n - 1]) == 0) {
+		ret = -1;
+		goto out;
+	}
+
+	mpz_set_ui(y, 0U);
+	mpz_set_ui(suf, 1U);
+	for (i = n; i-- > 0; ) {
+		if (i > 0)
+			mpz_mul(tmp, pre[i - 1], suf);
+		else
+			mpz_set(tmp, suf);
+		mpz_addmul(y, tmp, skey_set_y(keys, i, view));
+
+		mpz_mul(suf, suf, u[i]);
+	}
+	mpz_mul(y, y, m);
+
+	/* A wrong key makes y a fraction */
+	if (!mpz_divisible_p(y, pre[n - 1])) {
+		ret = -1;
+		goto out;
+	}
+	mpz_divexact(y, y, pre[n - 1]);
+
+out:
+	mpz_clears(m, suf, tmp, NULL);
+	return ret;
+}
+
+/* Calculate new keys, at the x values at[0], ..., at[n_at - 1], of the
+ * polynomial the keys were generated from, without ever calculating the
+ * secret: the keys already handed out stay valid, and the new ones go with
+ * them. There must be at least KEYS_REQ keys, or the new keys belong to
+ * another polynomial, and nothing can tell.
+ *
+ * This is the interpolation of shamir_calculate_secret() at x = at instead
+ * of 0, in barycentric form:
+ *
+ *                keys->count-1
+ *                    ____            y[i]
+ * y  =  m  *         \       --------------------
+ *                    /___    (x[i] - at) * d[i]
+ *                    i = 0
+ *
+ * where m = prod(x[i] - at) and d[i] = prod(x[j] - x[i]), j != i.
+ * The d[i] only depend on the keys: they take keys->count^2 multiplications,
+ * once, and every new key after that keys->count multiplications and one
+ * inversion.
+ *
+ * In field, the new x values must be less than field->p.
+ * The new keys are stored in *out, which must be freed with skey_set_free().
+ * Returns 0 on success, and -1 if two keys have the same x, if a new x is
+ * the x of one of the keys, or if, over the integers, the keys are
+ * inconsistent. */
+int shamir_issue_keys(skey_set **out,
+		const skey_set *keys,
+		const mpz_t *at,
+		size_t n_at,
+		const sfield *field)
+{
+	const size_t n = keys->count;
+	mpz_t *num = alloc_mpz_array(n);
+	mpz_t *d = alloc_mpz_array(n);
+	mpz_t *pre = alloc_mpz_array(n);
+	mpz_t *y = alloc_mpz_array(n_at);
+	mp_bitcnt_t xbits = 1, ybits = 1;
+	mpz_t tmp;
+	size_t i;
+	int ret = 0;
+
+	assert(n > 0);
+
+	*out = NULL;
+	mpz_init(tmp);
+
+	/* num is only needed by lagrange_terms(), and is used as u after it */
+	lagrange_terms(num, d, keys, NULL, field, tmp);
+
+	for (i = 0; i < n_at && ret == 0; ++i) {
+		ret = field ? issue_field(y[i], at[i], keys, d, num, pre, field)
+			: issue_integer(y[i], at[i], keys, d, num, pre);
+
+		if (mpz_sizeinbase(at[i], 2) > xbits)
+			xbits = mpz_sizeinbase(at[i], 2);
+		if (mpz_sizeinbase(y[i], 2) > ybits)
+			ybits = mpz_sizeinbase(y[i], 2);
+	}
+
+	if (ret == 0) {
+		*out = skey_set_alloc(n_at, xbits, ybits);
+		if (!*out) {
+			perror("malloc");
+			abort();
+		}
+		for (i = 0; i < n_at; ++i)
+			skey_set_store(*out, i, at[i], y[i]);
+	}
+
+	mpz_clear(tmp);
+	free_mpz_array(num, n);
+	free_mpz_array(d, n);
+	free_mpz_array(pre, n);
+	free_mpz_array(y, n_at);
+
+	return ret;
+}
+
+/* The index of the i-th key in order, or i if there is no order */
+static size_t key_index(const size_t *order, size_t i)
+{
+	return order ? order[i] : i;
+}
+
+/* Returns non-zero if every x of keys is a small non-negative integer, so
+ * that the differences between them fit in a long */
+static int small_x(const skey_set *keys)
+{
+	mpz_t view;
+	size_t i;
+
+	for (i = 0; i < keys->count; ++i) {
+		mpz_srcptr x = skey_set_x(keys, i, view);
+
+		if (mpz_sgn(x) < 0 || mpz_cmp_ui(x, LONG_MAX) > 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* lagrange_terms() for keys with small x values, such as the ones of
+ * skey_generate_seq(): every factor is a single limb, and the sign of the
+ * denominator is only fixed up once, at the end */
+static void lagrange_terms_small(mpz_t *num, mpz_t *den,
+		const skey_set *keys,
+		const size_t *order,
+		const sfield *field,
+		mpz_t tmp)
+{
+	const size_t n = keys->count;
+	size_t i, j;
+	mpz_t view;
+	long *x = malloc(n * sizeof *x);
+
+	if (!x) {
+		perror("malloc");
+		abort();
+	}
+	for (i = 0; i < n; ++i)
+		x[i] = mpz_get_si(skey_set_x(keys, key_index(order, i), view));
+
+	for (i = 0; i < n; ++i) {
+		int negative = 0;
+
+		mpz_set_ui(num[i], 1U);
+		mpz_set_ui(den[i], 1U);
+
+		for (j = 0; j < n; ++j) {
+			long diff;
+
+			if (j == i)
+				continue;
+
+			diff = x[j] - x[i];
+			if (diff < 0) {
+				negative = !negative;
+				diff = -diff;
+			}
+			mpz_mul_ui(num[i], num[i], (unsigned long) x[j]);
+			mpz_mul_ui(den[i], den[i], (unsigned long) diff);
+			if (field) {
+				sfield_reduce(field, num[i], tmp);
+				sfield_reduce(field, den[i], tmp);
+			}
+		}
+
+		if (negative) {
+			if (field && mpz_sgn(den[i]) != 0)
+				mpz_sub(den[i], field->p, den[i]);
+			else if (!field)
+				mpz_neg(den[i], den[i]);
+		}
+	}
+
+	free(x);
+}
+
+/* Calculate num[i] = prod(x[j]) and den[i] = prod(x[j] - x[i]), j != i,
+ * where x[i] is the x of the i-th key in order.
+ * This is the O(n^2) part of the interpolation; everything after it is
+ * O(n). If field is not NULL, everything is reduced modulo field->p. */
+static void lagrange_terms(mpz_t *num, mpz_t *den,
+		const skey_set *keys,
+		const size_t *order,
+		const sfield *field,
+		mpz_t tmp)
+{
+	const size_t n = keys->count;
+	size_t i, j;
+	mpz_t diff, xiv, xjv;
+
+	if (small_x(keys)) {
+		lagrange_terms_small(num, den, keys, order, field, tmp);
+		return;
+	}
+
+	mpz_init(diff);
+
+	for (i = 0; i < n; ++i) {
+		mpz_srcptr xi = skey_set_x(keys, key_index(order, i), xiv);
+
+		mpz_set_ui(num[i], 1U);
+		mpz_set_ui(den[i], 1U);
+
+		for (j = 0; j < n; ++j) {
+			mpz_srcptr xj;
+
+			if (j == i)
+				continue;
+
+			xj = skey_set_x(keys, key_index(order, j), xjv);
+			mpz_sub(diff, xj, xi);
+			mpz_mul(num[i], num[i], xj);
+			if (field) {
+				if (mpz_sgn(diff) < 0)
+					mpz_add(diff, diff, field->p);
+				sfield_reduce(field, num[i], tmp);
+			}
+			mpz_mul(den[i], den[i], diff);
+			if (field)
+				sfield_reduce(field, den[i], tmp);
+		}
+	}
+
+	mpz_clear(diff);
+}
+
+static mpz_t *alloc_mpz_array(size_t n)
+{
+	mpz_t *a = malloc(n * sizeof *a);
+	size_t i;
+
+	if (!a) {
+		perror("malloc");
+		abort();
+	}
+	for (i = 0; i < n; ++i)
+		mpz_init(a[i]);
+
+	return a;
+}
+
+static void free_mpz_array(mpz_t *a, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		mpz_clear(a[i]);
+	free(a);
+}
+
+/* The weights w[i] = num[i] / den[i] in GF(p). Instead of inverting every
+ * den[i], all of them are inverted at once with Montgomery's trick:
+ *
+ *   pre[i] = den[0] * den[1] * ... * den[i]
+ *   inv    = 1 / pre[n - 1]                      (the only inversion)
+ *
+ * and then, for i = n - 1, ..., 0:
+ *
+ *   1 / den[i] = inv * pre[i - 1]
+ *   inv        = inv * den[i]                    (= 1 / pre[i - 1]) */
+static int weights_field(mpz_t *w,
+		const skey_set *keys,
+		const size_t *order,
+		const sfield *field)
+{
+	const size_t n = keys->count;
+	mpz_t *num = alloc_mpz_array(n);
+	mpz_t *den = alloc_mpz_array(n);
+	mpz_t *pre = alloc_mpz_array(n);
+	mpz_t inv, tmp;
+	size_t i;
+	int ret = 0;
+
+	mpz_inits(inv, tmp, NULL);
+
+	lagrange_terms(num, den, keys, order, field, tmp);
+
+	mpz_set(pre[0], den[0]);
+	for (i = 1; i < n; ++i) {
+		mpz_mul(pre[i], pre[i - 1], den[i]);
+		sfield_reduce(field, pre[i], tmp);
+	}
+
+	/* A zero denominator means two keys have the same x */
+	if (!mpz_invert(inv, pre[n - 1], field->p)) {
+		ret = -1;
+		goto out;
+	}
+
+	for (i = n; i-- > 0; ) {
+		/* w[i] = 1 / den[i] */
+		if (i > 0) {
+			mpz_mul(w[i], inv, pre[i - 1]);
+			sfield_reduce(field, w[i], tmp);
+			mpz_mul(inv, inv, den[i]);
+			sfield_reduce(field, inv, tmp);
+		} else {
+			mpz_set(w[i], inv);
+		}
+
+		mpz_mul(w[i], w[i], num[i]);
+		sfield_reduce(field, w[i], tmp);
+	}
+
+out:
+	mpz_clears(inv, tmp, NULL);
+	free_mpz_array(num, n);
+	free_mpz_array(den, n);
+	free_mpz_array(pre, n);
+
+	return ret;
+}
+
+/* weights_field() in fixed width, for the fields small enough for
+ * sfield_fixed_*(). w holds keys->count elements of field->limbs limbs. */
+static int weights_fixed(mp_limb_t *w,
+		const skey_set *keys,
+		const size_t *order,
+		const sfield *field)
+{
+	const size_t n = keys->count;
+	const size_t l = (size_t) field->limbs;
+	/* x, num, den and pre, n elements each */
+	mp_limb_t *const mem = malloc(4 * n * l * sizeof *mem);
+	mp_limb_t *const x = mem, *const num = x + n * l;
+	mp_limb_t *const den = num + n * l, *const pre = den + n * l;
+	mp_limb_t inv[SFIELD_FIXED_MAX_LIMBS], term[SFIELD_FIXED_MAX_LIMBS];
+	mpz_t view, invz;
+	size_t i, j;
+	int ret = 0;
+
+	if (!mem) {
+		perror("malloc");
+		abort();
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (sfield_fixed_load(field, x + i * l,
+				skey_set_x(keys, key_index(order, i), view)) == -1) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+	/* num[i] = prod(x[j]) and den[i] = prod(x[j] - x[i]), j != i */
+	memset(num, 0, 2 * n * l * sizeof *mem);
+	for (i = 0; i < n; ++i) {
+		num[i * l] = 1U;
+		den[i * l] = 1U;
+
+		for (j = 0; j < n; ++j) {
+			if (j == i)
+				continue;
+
+			sfield_fixed_mul(field, num + i * l, num + i * l, x + j * l);
+			sfield_fixed_sub(field, term, x + j * l, x + i * l);
+			sfield_fixed_mul(field, den + i * l, den + i * l, term);
+		}
+	}
+
+	/* Montgomery's trick, as in weights_field() */
+	memcpy(pre, den, l * sizeof *pre);
+	for (i = 1; i < n; ++i)
+		sfield_fixed_mul(field, pre + i * l, pre + (i - 1) * l,
+			den + i * l);
+
+	/* The denominators only depend on the x values, which aren't secret,
+	 * so mpz_invert() will do, and it is much faster than
+	 * mpn_sec_invert(). A zero denominator means two keys have the same
+	 * x. */
+	mpz_init(invz);
+	if (!mpz_invert(invz, mpz_roinit_n(view, pre + (n - 1) * l,
+			(mp_size_t) l), field->p)) {
+		mpz_clear(invz);
+		ret = -1;
+		goto out;
+	}
+	/* mpz_invert() leaves invz in [0, p), so this can't fail */
+	sfield_fixed_load(field, inv, invz);
+	mpz_clear(invz);
+
+	for (i = n; i-- > 0; ) {
+		if (i > 0) {
+			sfield_fixed_mul(field, term, inv, pre + (i - 1) * l);
+			sfield_fixed_mul(field, inv, inv, den + i * l);
+		} else {
+			memcpy(term, inv, l * sizeof *term);
+		}
+
+		sfield_fixed_mul(field, w + i * l, term, num + i * l);
+	}
+
+out:
+	free(mem);
+
+	return ret;
+}
+
+/* The weights over the integers. The terms y[i] * num[i] / den[i] are not
+ * integers on their own, but their sum is, so everything is put over the
+ * common denominator den[0] * ... * den[n - 1], stored in d, and divided
+ * exactly once at the end. The cofactors
+ * den[0] * ... * den[i - 1] * den[i + 1] * ... are the products of prefix
+ * and suffix products, in the same spirit as Montgomery's trick. */
+static int weights_integer(mpz_t *w,
+		mpz_t d,
+		const skey_set *keys,
+		const size_t *order)
+{
+	const size_t n = keys->count;
+	mpz_t *num = alloc_mpz_array(n);
+	mpz_t *den = alloc_mpz_array(n);
+	mpz_t *pre = alloc_mpz_array(n);
+	mpz_t suf;
+	size_t i;
+	int ret = 0;
+
+	mpz_init(suf);
+
+	lagrange_terms(num, den, keys, order, NULL, NULL);
+
+	mpz_set(pre[0], den[0]);
+	for (i = 1; i < n; ++i)
+		mpz_mul(pre[i], pre[i - 1], den[i]);
+
+	if (mpz_sgn(pre[n - 1]) == 0) {
+		ret = -1;
+		goto out;
+	}
+	mpz_set(d, pre[n - 1]);
+
+	mpz_set_ui(suf, 1U);
+	for (i = n; i-- > 0; ) {
+		/* w[i] = num[i] * (den[0] * ... * den[n - 1] / den[i]) */
+		if (i > 0)
+			mpz_mul(w[i], pre[i - 1], suf);
+		else
+			mpz_set(w[i], suf);
+		mpz_mul(w[i], w[i], num[i]);
+
+		mpz_mul(suf, suf, den[i]);
+	}
+
+out:
+	mpz_clear(suf);
+	free_mpz_array(num, n);
+	free_mpz_array(den, n);
+	free_mpz_array(pre, n);
+
+	return ret;
+}
+
+/* Calculate the weights of the x values of the keys, taken in order (or as
+ * they come if order is NULL), in field if it isn't NULL.
+ * wt must be freed with weights_free(), even on failure.
+ * Returns -1 if two keys have the same x, or, in fixed width, if an x isn't
+ * an element of field. */
+static int weights_compute(shamir_weights *wt,
+		const skey_set *keys,
+		const size_t *order,
+		const sfield *field)
+{
+	const size_t n = keys->count;
+	mpz_t view;
+	size_t i;
+
+	memset(wt, 0, sizeof *wt);
+	wt->count = n;
+	wt->e = field ? field->e : 0;
+	mpz_init(wt->den);
+
+	/* The x values are only needed to find the weights again */
+	if (order) {
+		wt->x = alloc_mpz_array(n);
+		for (i = 0; i < n; ++i)
+			mpz_set(wt->x[i], skey_set_x(keys, order[i], view));
+	}
+
+	if (field && field->limbs) {
+		wt->fixed = malloc(n * (size_t) field->limbs * sizeof *wt->fixed);
+		if (!wt->fixed) {
+			perror("malloc");
+			abort();
+		}
+		return weights_fixed(wt->fixed, keys, order, field);
+	}
+
+	wt->w = alloc_mpz_array(n);
+	if (field)
+		return weights_field(wt->w, keys, order, field);
+	return weights_integer(wt->w, wt->den, keys, order);
+}
+
+/* secret = the sum of the weights times the y values of the keys, in the
+ * order of weights_compute(). In fixed width, every step that touches a y
+ * takes the same time whatever the keys.
+ * Returns -1 if, over the integers, the sum can't be divided: the keys don't
+ * come from one polynomial with integer coefficients; or, in fixed width, if
+ * a y isn't an element of field. */
+static int weights_apply(mpz_t secret,
+		const shamir_weights *wt,
+		const skey_set *keys,
+		const size_t *order,
+		const sfield *field)
+{
+	const size_t n = keys->count;
+	mpz_t yv, tmp;
+	size_t i;
+
+	if (wt->fixed) {
+		const size_t l = (size_t) field->limbs;
+		mp_limb_t y[SFIELD_FIXED_MAX_LIMBS], sum[SFIELD_FIXED_MAX_LIMBS];
+
+		int ret = 0;
+
+		memset(sum, 0, sizeof sum);
+		for (i = 0; i < n && ret == 0; ++i) {
+			ret = skey_set_y_fixed(keys, key_index(order, i), field, y);
+			sfield_fixed_mul(field, y, y, wt->fixed + i * l);
+			sfield_fixed_add(field, sum, sum, y);
+		}
+		if (ret == 0)
+			sfield_fixed_store(field, secret, sum);
+
+		memset(y, 0, sizeof y);
+		memset(sum, 0, sizeof sum);
+		return ret;
+	}
+
+	mpz_set_ui(secret, 0U);
+	for (i = 0; i < n; ++i)
+		mpz_addmul(secret, wt->w[i],
+			skey_set_y(keys, key_index(order, i), yv));
+
+	if (field) {
+		mpz_init(tmp);
+		sfield_reduce(field, secret, tmp);
+		mpz_clear(tmp);
+	} else {
+		/* A wrong key makes the sum a fraction */
+		if (!mpz_divisible_p(secret, wt->den))
+			return -1;
+		mpz_divexact(secret, secret, wt->den);
+	}
+
+	return 0;
+}
+
+static void weights_free(shamir_weights *wt)
+{
+	if (wt->x)
+		free_mpz_array(wt->x, wt->count);
+	if (wt->w)
+		free_mpz_array(wt->w, wt->count);
+	free(wt->fixed);
+	mpz_clear(wt->den);
+	memset(wt, 0, sizeof *wt);
+}
+
+/* Return *secret as a "0x"-prefixed hexadecimal string, "-0x..." if it is
+ * negative, to be freed by the caller, or NULL if there isn't enough
+ * memory. *secret is cleared either way. */
+static char *get_str_secret(mpz_t *secret)
+{
+	/* mpz_sizeinbase() is exact in base 16, so one allocation is enough
+	 * for the sign, the "0x" prefix, the digits and the terminator */
+	const size_t size = mpz_sizeinbase(*secret, 16) + 4;
+	char *str = malloc(size);
+	char *p = str;
 
-	gmp_snprintf(str, size, format, *secret);
+	if (str) {
+		if (mpz_sgn(*secret) < 0) {
+			*p++ = '-';
+			mpz_neg(*secret, *secret);
+		}
+		*p++ = '0';
+		*p++ = 'x';
+		mpz_get_str(p, 16, *secret);
+	}
 
 	/* Free the variable pointed to by secret */
 	mpz_clear(*secret);
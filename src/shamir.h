@@ -2,9 +2,64 @@
 #define B8C064CC_FBFA_4FD0_8F8C_7FE84CA2B1D7
 
 #include "shamir_key.h"
+#include "shamir_field.h"
 
+#include <gmp.h>
+#include <stddef.h> /* size_t */
 
-char *shamir2_calculate_secret_str(shamir_key **const keys);
-char *shamir2_calculate_secret_str2(shamir_key **const keys);
+
+/* The Lagrange weights at x = 0 of a set of x values: the secret is the dot
+ * product of the weights and the y values of the keys. They only depend on
+ * the x values, so all the secrets shared to the same keys can be combined
+ * with the same weights. */
+struct shamir_weights {
+	size_t count;        /* The number of x values, or 0 if unused */
+	mp_bitcnt_t e;       /* The exponent of the field, or 0 over the integers */
+	mpz_t *x;            /* The x values, in increasing order */
+	mpz_t *w;            /* w[i] is the weight of x[i] */
+	mp_limb_t *fixed;    /* Or, in the fields of sfield_fixed_*(), the weights
+	                        in their format, and w is NULL */
+	mpz_t den;           /* Over the integers, what the dot product must be
+	                        divided by */
+	unsigned long used;  /* When the weights were last used */
+};
+typedef struct shamir_weights shamir_weights;
+
+/* The number of sets of x values whose weights are kept */
+#define SHAMIR_WEIGHTS_CACHE_SIZE 8U
+
+/* The weights of the last sets of x values combined, for
+ * shamir_calculate_secret_cached() */
+struct shamir_weights_cache {
+	shamir_weights entry[SHAMIR_WEIGHTS_CACHE_SIZE];
+	size_t *order;       /* The keys of the last call, in increasing order
+	                        of x */
+	size_t order_count;
+	size_t order_cap;
+	unsigned long clock; /* Incremented on every use of an entry */
+};
+typedef struct shamir_weights_cache shamir_weights_cache;
+
+char *shamir2_calculate_secret_str(const skey_set *keys);
+char *shamir2_calculate_secret_str2(const skey_set *keys);
+
+int shamir_calculate_secret(mpz_t secret,
+		const skey_set *keys,
+		const sfield *field);
+char *shamir_calculate_secret_str(const skey_set *keys,
+		const sfield *field);
+
+void shamir_weights_cache_init(shamir_weights_cache *cache);
+void shamir_weights_cache_clear(shamir_weights_cache *cache);
+int shamir_calculate_secret_cached(mpz_t secret,
+		const skey_set *keys,
+		const sfield *field,
+		shamir_weights_cache *cache);
+
+int shamir_issue_keys(skey_set **out,
+		const skey_set *keys,
+		const mpz_t *at,
+		size_t n_at,
+		const sfield *field);
 
 #endif /* B8C064CC_FBFA_4FD0_8F8C_7FE84CA2B1D7 */
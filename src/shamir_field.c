@@ -0,0 +1,259 @@
+/* My includes */
+#include "shamir_field.h"
+
+/* Standard C includes */
+#include <assert.h> /* for assert() */
+#include <stddef.h> /* for size_t */
+#include <string.h> /* for memcpy(), memset() */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+/* Exponents e for which 2^e - 1 is prime, in increasing order.
+ * The smallest one that can hold the secret is picked. */
+static const unsigned long mersenne_exponents[] = {
+	127UL, 521UL, 607UL, 1279UL, 2203UL, 2281UL, 3217UL, 4253UL, 4423UL,
+	9689UL, 9941UL, 11213UL, 19937UL, 21701UL, 23209UL, 44497UL, 86243UL,
+	110503UL, 132049UL, 216091UL, 756839UL, 859433UL, 1257787UL,
+	1398269UL, 2976221UL, 3021377UL, 6972593UL, 13466917UL, 20996011UL,
+	24036583UL, 25964951UL, 30402457UL, 32582657UL, 37156667UL,
+	42643801UL, 43112609UL, 57885161UL
+};
+#define N_MERSENNE_EXPONENTS \
+	(sizeof mersenne_exponents / sizeof *mersenne_exponents)
+
+
+/* The exponent e of the smallest Mersenne prime field GF(2^e - 1) in which
+ * every secret of secret_bits bits is an element, or 0 if the secret is too
+ * large for any of the fields we know about */
+mp_bitcnt_t sfield_exp_for(mp_bitcnt_t secret_bits)
+{
+	size_t i;
+
+	for (i = 0; i < N_MERSENNE_EXPONENTS; ++i)
+		if (secret_bits < mersenne_exponents[i])
+			return mersenne_exponents[i];
+
+	return 0;
+}
+
+/* Initialize field to the smallest Mersenne prime field in which every
+ * secret of secret_bits bits is an element.
+ * Returns 0 on success, and -1 if the secret is too large for any of the
+ * fields we know about. */
+int sfield_init(sfield *field, mp_bitcnt_t secret_bits)
+{
+	const mp_bitcnt_t e = sfield_exp_for(secret_bits);
+
+	if (e == 0)
+		return -1;
+
+	return sfield_init_exp(field, e);
+}
+
+/* Initialize field to GF(2^e - 1).
+ * Returns -1 if 2^e - 1 is not one of the Mersenne primes in our table. */
+int sfield_init_exp(sfield *field, mp_bitcnt_t e)
+{
+	size_t i;
+
+	for (i = 0; i < N_MERSENNE_EXPONENTS; ++i)
+		if (mersenne_exponents[i] == e)
+			break;
+	if (i == N_MERSENNE_EXPONENTS)
+		return -1;
+
+	field->e = e;
+	/* The top limb must have room for the carry of an addition */
+	field->limbs = e <= SFIELD_FIXED_MAX_E && e % GMP_NUMB_BITS != 0
+		? (mp_size_t) ((e + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS)
+		: 0;
+	mpz_init(field->p);
+	mpz_setbit(field->p, e);
+	mpz_sub_ui(field->p, field->p, 1U);
+
+	return 0;
+}
+
+void sfield_clear(sfield *field)
+{
+	mpz_clear(field->p);
+}
+
+/* Get GF(2^e - 1) from cache, initializing it only if the field it holds
+ * is a different one. cache->initialized must be 0 the first time.
+ * Returns NULL if 2^e - 1 is not one of the Mersenne primes in our table. */
+const sfield *sfield_cache_get(sfield_cache *cache, mp_bitcnt_t e)
+{
+	if (cache->initialized && cache->field.e == e)
+		return &cache->field;
+
+	if (cache->initialized) {
+		sfield_clear(&cache->field);
+		cache->initialized = 0;
+	}
+	if (sfield_init_exp(&cache->field, e) == -1)
+		return NULL;
+	cache->initialized = 1;
+
+	return &cache->field;
+}
+
+void sfield_cache_clear(sfield_cache *cache)
+{
+	if (cache->initialized)
+		sfield_clear(&cache->field);
+	cache->initialized = 0;
+}
+
+/* Reduce the non-negative number r modulo field->p.
+ * Since 2^e = 1 (mod p), the high bits of r can simply be folded onto the
+ * low bits: r = (r mod 2^e) + (r div 2^e) (mod p).
+ * tmp is used as scratch space. */
+void sfield_reduce(const sfield *field, mpz_t r, mpz_t tmp)
+{
+	assert(mpz_sgn(r) >= 0);
+
+	while (mpz_sizeinbase(r, 2) > field->e) {
+		mpz_tdiv_q_2exp(tmp, r, field->e);
+		mpz_tdiv_r_2exp(r, r, field->e);
+		mpz_add(r, r, tmp);
+	}
+
+	if (mpz_cmp(r, field->p) >= 0)
+		mpz_sub(r, r, field->p);
+}
+
+
+/* The sfield_fixed_*() functions work on elements of fields with
+ * field->limbs != 0, stored in exactly field->limbs limbs and always fully
+ * reduced, in [0, p). They use GMP's mpn_sec_*() and mpn_cnd_*() functions,
+ * which take the same time and touch the same memory whatever the values,
+ * and they never allocate: everything lives on the stack. That makes them
+ * much faster than mpz_*() for small fields, where the bookkeeping of
+ * mpz_*() costs more than the arithmetic. */
+
+/* Scratch space for mpn_sec_mul() */
+#define FIXED_SCRATCH_LIMBS (4 * SFIELD_FIXED_MAX_LIMBS)
+
+static const mp_limb_t *fixed_p(const sfield *field)
+{
+	assert(field->limbs > 0);
+	assert(mpz_size(field->p) == (size_t) field->limbs);
+	return mpz_limbs_read(field->p);
+}
+
+/* r = r - p if r >= p, for r < 2p */
+static void reduce_once(const sfield *field, mp_limb_t *r)
+{
+	const mp_size_t n = field->limbs;
+	mp_limb_t d[SFIELD_FIXED_MAX_LIMBS];
+	const mp_limb_t borrow = mpn_sub_n(d, r, fixed_p(field), n);
+
+	mpn_cnd_swap(borrow ^ 1U, r, d, n);
+}
+
+/* r = a (mod p), for a of 2 * field->limbs limbs, less than p^2.
+ * a is overwritten. Since 2^e = 1 (mod p), the bits of a above e are simply
+ * added to the ones below. */
+static void fold(const sfield *field, mp_limb_t *r, mp_limb_t *a)
+{
+	const mp_size_t n = field->limbs;
+	const mp_size_t q = (mp_size_t) (field->e / GMP_NUMB_BITS);
+	const unsigned s = (unsigned) (field->e % GMP_NUMB_BITS);
+	mp_limb_t hi[2 * SFIELD_FIXED_MAX_LIMBS];
+
+	/* hi = a div 2^e < p, and the low n limbs of a become a mod 2^e <= p.
+	 * q = n - 1, since e isn't a multiple of the limb size. */
+	mpn_rshift(hi, a + q, 2 * n - q, s);
+	a[q] &= ((mp_limb_t) 1 << s) - 1U;
+
+	/* Less than 2p, which fits in n limbs */
+	mpn_add_n(r, a, hi, n);
+	reduce_once(field, r);
+}
+
+/* Load a into r. The time depends on the size of a, so this is for the x
+ * values and the other numbers that aren't secret: the y values are loaded
+ * from their slots with sfield_fixed_load_n().
+ * Returns -1, leaving r alone, if a isn't an element of field. */
+int sfield_fixed_load(const sfield *field, mp_limb_t *r, mpz_srcptr a)
+{
+	size_t size;
+
+	if (mpz_sgn(a) < 0 || mpz_cmp(a, field->p) >= 0)
+		return -1;
+
+	size = mpz_size(a);
+	memcpy(r, mpz_limbs_read(a), size * sizeof *r);
+	memset(r + size, 0, ((size_t) field->limbs - size) * sizeof *r);
+
+	return 0;
+}
+
+/* Load the number in the n limbs at a, zero-padded, into r. Every limb is
+ * read whatever the number, so the time only depends on n.
+ * Returns -1, with r zeroed, if the number isn't an element of field. */
+int sfield_fixed_load_n(const sfield *field, mp_limb_t *r,
+		const mp_limb_t *a, mp_size_t n)
+{
+	const mp_size_t l = field->limbs;
+	mp_limb_t d[SFIELD_FIXED_MAX_LIMBS], high = 0, borrow;
+	mp_size_t i;
+
+	for (i = 0; i < l; ++i)
+		r[i] = i < n ? a[i] : 0U;
+	for (i = l; i < n; ++i)
+		high |= a[i];
+
+	/* r < p if and only if r - p borrows */
+	borrow = mpn_sub_n(d, r, fixed_p(field), l);
+	memset(d, 0, sizeof d);
+
+	if (high != 0 || borrow == 0) {
+		memset(r, 0, (size_t) l * sizeof *r);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Store a in the mpz r */
+void sfield_fixed_store(const sfield *field, mpz_t r, const mp_limb_t *a)
+{
+	memcpy(mpz_limbs_write(r, field->limbs), a,
+		(size_t) field->limbs * sizeof *a);
+	mpz_limbs_finish(r, field->limbs);
+}
+
+/* r = a + b (mod p). r may be a or b. */
+void sfield_fixed_add(const sfield *field, mp_limb_t *r,
+		const mp_limb_t *a, const mp_limb_t *b)
+{
+	mpn_add_n(r, a, b, field->limbs);
+	reduce_once(field, r);
+}
+
+/* r = a - b (mod p). r may be a or b. */
+void sfield_fixed_sub(const sfield *field, mp_limb_t *r,
+		const mp_limb_t *a, const mp_limb_t *b)
+{
+	const mp_limb_t borrow = mpn_sub_n(r, a, b, field->limbs);
+
+	mpn_cnd_add_n(borrow, r, r, fixed_p(field), field->limbs);
+}
+
+/* r = a * b (mod p). r may be a or b. */
+void sfield_fixed_mul(const sfield *field, mp_limb_t *r,
+		const mp_limb_t *a, const mp_limb_t *b)
+{
+	const mp_size_t n = field->limbs;
+	mp_limb_t t[2 * SFIELD_FIXED_MAX_LIMBS];
+	mp_limb_t scratch[FIXED_SCRATCH_LIMBS];
+
+	assert(mpn_sec_mul_itch(n, n) <= FIXED_SCRATCH_LIMBS);
+
+	mpn_sec_mul(t, a, n, b, n, scratch);
+	fold(field, r, t);
+}
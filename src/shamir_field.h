@@ -0,0 +1,52 @@
+#ifndef C7CD7C9B_06E7_4289_844E_A135CC25B219
+#define C7CD7C9B_06E7_4289_844E_A135CC25B219
+
+#include <gmp.h>
+
+
+/* A prime field GF(p), where p = 2^e - 1 is a Mersenne prime.
+ * Using a Mersenne prime lets us reduce with shifts and additions instead
+ * of a full division. */
+struct sfield {
+	mpz_t p;         /* The modulus, 2^e - 1 */
+	mp_bitcnt_t e;   /* The Mersenne exponent */
+	mp_size_t limbs; /* The limbs of an element for sfield_fixed_*(),
+	                    or 0 if the field is too large for them */
+};
+typedef struct sfield sfield;
+
+/* The largest exponent the fixed-width functions handle. Secrets of up
+ * to 65 bytes, which covers keys and passwords, land in one of these
+ * fields. */
+#define SFIELD_FIXED_MAX_E 521U
+#define SFIELD_FIXED_MAX_LIMBS \
+	((SFIELD_FIXED_MAX_E + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS)
+
+/* A field that is kept from one secret to the next, and only reinitialized
+ * when a secret needs a different one */
+struct sfield_cache {
+	sfield field;
+	int initialized;
+};
+typedef struct sfield_cache sfield_cache;
+
+mp_bitcnt_t sfield_exp_for(mp_bitcnt_t secret_bits);
+int sfield_init(sfield *field, mp_bitcnt_t secret_bits);
+int sfield_init_exp(sfield *field, mp_bitcnt_t e);
+void sfield_clear(sfield *field);
+const sfield *sfield_cache_get(sfield_cache *cache, mp_bitcnt_t e);
+void sfield_cache_clear(sfield_cache *cache);
+void sfield_reduce(const sfield *field, mpz_t r, mpz_t tmp);
+
+int sfield_fixed_load(const sfield *field, mp_limb_t *r, mpz_srcptr a);
+int sfield_fixed_load_n(const sfield *field, mp_limb_t *r,
+		const mp_limb_t *a, mp_size_t n);
+void sfield_fixed_store(const sfield *field, mpz_t r, const mp_limb_t *a);
+void sfield_fixed_add(const sfield *field, mp_limb_t *r,
+		const mp_limb_t *a, const mp_limb_t *b);
+void sfield_fixed_sub(const sfield *field, mp_limb_t *r,
+		const mp_limb_t *a, const mp_limb_t *b);
+void sfield_fixed_mul(const sfield *field, mp_limb_t *r,
+		const mp_limb_t *a, const mp_limb_t *b);
+
+#endif /* !C7CD7C9B_06E7_4289_844E_A135CC25B219 */
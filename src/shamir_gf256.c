@@ -0,0 +1,566 @@
+/* My includes */
+#include "shamir_gf256.h"
+#include "csprng.h"
+#include "stats.h"
+
+/* Standard C includes */
+#include <assert.h> /* for assert() */
+#include <stdlib.h> /* for malloc(), free() */
+#include <stdio.h>  /* for perror() */
+#include <string.h> /* for memcpy() */
+#include <pthread.h> /* for pthread_once() */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GF256_X86 1
+#include <immintrin.h>
+#endif
+
+
+/* GF(2^8) is represented the same way as in AES: polynomials over GF(2)
+ * modulo x^8 + x^4 + x^3 + x + 1. 0x03 generates the multiplicative group. */
+#define GF256_POLY 0x11bU
+#define GF256_GENERATOR 0x03U
+
+static unsigned char exp_table[510];
+static unsigned char log_table[256];
+
+/* mul_lo[c][i] = c * i and mul_hi[c][i] = c * (i << 4), for 0 <= i < 16.
+ * Since multiplication distributes over xor, c * b is
+ * mul_lo[c][b & 0x0f] ^ mul_hi[c][b >> 4], which is exactly two 16-byte
+ * table lookups: one PSHUFB each. */
+static unsigned char mul_lo[256][16];
+static unsigned char mul_hi[256][16];
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+typedef void (*kernel_func)(unsigned char *dst,
+		const unsigned char *src,
+		unsigned char c,
+		size_t len);
+
+static void muladd_generic(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len);
+static void mulxor_generic(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len);
+
+/* The kernels used for the bulk operations. They are replaced by the
+ * fastest ones the CPU supports in tables_init(). */
+static kernel_func muladd_kernel = muladd_generic;
+static kernel_func mulxor_kernel = mulxor_generic;
+
+
+static unsigned char mul_slow(unsigned char a, unsigned char b)
+{
+	unsigned p = 0U, aa = a;
+
+	while (b) {
+		if (b & 1U)
+			p ^= aa;
+		aa <<= 1;
+		if (aa & 0x100U)
+			aa ^= GF256_POLY;
+		b >>= 1;
+	}
+
+	return (unsigned char) p;
+}
+
+#ifdef GF256_X86
+
+/* dst[i] ^= c * src[i], 16 bytes at a time */
+__attribute__((target("ssse3")))
+static void muladd_ssse3(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len)
+{
+	const __m128i lo = _mm_loadu_si128((const __m128i *) mul_lo[c]);
+	const __m128i hi = _mm_loadu_si128((const __m128i *) mul_hi[c]);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		const __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+		const __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+		const __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(s, mask));
+		const __m128i h = _mm_shuffle_epi8(hi,
+			_mm_and_si128(_mm_srli_epi64(s, 4), mask));
+		_mm_storeu_si128((__m128i *) (dst + i),
+			_mm_xor_si128(d, _mm_xor_si128(l, h)));
+	}
+
+	muladd_generic(dst + i, src + i, c, len - i);
+}
+
+/* dst[i] = c * dst[i] ^ src[i], 16 bytes at a time */
+__attribute__((target("ssse3")))
+static void mulxor_ssse3(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len)
+{
+	const __m128i lo = _mm_loadu_si128((const __m128i *) mul_lo[c]);
+	const __m128i hi = _mm_loadu_si128((const __m128i *) mul_hi[c]);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		const __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+		const __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+		const __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(d, mask));
+		const __m128i h = _mm_shuffle_epi8(hi,
+			_mm_and_si128(_mm_srli_epi64(d, 4), mask));
+		_mm_storeu_si128((__m128i *) (dst + i),
+			_mm_xor_si128(s, _mm_xor_si128(l, h)));
+	}
+
+	mulxor_generic(dst + i, src + i, c, len - i);
+}
+
+/* Same as muladd_ssse3(), 32 bytes at a time.
+ * VPSHUFB shuffles within each 128-bit lane, so both lanes get a copy of
+ * the tables. */
+__attribute__((target("avx2")))
+static void muladd_avx2(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len)
+{
+	const __m256i lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *) mul_lo[c]));
+	const __m256i hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *) mul_hi[c]));
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		const __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+		const __m256i d = _mm256_loadu_si256((const __m256i *) (dst + i));
+		const __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask));
+		const __m256i h = _mm256_shuffle_epi8(hi,
+			_mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+		_mm256_storeu_si256((__m256i *) (dst + i),
+			_mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+	}
+
+	muladd_generic(dst + i, src + i, c, len - i);
+}
+
+/* Same as mulxor_ssse3(), 32 bytes at a time */
+__attribute__((target("avx2")))
+static void mulxor_avx2(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len)
+{
+	const __m256i lo = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *) mul_lo[c]));
+	const __m256i hi = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const __m128i *) mul_hi[c]));
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		const __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+		const __m256i d = _mm256_loadu_si256((const __m256i *) (dst + i));
+		const __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(d, mask));
+		const __m256i h = _mm256_shuffle_epi8(hi,
+			_mm256_and_si256(_mm256_srli_epi64(d, 4), mask));
+		_mm256_storeu_si256((__m256i *) (dst + i),
+			_mm256_xor_si256(s, _mm256_xor_si256(l, h)));
+	}
+
+	mulxor_generic(dst + i, src + i, c, len - i);
+}
+
+#endif /* GF256_X86 */
+
+/* Build the log/exp and nibble tables, and pick the kernels */
+static void build_tables(void)
+{
+	unsigned i, c, v = 1U;
+
+	for (i = 0; i < 255U; ++i) {
+		exp_table[i] = exp_table[i + 255U] = (unsigned char) v;
+		log_table[v] = (unsigned char) i;
+		v = mul_slow((unsigned char) v, GF256_GENERATOR);
+	}
+
+	for (c = 0; c < 256U; ++c) {
+		for (i = 0; i < 16U; ++i) {
+			mul_lo[c][i] = mul_slow((unsigned char) c, (unsigned char) i);
+			mul_hi[c][i] = mul_slow((unsigned char) c, (unsigned char) (i << 4));
+		}
+	}
+
+#ifdef GF256_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		muladd_kernel = muladd_avx2;
+		mulxor_kernel = mulxor_avx2;
+	} else if (__builtin_cpu_supports("ssse3")) {
+		muladd_kernel = muladd_ssse3;
+		mulxor_kernel = mulxor_ssse3;
+	}
+#endif
+}
+
+/* Build the tables the first time they are needed, once even if many
+ * threads get here at the same time */
+static void tables_init(void)
+{
+	pthread_once(&tables_once, build_tables);
+}
+
+static void muladd_generic(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len)
+{
+	const unsigned char *const lo = mul_lo[c];
+	const unsigned char *const hi = mul_hi[c];
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		dst[i] ^= lo[src[i] & 0x0f] ^ hi[src[i] >> 4];
+}
+
+static void mulxor_generic(unsigned char *dst, const unsigned char *src,
+		unsigned char c, size_t len)
+{
+	const unsigned char *const lo = mul_lo[c];
+	const unsigned char *const hi = mul_hi[c];
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		dst[i] = lo[dst[i] & 0x0f] ^ hi[dst[i] >> 4] ^ src[i];
+}
+
+unsigned char gf256_mul(unsigned char a, unsigned char b)
+{
+	tables_init();
+	if (a == 0 || b == 0)
+		return 0;
+	return exp_table[log_table[a] + log_table[b]];
+}
+
+/* The multiplicative inverse of a, which must not be 0 */
+unsigned char gf256_inv(unsigned char a)
+{
+	assert(a != 0);
+	tables_init();
+	return exp_table[255U - log_table[a]];
+}
+
+/* dst[i] ^= c * src[i] for 0 <= i < len */
+void gf256_muladd(unsigned char *dst,
+		const unsigned char *src,
+		unsigned char c,
+		size_t len)
+{
+	tables_init();
+	muladd_kernel(dst, src, c, len);
+}
+
+/* dst[i] = c * dst[i] ^ src[i] for 0 <= i < len.
+ * This is one step of Horner's scheme. */
+void gf256_mulxor(unsigned char *dst,
+		unsigned char c,
+		const unsigned char *src,
+		size_t len)
+{
+	tables_init();
+	mulxor_kernel(dst, src, c, len);
+}
+
+/* Fill x with num_keys distinct non-zero random bytes, by shuffling
+ * 1, ..., 255 and keeping the first num_keys of them. */
+void gf256_random_x(unsigned char *x, csprng *rng, unsigned num_keys)
+{
+	unsigned char perm[GF256_MAX_KEYS];
+	unsigned char rnd[256];
+	size_t used = sizeof rnd;
+	unsigned i;
+
+	for (i = 0; i < GF256_MAX_KEYS; ++i)
+		perm[i] = (unsigned char) (i + 1U);
+
+	/* Fisher-Yates, drawing bytes until one is free of modulo bias */
+	for (i = GF256_MAX_KEYS - 1U; i > 0; --i) {
+		const unsigned bound = 256U - 256U % (i + 1U);
+		unsigned r;
+		unsigned char t;
+
+		do {
+			if (used == sizeof rnd) {
+				csprng_bytes(rng, rnd, sizeof rnd);
+				used = 0;
+			}
+			r = rnd[used++];
+		} while (r >= bound);
+		r %= i + 1U;
+
+		t = perm[i];
+		perm[i] = perm[r];
+		perm[r] = t;
+	}
+
+	memcpy(x, perm, num_keys);
+}
+
+/* Generate num_keys keys for the len bytes of secret, at least keys_req of
+ * which are needed to recover it. Every byte is shared independently, with
+ * its own random polynomial of degree keys_req - 1 over GF(2^8), whose
+ * coefficients are drawn from rng.
+ * Each key is passed to emit as soon as it has been calculated, so only
+ * keys_req + 1 buffers of len bytes are held at any time.
+ * Returns 0 on success. */
+int gf256_generate(csprng *rng,
+		const unsigned char *secret,
+		size_t len,
+		unsigned keys_req,
+		unsigned num_keys,
+		gf256_emit_func emit,
+		void *data)
+{
+	unsigned char x[GF256_MAX_KEYS];
+
+	if (num_keys > GF256_MAX_KEYS) {
+		fprintf(stderr, "gf256_generate: at most %u keys can be generated.\n",
+			GF256_MAX_KEYS);
+		return EXIT_FAILURE;
+	}
+
+	gf256_random_x(x, rng, num_keys);
+
+	return gf256_generate_x(rng, secret, len, keys_req, x, num_keys, emit,
+		data);
+}
+
+/* Same as gf256_generate(), but the i-th key is generated at x = i + 1 */
+int gf256_generate_seq(csprng *rng,
+		const unsigned char *secret,
+		size_t len,
+		unsigned keys_req,
+		unsigned num_keys,
+		gf256_emit_func emit,
+		void *data)
+{
+	unsigned char x[GF256_MAX_KEYS];
+	unsigned k;
+
+	if (num_keys > GF256_MAX_KEYS) {
+		fprintf(stderr, "gf256_generate: at most %u keys can be generated.\n",
+			GF256_MAX_KEYS);
+		return EXIT_FAILURE;
+	}
+
+	for (k = 0; k < num_keys; ++k)
+		x[k] = (unsigned char) (k + 1U);
+
+	return gf256_generate_x(rng, secret, len, keys_req, x, num_keys, emit,
+		data);
+}
+
+/* Same as gf256_generate(), but the keys are generated at the given x values,
+ * which must be distinct and non-zero */
+int gf256_generate_x(csprng *rng,
+		const unsigned char *secret,
+		size_t len,
+		unsigned keys_req,
+		const unsigned char *x,
+		unsigned num_keys,
+		gf256_emit_func emit,
+		void *data)
+{
+	const size_t ncoeffs = keys_req - 1U;
+	unsigned char *coeffs, *y;
+	unsigned k;
+	size_t c;
+	uint64_t t;
+	int ret = 0;
+
+	assert(keys_req >= 2U);
+	assert(keys_req <= num_keys);
+	assert(num_keys <= GF256_MAX_KEYS);
+
+	tables_init();
+
+	/* One allocation for the coefficients (ncoeffs rows of len bytes,
+	 * the row of coefficients of x^(c + 1) first), and one more row for y */
+	coeffs = malloc((ncoeffs + 1U) * len + 1U);
+	if (!coeffs) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	y = coeffs + ncoeffs * len;
+
+	t = stats_start();
+	csprng_bytes(rng, coeffs, ncoeffs * len);
+	stats_stop(STATS_COEFFS, t);
+
+	for (k = 0; k < num_keys && ret == 0; ++k) {
+		/* y = (((c[n-1] * x + c[n-2]) * x + ...) * x + c[0]) * x + secret */
+		t = stats_start();
+		memcpy(y, coeffs + (ncoeffs - 1U) * len, len);
+		for (c = ncoeffs - 1U; c > 0; --c)
+			mulxor_kernel(y, coeffs + (c - 1U) * len, x[k], len);
+		mulxor_kernel(y, secret, x[k], len);
+		stats_stop(STATS_EVAL, t);
+
+		ret = emit(k, x[k], y, len, data);
+	}
+
+	memset(coeffs, 0, (ncoeffs + 1U) * len);
+	free(coeffs);
+
+	return ret;
+}
+
+/* Print a key as "x:y", both in hexadecimal.
+ * Returns 0 on success. */
+int gf256_fprint_key(FILE *out, unsigned char x,
+		const unsigned char *y,
+		size_t len)
+{
+	static const char *hex_chars = "0123456789abcdef";
+	char buf[BUFSIZ];
+	size_t i, used = 0;
+
+	fprintf(out, "%02x:", (unsigned) x);
+
+	for (i = 0; i < len; ++i) {
+		if (used + 2 > sizeof buf) {
+			fwrite(buf, 1, used, out);
+			used = 0;
+		}
+		buf[used++] = hex_chars[(y[i] & 0xf0) >> 4];
+		buf[used++] = hex_chars[y[i] & 0x0f];
+	}
+	fwrite(buf, 1, used, out);
+	fputc('\n', out);
+
+	return ferror(out) ? EXIT_FAILURE : 0;
+}
+
+/* Format the key printed by gf256_fprint_key() into buf, which must hold
+ * GF256_KEY_STR_SIZE(len) bytes. It isn't null-terminated.
+ * Returns the length of the key. */
+size_t gf256_format_key(char *buf, unsigned char x,
+		const unsigned char *y,
+		size_t len)
+{
+	static const char *hex_chars = "0123456789abcdef";
+	char *p = buf;
+	size_t i;
+
+	*p++ = hex_chars[(x & 0xf0) >> 4];
+	*p++ = hex_chars[x & 0x0f];
+	*p++ = ':';
+	for (i = 0; i < len; ++i) {
+		*p++ = hex_chars[(y[i] & 0xf0) >> 4];
+		*p++ = hex_chars[y[i] & 0x0f];
+	}
+	*p++ = '\n';
+
+	return (size_t) (p - buf);
+}
+
+/* Recover the len-byte secret from n_keys keys (x[i], y[i]) by Lagrange
+ * interpolation at 0:
+ *
+ *                 n_keys-1            ____      x[j]
+ *                  ____               |  |  -------------
+ * secret  =        \        y[i]  *   |  |  x[i] ^ x[j]
+ *                  /___             j != i
+ *                  i = 0
+ *
+ * (Subtraction is xor in GF(2^8).)
+ * Returns -1 if two keys have the same x, 0 otherwise. */
+int gf256_combine(unsigned char *secret,
+		const unsigned char *x,
+		const unsigned char *const *y,
+		size_t len,
+		unsigned n_keys)
+{
+	const uint64_t t = stats_start();
+	const int ret = gf256_interpolate(secret, 0U, x, y, len, n_keys);
+
+	stats_stop(STATS_COMBINE, t);
+	return ret;
+}
+
+/* Same as gf256_combine(), but interpolate at x = at instead of 0, for the
+ * y of a new key at that x: the product is of (at ^ x[j]) / (x[i] ^ x[j]).
+ * The weights only take n_keys^2 multiplications of single bytes, and the
+ * len bytes of y n_keys multiplications each.
+ * Returns -1 if two keys have the same x, 0 otherwise. */
+int gf256_interpolate(unsigned char *out,
+		unsigned char at,
+		const unsigned char *x,
+		const unsigned char *const *y,
+		size_t len,
+		unsigned n_keys)
+{
+	unsigned i, j;
+
+	tables_init();
+
+	memset(out, 0, len);
+
+	for (i = 0; i < n_keys; ++i) {
+		unsigned char num = 1U, den = 1U;
+
+		for (j = 0; j < n_keys; ++j) {
+			if (j == i)
+				continue;
+			if (x[i] == x[j])
+				return -1;
+			num = gf256_mul(num, (unsigned char) (at ^ x[j]));
+			den = gf256_mul(den, (unsigned char) (x[i] ^ x[j]));
+		}
+
+		muladd_kernel(out, y[i], gf256_mul(num, gf256_inv(den)), len);
+	}
+
+	return 0;
+}
+
+static int hex_value(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* The number of bytes in the y of a key printed by gf256_fprint_key() */
+size_t gf256_key_len(const char *str)
+{
+	const size_t len = strlen(str);
+	return len < 3 ? 0 : (len - 3) / 2;
+}
+
+/* Parse a key printed by gf256_fprint_key(). y must have room for len bytes,
+ * where len is what gf256_key_len() returns for str.
+ * Returns -1 if str is not a valid key. */
+int gf256_parse_key(const char *str,
+		unsigned char *x,
+		unsigned char *y,
+		size_t len)
+{
+	size_t i;
+	int hi, lo;
+
+	if (strlen(str) != 2 * len + 3 || str[2] != ':')
+		return -1;
+
+	hi = hex_value(str[0]);
+	lo = hex_value(str[1]);
+	if (hi == -1 || lo == -1 || (hi | lo) == 0)
+		return -1;
+	*x = (unsigned char) (hi << 4 | lo);
+
+	for (i = 0, str += 3; i < len; ++i, str += 2) {
+		hi = hex_value(str[0]);
+		lo = hex_value(str[1]);
+		if (hi == -1 || lo == -1)
+			return -1;
+		y[i] = (unsigned char) (hi << 4 | lo);
+	}
+
+	return 0;
+}
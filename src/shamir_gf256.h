@@ -0,0 +1,86 @@
+#ifndef DE183E15_BFD2_43ED_9AAA_2A54DBCD33A8
+#define DE183E15_BFD2_43ED_9AAA_2A54DBCD33A8
+
+#include "csprng.h"
+
+#include <stddef.h> /* size_t */
+#include <stdio.h>  /* FILE */
+
+
+/* The largest number of keys that can be generated in GF(2^8), since every
+ * key needs its own distinct, non-zero x */
+#define GF256_MAX_KEYS 255U
+
+/* The size of a key printed by gf256_fprint_key(), for len bytes of y:
+ * "xx:", two digits per byte and a newline */
+#define GF256_KEY_STR_SIZE(len) (3U + 2U * (size_t) (len) + 1U)
+
+/* Called by gf256_generate() once for every key; i is the index of the key.
+ * y holds len bytes.
+ * Returns 0 on success. */
+typedef int (*gf256_emit_func)(unsigned i,
+		unsigned char x,
+		const unsigned char *y,
+		size_t len,
+		void *data);
+
+unsigned char gf256_mul(unsigned char a, unsigned char b);
+unsigned char gf256_inv(unsigned char a);
+
+void gf256_muladd(unsigned char *dst,
+		const unsigned char *src,
+		unsigned char c,
+		size_t len);
+void gf256_mulxor(unsigned char *dst,
+		unsigned char c,
+		const unsigned char *src,
+		size_t len);
+
+int gf256_generate(csprng *rng,
+		const unsigned char *secret,
+		size_t len,
+		unsigned keys_req,
+		unsigned num_keys,
+		gf256_emit_func emit,
+		void *data);
+int gf256_generate_seq(csprng *rng,
+		const unsigned char *secret,
+		size_t len,
+		unsigned keys_req,
+		unsigned num_keys,
+		gf256_emit_func emit,
+		void *data);
+int gf256_generate_x(csprng *rng,
+		const unsigned char *secret,
+		size_t len,
+		unsigned keys_req,
+		const unsigned char *x,
+		unsigned num_keys,
+		gf256_emit_func emit,
+		void *data);
+void gf256_random_x(unsigned char *x, csprng *rng, unsigned num_keys);
+int gf256_combine(unsigned char *secret,
+		const unsigned char *x,
+		const unsigned char *const *y,
+		size_t len,
+		unsigned n_keys);
+int gf256_interpolate(unsigned char *out,
+		unsigned char at,
+		const unsigned char *x,
+		const unsigned char *const *y,
+		size_t len,
+		unsigned n_keys);
+
+int gf256_fprint_key(FILE *out, unsigned char x,
+		const unsigned char *y,
+		size_t len);
+size_t gf256_format_key(char *buf, unsigned char x,
+		const unsigned char *y,
+		size_t len);
+size_t gf256_key_len(const char *str);
+int gf256_parse_key(const char *str,
+		unsigned char *x,
+		unsigned char *y,
+		size_t len);
+
+#endif /* !DE183E15_BFD2_43ED_9AAA_2A54DBCD33A8 */
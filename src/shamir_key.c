@@ -1,11 +1,18 @@
 /* My includes */
 #include "shamir_key.h"
-#include "getrandom.h"
+#include "csprng.h"
+#include "vss.h"
+#include "stats.h"
 
 /* Standard C includes */
 #include <assert.h> /* for assert() */
 #include <stdlib.h> /* for EXIT_FAILURE */
 #include <stdio.h>  /* for perror() */
+#include <string.h> /* for memcpy(), memset() */
+#include <limits.h> /* for CHAR_BIT */
+#include <pthread.h> /* for pthread_* */
+#include <errno.h>  /* for errno, EINTR */
+#include <unistd.h> /* for write() */
 
 /* Third-party includes */
 #include <gmp.h>    /* for gmp_*  */
@@ -14,153 +21,979 @@
 /* Minimum value for the keys_req paramater of skey_generate */
 static const short unsigned min_keys_req = 2;
 
-/* Random state variable for GMP */
-static gmp_randstate_t randstate;
+/* The number of threads skey_generate() spreads the keys over */
+static unsigned n_threads = 1;
+
+/* Don't bother starting a thread for fewer keys than this */
+#define MIN_KEYS_PER_THREAD 8U
+
+/* skey_write() flushes its buffer whenever it holds this many bytes */
+#define WRITE_BUFSIZE ((size_t) 1U << 20)
+
+/* Everything the workers need to generate their keys.
+ * It is shared by all the workers, and none of them modify it. */
+struct job {
+	skey_set *keys;
+	const mpz_t *secret;
+	const mpz_t *coeffs;
+	size_t ncoeffs;
+	const mpz_t *x;          /* The x values, or NULL */
+	const skey_powtab *tab;  /* The powers of the x values, or NULL */
+	int seq;                 /* Use x = 1, ..., num_keys */
+	const sfield *field;
+	csprng *rng;             /* The caller's generator */
+	/* The secret, then the coefficients, field->limbs limbs each, for
+	 * sfield_fixed_*(), or NULL if the field is too large for them */
+	const mp_limb_t *fixed;
+};
+
+/* A worker generates the keys first, ..., last - 1, with its own random
+ * number generator (used when the x values are random) */
+struct worker {
+	pthread_t thread;
+	csprng rng;
+	const struct job *job;
+	size_t first, last;
+};
+
+
+/* The number of limbs needed to hold a number of bits bits */
+#define LIMBS(bits) ((mp_size_t) (((bits) + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS))
+
+/* Round size up to a multiple of the size of a limb */
+#define LIMB_ALIGN(size) \
+	(((size) + sizeof(mp_limb_t) - 1) / sizeof(mp_limb_t) * sizeof(mp_limb_t))
+
+/* Allocate a set of count keys. A key is basically two values: x and y
+ * wher y = f(x).
+ * f is a polynomial (whose coefficients are unknown to us).
+ * Every x can be up to xbits bits long, and every y up to ybits bits.
+ * Returns NULL if there isn't enough memory. */
+skey_set *skey_set_alloc(size_t count, mp_bitcnt_t xbits, mp_bitcnt_t ybits)
+{
+	const mp_size_t xlimbs = LIMBS(xbits) ? LIMBS(xbits) : 1;
+	const mp_size_t ylimbs = LIMBS(ybits) ? LIMBS(ybits) : 1;
+	const size_t header = LIMB_ALIGN(sizeof(skey_set));
+	const size_t sizes = LIMB_ALIGN(2 * count * sizeof(mp_size_t));
+	const size_t limbs = count * (size_t) (xlimbs + ylimbs) * sizeof(mp_limb_t);
+	unsigned char *mem;
+	skey_set *set;
+
+	mem = malloc(header + sizes + limbs);
+	if (!mem)
+		return NULL;
+
+	set = (skey_set *) mem;
+	set->count = count;
+	set->capacity = count;
+	set->xlimbs = xlimbs;
+	set->ylimbs = ylimbs;
+	set->xsize = (mp_size_t *) (mem + header);
+	set->ysize = set->xsize + count;
+	set->x = (mp_limb_t *) (mem + header + sizes);
+	set->y = set->x + count * (size_t) xlimbs;
+
+	memset(set->xsize, 0, 2 * count * sizeof(mp_size_t));
+
+	return set;
+}
 
+void skey_set_free(skey_set *set)
+{
+	if (!set)
+		return;
 
-/* Initialize a key. The key is basically two values: x and y
- * wher y = f(x).
- * f is a polynomial (whose coefficients are unknown to us) */
-shamir_key *skey_init(const mpz_t x, const mpz_t y)
+	/* The y values are secret material, don't leave them lying around,
+	 * including those of the larger sets a reused set held before */
+	memset(set->y, 0, set->capacity * (size_t) set->ylimbs * sizeof(mp_limb_t));
+	free(set);
+}
+
+/* Copy the limbs of n into the slot at limbs, padded with zeros to max
+ * limbs, and return its signed size */
+static mp_size_t store(mp_limb_t *limbs, mp_size_t max, const mpz_t n)
 {
-	shamir_key *key = malloc(sizeof *key);
-	mpz_init_set(key->x, x);
-	mpz_init_set(key->y, y);
-	return key;
+	const mp_size_t size = (mp_size_t) mpz_size(n);
+
+	assert(size <= max);
+
+	if (size)
+		memcpy(limbs, mpz_limbs_read(n), (size_t) size * sizeof(mp_limb_t));
+	memset(limbs + size, 0, (size_t) (max - size) * sizeof(mp_limb_t));
+
+	return mpz_sgn(n) < 0 ? -size : size;
 }
 
-void skey_free(shamir_key *key)
+/* Store x and y as the i-th key of set */
+void skey_set_store(skey_set *set, size_t i, const mpz_t x, const mpz_t y)
 {
-	mpz_clears(key->x, key->y, NULL);
-	free(key);
+	set->xsize[i] = store(set->x + i * (size_t) set->xlimbs, set->xlimbs, x);
+	set->ysize[i] = store(set->y + i * (size_t) set->ylimbs, set->ylimbs, y);
 }
 
+/* A read-only view of the x of the i-th key of set. view holds the view,
+ * and must not be cleared or modified. */
+mpz_srcptr skey_set_x(const skey_set *set, size_t i, mpz_t view)
+{
+	return mpz_roinit_n(view, set->x + i * (size_t) set->xlimbs,
+		set->xsize[i]);
+}
+
+/* Same as skey_set_x(), for the y of the i-th key */
+mpz_srcptr skey_set_y(const skey_set *set, size_t i, mpz_t view)
+{
+	return mpz_roinit_n(view, set->y + i * (size_t) set->ylimbs,
+		set->ysize[i]);
+}
+
+/* Load the y of the i-th key of set into r, for the fixed-width functions
+ * of field. The whole slot is read, so the time doesn't depend on y.
+ * Returns -1 if y isn't an element of field. */
+int skey_set_y_fixed(const skey_set *set, size_t i, const sfield *field,
+		mp_limb_t *r)
+{
+	const int in_field = sfield_fixed_load_n(field, r,
+		set->y + i * (size_t) set->ylimbs, set->ylimbs) == 0;
+
+	return in_field && set->ysize[i] >= 0 ? 0 : -1;
+}
 
-static void calculate_key(const mpz_t x, mpz_t y, mpz_t prod,
-		const mpz_t a, mpz_t *c, size_t n);
+
+static void calculate_key(const mpz_t x, mpz_t y,
+		const mpz_t a, mpz_t *c, size_t n,
+		const sfield *field, mpz_t tmp);
+static void calculate_key_ui(unsigned long x, mpz_t y,
+		const mpz_t a, mpz_t *c, size_t n,
+		const sfield *field, mpz_t tmp);
+static void calculate_key_powtab(const mpz_t *pow, mpz_t y,
+		const mpz_t a, mpz_t *c, size_t n,
+		const sfield *field, mpz_t tmp);
+static int calculate_key_fixed(const struct job *job,
+		mpz_srcptr x, mpz_t y);
+static int generate_keys(skey_set **keys_,
+		csprng *rng,
+		const mpz_t secret,
+		unsigned short keys_req,
+		const mpz_t *x,
+		const skey_powtab *tab,
+		int seq,
+		unsigned num_keys,
+		const sfield *field,
+		const mpz_t *poly,
+		vss *commit);
 
 /* Generate num_keys keys to give out to participants.
  * At least keys_req keys are needed to decrypt the secret.
- * Memory is allocated to hold the keys, and a pointer to the allocated memory
- * is stored in the variable pointed to by keys.
- * The user should remember to free it after use */
-int skey_generate(shamir_key ***keys_,
+ * If field is not NULL, all the arithmetic is done in that field, and the
+ * secret must be an element of it. Otherwise the polynomial is evaluated
+ * over the integers.
+ * The coefficients and the x values are drawn from rng, which only this
+ * call may use until it returns: calls with different generators can run
+ * in parallel.
+ * The keys are stored in *keys, which is reused if it is large enough and
+ * (re)allocated otherwise, so *keys must be NULL or a set from an earlier
+ * call.
+ * The user should remember to free it with skey_set_free() after use */
+int skey_generate(skey_set **keys,
+		csprng *rng,
 		const mpz_t secret,
 		unsigned short keys_req,
-		unsigned num_keys)
+		unsigned num_keys,
+		const sfield *field)
 {
-	shamir_key **keys;
-	mpz_t *coeffs, x, y, xprod;
-	size_t ncoeffs = keys_req - 1;
-	size_t c_count, k_count;
+	/* Without x values or a table, the x values are drawn at random by
+	 * whichever thread generates the key */
+	return generate_keys(keys, rng, secret, keys_req, NULL, NULL, 0,
+		num_keys, field, NULL, NULL);
+}
+
+/* Same as skey_generate(), but the i-th key is generated at x = i + 1
+ * instead of a random x. Every power of x is then a multiplication by a
+ * single limb, and the keys are a lot shorter to write down. */
+int skey_generate_seq(skey_set **keys,
+		csprng *rng,
+		const mpz_t secret,
+		unsigned short keys_req,
+		unsigned num_keys,
+		const sfield *field)
+{
+	return generate_keys(keys, rng, secret, keys_req, NULL, NULL, 1,
+		num_keys, field, NULL, NULL);
+}
+
+/* Same as skey_generate(), or skey_generate_seq() if seq is not 0, but
+ * also commit to the secret and the coefficients in commit, which must
+ * have been initialized with vss_init() for field and keys_req
+ * commitments. The keys can then be checked with vss_verify(). */
+int skey_generate_vss(skey_set **keys,
+		csprng *rng,
+		const mpz_t secret,
+		unsigned short keys_req,
+		unsigned num_keys,
+		int seq,
+		const sfield *field,
+		vss *commit)
+{
+	assert(field && commit->count == keys_req);
+
+	return generate_keys(keys, rng, secret, keys_req, NULL, NULL, seq,
+		num_keys, field, NULL, commit);
+}
+
+/* Set the number of threads used to generate the keys (at least 1) */
+void skey_use_threads(unsigned threads)
+{
+	n_threads = threads ? threads : 1U;
+}
+
+/* Draw one x value from r */
+static void random_x(mpz_t x, csprng *r, const sfield *field)
+{
+	if (field) {
+		/* x = 0 would give away the secret */
+		do
+			csprng_urandomm(x, r, field->p);
+		while (mpz_sgn(x) == 0);
+	} else {
+		csprng_urandomb(x, r, SKEY_COEFF_BITCNT);
+	}
+}
+
+/* Draw the x values of num_keys keys at random.
+ * The elements of x must be initialized. */
+void skey_random_x(mpz_t *x,
+		csprng *rng,
+		unsigned num_keys,
+		const sfield *field)
+{
+	size_t k_count;
+
+	for (k_count = 0; k_count < num_keys; ++k_count)
+		random_x(x[k_count], rng, field);
+}
+
+/* Same as skey_generate(), but the keys are generated at the given x values
+ * instead of random ones. This lets a secret that is shared block by block
+ * keep the same x for every block of a key. */
+int skey_generate_x(skey_set **keys,
+		csprng *rng,
+		const mpz_t secret,
+		unsigned short keys_req,
+		const mpz_t *x,
+		unsigned num_keys,
+		const sfield *field)
+{
+	return generate_keys(keys, rng, secret, keys_req, x, NULL, 0,
+		num_keys, field, NULL, NULL);
+}
+
+/* Same as skey_generate_x(), but the powers of the x values are taken from
+ * tab instead of being recalculated. This is worth it when many secrets
+ * are shared at the same x values. */
+int skey_generate_powtab(skey_set **keys,
+		csprng *rng,
+		const mpz_t secret,
+		const skey_powtab *tab,
+		const sfield *field)
+{
+	return generate_keys(keys, rng, secret, tab->keys_req, NULL, tab, 0,
+		tab->num_keys, field, NULL, NULL);
+}
+
+/* Same as skey_generate_x(), or skey_generate_seq() if x is NULL, but the
+ * polynomial is given instead of drawn: poly[0] is its constant term, and
+ * poly[i] the coefficient of x^i, up to i = keys_req - 1. This is for
+ * polynomials built to hold more than one secret, see pack.h. */
+int skey_generate_poly(skey_set **keys,
+		const mpz_t *poly,
+		unsigned short keys_req,
+		const mpz_t *x,
+		unsigned num_keys,
+		const sfield *field)
+{
+	return generate_keys(keys, NULL, poly[0], keys_req, x, NULL, !x,
+		num_keys, field, poly, NULL);
+}
+
+/* Precompute x, x^2, ..., x^(keys_req - 1) for every one of the num_keys x
+ * values, reduced in field if it isn't NULL.
+ * Returns 0 on success. */
+int skey_powtab_init(skey_powtab *tab,
+		const mpz_t *x,
+		unsigned num_keys,
+		unsigned short keys_req,
+		const sfield *field)
+{
+	const size_t ncoeffs = keys_req - 1;
+	size_t k_count, i;
+	mpz_t *row, tmp;
 
 	assert(keys_req >= min_keys_req);
-	assert(keys_req <= num_keys);
 
-	/* Allocate one more for the terminating NULL */
-	keys = malloc((num_keys + 1) * sizeof *keys);
-	if (!keys) {
+	tab->num_keys = num_keys;
+	tab->keys_req = keys_req;
+	tab->xbits = 1;
+	tab->pow = malloc(num_keys * ncoeffs * sizeof *tab->pow);
+	if (!tab->pow) {
 		perror("malloc");
 		return EXIT_FAILURE;
 	}
-	keys[num_keys] = NULL;
+
+	mpz_init(tmp);
+	for (k_count = 0; k_count < num_keys; ++k_count) {
+		row = tab->pow + k_count * ncoeffs;
+		mpz_init_set(row[0], x[k_count]);
+		if (mpz_sizeinbase(x[k_count], 2) > tab->xbits)
+			tab->xbits = mpz_sizeinbase(x[k_count], 2);
+		for (i = 1; i < ncoeffs; ++i) {
+			mpz_init(row[i]);
+			mpz_mul(row[i], row[i - 1], x[k_count]);
+			if (field)
+				sfield_reduce(field, row[i], tmp);
+		}
+	}
+	mpz_clear(tmp);
+
+	return 0;
+}
+
+void skey_powtab_clear(skey_powtab *tab)
+{
+	const size_t n = tab->num_keys * (size_t) (tab->keys_req - 1);
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		mpz_clear(tab->pow[i]);
+	free(tab->pow);
+}
+
+/* Generate the keys job->keys[first], ..., job->keys[last - 1] */
+static void generate_range(const struct job *job,
+		size_t first,
+		size_t last,
+		csprng *r)
+{
+	const size_t ncoeffs = job->ncoeffs;
+	mpz_t *const c = (mpz_t *) job->coeffs;
+	mpz_t x, y, tmp;
+	size_t k_count;
+
+	mpz_inits(x, y, tmp, NULL);
+
+	for (k_count = first; k_count < last; ++k_count) {
+		/* Calculate y */
+		if (job->tab) {
+			const mpz_t *const pow = job->tab->pow + k_count * ncoeffs;
+
+			if (!job->fixed
+					|| calculate_key_fixed(job, pow[0], y) == -1)
+				calculate_key_powtab(pow, y, *job->secret, c,
+					ncoeffs, job->field, tmp);
+			skey_set_store(job->keys, k_count, pow[0], y);
+		} else if (job->seq) {
+			mpz_set_ui(x, (unsigned long) k_count + 1UL);
+			if (!job->fixed
+					|| calculate_key_fixed(job, x, y) == -1)
+				calculate_key_ui((unsigned long) k_count + 1UL, y,
+					*job->secret, c, ncoeffs, job->field, tmp);
+			skey_set_store(job->keys, k_count, x, y);
+		} else {
+			if (job->x)
+				mpz_set(x, job->x[k_count]);
+			else
+				random_x(x, r, job->field);
+
+			if (!job->fixed
+					|| calculate_key_fixed(job, x, y) == -1)
+				calculate_key(x, y, *job->secret, c, ncoeffs,
+					job->field, tmp);
+			skey_set_store(job->keys, k_count, x, y);
+		}
+	}
+
+	mpz_clears(x, y, tmp, NULL);
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *const w = arg;
+
+	generate_range(w->job, w->first, w->last, &w->rng);
+	return NULL;
+}
+
+/* Generate the keys of job on up to n_threads threads */
+static void run_job(const struct job *job, size_t num_keys)
+{
+	struct worker *workers;
+	size_t n_workers = num_keys / MIN_KEYS_PER_THREAD;
+	size_t w, started;
+
+	if (n_workers > n_threads)
+		n_workers = n_threads;
+	if (n_workers < 2) {
+		generate_range(job, 0, num_keys, job->rng);
+		return;
+	}
+
+	workers = malloc(n_workers * sizeof *workers);
+	if (!workers) {
+		generate_range(job, 0, num_keys, job->rng);
+		return;
+	}
+
+	/* The main thread takes the first range itself */
+	for (w = 0; w < n_workers; ++w) {
+		workers[w].job = job;
+		workers[w].first = num_keys * w / n_workers;
+		workers[w].last = num_keys * (w + 1) / n_workers;
+		/* Every worker gets its own generator, seeded from ours, so
+		 * that it doesn't need to lock the shared one */
+		if (w > 0 && !job->x && !job->tab && !job->seq)
+			csprng_init_from(&workers[w].rng, job->rng);
+	}
+
+	for (started = 1; started < n_workers; ++started) {
+		if (pthread_create(&workers[started].thread, NULL,
+				worker_main, &workers[started]) != 0)
+			break;
+	}
+
+	generate_range(job, workers[0].first, workers[0].last, job->rng);
+
+	/* If a thread could not be started, do its work here */
+	for (w = started; w < n_workers; ++w)
+		worker_main(&workers[w]);
+
+	for (w = 1; w < n_workers; ++w) {
+		if (w < started)
+			pthread_join(workers[w].thread, NULL);
+		if (!job->x && !job->tab && !job->seq)
+			csprng_clear(&workers[w].rng);
+	}
+
+	free(workers);
+}
+
+/* Generate the keys, at the x values of x, or of tab if x is NULL, at
+ * 1, ..., num_keys if seq is not 0, or at random x values otherwise.
+ * The coefficients are taken from poly + 1 if poly is not NULL, and drawn
+ * at random otherwise.
+ * If commit is not NULL, commit to the polynomial in it. */
+static int generate_keys(skey_set **keys_,
+		csprng *rng,
+		const mpz_t secret,
+		unsigned short keys_req,
+		const mpz_t *x,
+		const skey_powtab *tab,
+		int seq,
+		unsigned num_keys,
+		const sfield *field,
+		const mpz_t *poly,
+		vss *commit)
+{
+	skey_set *keys;
+	mpz_t *coeffs;
+	mp_limb_t *fixed = NULL;
+	size_t ncoeffs = keys_req - 1;
+	size_t c_count;
+	mp_bitcnt_t xbits, ybits;
+	struct job job;
+	uint64_t t;
+
+	assert(keys_req >= min_keys_req);
+	assert(keys_req <= num_keys);
+	assert(!field || (mpz_sgn(secret) >= 0 && mpz_cmp(secret, field->p) < 0));
+
+	if (field) {
+		xbits = ybits = field->e;
+		/* 1, ..., num_keys fit in an unsigned */
+		if (seq)
+			xbits = CHAR_BIT * sizeof num_keys;
+	} else {
+		/* Every term c[i] * x^(i+1) is less than
+		 * 2^(SKEY_COEFF_BITCNT + (i+1) * xbits), so y can't be longer
+		 * than the longest term (or the secret) plus log2(keys_req) + 1
+		 * bits */
+		xbits = SKEY_COEFF_BITCNT;
+		for (c_count = 0; x && c_count < num_keys; ++c_count)
+			if (mpz_sizeinbase(x[c_count], 2) > xbits)
+				xbits = mpz_sizeinbase(x[c_count], 2);
+		if (tab)
+			xbits = tab->xbits;
+		if (seq)
+			xbits = CHAR_BIT * sizeof num_keys;
+		ybits = SKEY_COEFF_BITCNT + ncoeffs * xbits;
+		if (mpz_sizeinbase(secret, 2) > ybits)
+			ybits = mpz_sizeinbase(secret, 2);
+		ybits += CHAR_BIT * sizeof keys_req + 1;
+	}
+
+	/* Reuse the caller's set if it is large enough, so sharing secret
+	 * after secret doesn't allocate */
+	keys = *keys_;
+	if (!keys || keys->capacity < num_keys
+			|| keys->xlimbs < LIMBS(xbits)
+			|| keys->ylimbs < LIMBS(ybits)) {
+		skey_set_free(keys);
+		*keys_ = NULL;
+		keys = skey_set_alloc(num_keys, xbits, ybits);
+		if (!keys) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+	}
+	keys->count = num_keys;
+
 	coeffs = malloc(ncoeffs * sizeof *coeffs);
 	if (!coeffs) {
 		perror("malloc");
-		free(keys);
+		/* keys may be the caller's set: don't leave it pointing at it */
+		skey_set_free(keys);
+		*keys_ = NULL;
 		return EXIT_FAILURE;
 	}
 
 	/* Initialize the coefficients */
+	t = stats_start();
 	for (c_count = 0; c_count < ncoeffs; ++c_count) {
 		mpz_init(coeffs[c_count]);
-		mpz_urandomb(coeffs[c_count], randstate, SKEY_COEFF_BITCNT);
+		if (poly)
+			mpz_set(coeffs[c_count], poly[c_count + 1]);
+		else if (field)
+			csprng_urandomm(coeffs[c_count], rng, field->p);
+		else
+			csprng_urandomb(coeffs[c_count], rng, SKEY_COEFF_BITCNT);
 	}
+	stats_stop(STATS_COEFFS, t);
 
-	mpz_inits(x, y, xprod, NULL);
-
-	for (k_count = 0; k_count < num_keys; ++k_count) {
-		mpz_urandomb(x, randstate, SKEY_COEFF_BITCNT);
+	if (commit) {
+		vss_commit(commit, 0, secret);
+		for (c_count = 0; c_count < ncoeffs; ++c_count)
+			vss_commit(commit, c_count + 1, coeffs[c_count]);
+	}
 
-		/* Calculate y */
-		calculate_key(x, y, xprod, secret, coeffs, ncoeffs);
+	/* Small fields are evaluated in fixed width, without GMP allocating
+	 * anything for every key */
+	if (field && field->limbs) {
+		const size_t l = (size_t) field->limbs;
+
+		fixed = malloc((ncoeffs + 1) * l * sizeof *fixed);
+		if (fixed) {
+			int loaded = sfield_fixed_load(field, fixed, secret) == 0;
+
+			for (c_count = 0; loaded && c_count < ncoeffs; ++c_count)
+				loaded = sfield_fixed_load(field,
+					fixed + (c_count + 1) * l, coeffs[c_count]) == 0;
+
+			/* A secret out of the field takes the general path */
+			if (!loaded) {
+				memset(fixed, 0, (ncoeffs + 1) * l * sizeof *fixed);
+				free(fixed);
+				fixed = NULL;
+			}
+		}
+	}
 
-		keys[k_count] = skey_init(x, y);
+	job.keys = keys;
+	job.secret = (const mpz_t *) secret;
+	job.coeffs = (const mpz_t *) coeffs;
+	job.ncoeffs = ncoeffs;
+	job.x = x;
+	job.tab = tab;
+	job.seq = seq;
+	job.field = field;
+	job.rng = rng;
+	job.fixed = fixed;
+
+	t = stats_start();
+	run_job(&job, num_keys);
+	stats_stop(STATS_EVAL, t);
+
+	if (fixed) {
+		memset(fixed, 0, (ncoeffs + 1) * (size_t) field->limbs
+			* sizeof *fixed);
+		free(fixed);
 	}
 
 	for (c_count = 0; c_count < ncoeffs; c_count++)
 		mpz_clear(coeffs[c_count]);
 	free(coeffs);
 
-	mpz_clears(x, y, xprod, NULL);
 	*keys_ = keys;
 	return 0;
 }
 
-static void calculate_key(const mpz_t x, mpz_t y, mpz_t prod,
-	const mpz_t a, mpz_t *c, size_t n)
+static void calculate_key(const mpz_t x, mpz_t y,
+	const mpz_t a, mpz_t *c, size_t n,
+	const sfield *field, mpz_t tmp)
 {
 	size_t i;
 
 	/*            n
 	 *           ____
-	 *           \           i
-	 * y  = a +   >   c  *  x
-	 *           /___  i
+	 *           \             i+1
+	 * y  = a +   >   c[i]  * x
+	 *           /___
 	 *           i = 0
+	 *
+	 * evaluated with Horner's scheme:
+	 *
+	 * y  = (((c[n-1] * x + c[n-2]) * x + ...) * x + c[0]) * x + a
+	 *
+	 * which is one multiplication by x and one addition per coefficient.
 	 */
 
-	/* Initialize the variable that will hold the product x * x * ... * x to x */
-	mpz_set(prod, x);
+	mpz_set(y, c[n - 1]);
+
+	for (i = n - 1; i > 0; --i) {
+		mpz_mul(y, y, x);
+		mpz_add(y, y, c[i - 1]);
+
+		/* Keep y the size of the field */
+		if (field)
+			sfield_reduce(field, y, tmp);
+	}
+
+	mpz_mul(y, y, x);
+	mpz_add(y, y, a);
+	if (field)
+		sfield_reduce(field, y, tmp);
+}
+
+/* Same as calculate_key(), for a small x: every step of Horner's scheme is
+ * a multiplication by a single limb */
+static void calculate_key_ui(unsigned long x, mpz_t y,
+	const mpz_t a, mpz_t *c, size_t n,
+	const sfield *field, mpz_t tmp)
+{
+	size_t i;
+
+	mpz_set(y, c[n - 1]);
+
+	for (i = n - 1; i > 0; --i) {
+		mpz_mul_ui(y, y, x);
+		mpz_add(y, y, c[i - 1]);
+
+		if (field)
+			sfield_reduce(field, y, tmp);
+	}
+
+	mpz_mul_ui(y, y, x);
+	mpz_add(y, y, a);
+	if (field)
+		sfield_reduce(field, y, tmp);
+}
+
+/* Same as calculate_key(), with pow[i] = x^(i+1) already known.
+ * The products are independent of each other, so they are all added up
+ * before y is reduced, once. */
+static void calculate_key_powtab(const mpz_t *pow, mpz_t y,
+	const mpz_t a, mpz_t *c, size_t n,
+	const sfield *field, mpz_t tmp)
+{
+	size_t i;
 
-	/* Initialze y to a */
 	mpz_set(y, a);
+	for (i = 0; i < n; ++i)
+		mpz_addmul(y, c[i], pow[i]);
 
-	for (i = 0; i < n; ++i) {
-		/* y += c[i] * prod */
-		mpz_addmul(y, c[i], prod);
-		/* Update the prouct */
-		mpz_mul(prod, prod, x);
+	if (field)
+		sfield_reduce(field, y, tmp);
+}
+
+/* Same as calculate_key(), in fixed width: every step of Horner's scheme
+ * takes the same time, and nothing is allocated.
+ * Returns -1, leaving y alone, if x isn't an element of the field. */
+static int calculate_key_fixed(const struct job *job,
+		mpz_srcptr x, mpz_t y)
+{
+	const sfield *const field = job->field;
+	const size_t l = (size_t) field->limbs;
+	const mp_limb_t *const a = job->fixed;
+	const mp_limb_t *const c = job->fixed + l;
+	mp_limb_t xl[SFIELD_FIXED_MAX_LIMBS], yl[SFIELD_FIXED_MAX_LIMBS];
+	size_t i = job->ncoeffs;
+
+	if (sfield_fixed_load(field, xl, x) == -1)
+		return -1;
+
+	memcpy(yl, c + (i - 1) * l, l * sizeof *yl);
+	for (; i > 1; --i) {
+		sfield_fixed_mul(field, yl, yl, xl);
+		sfield_fixed_add(field, yl, yl, c + (i - 2) * l);
+	}
+
+	sfield_fixed_mul(field, yl, yl, xl);
+	sfield_fixed_add(field, yl, yl, a);
+
+	sfield_fixed_store(field, y, yl);
+	memset(yl, 0, sizeof yl);
+	return 0;
+}
+
+/* Returns non-zero if the x and the y of every key of set are elements of
+ * field */
+int skey_set_in_field(const skey_set *set, const sfield *field)
+{
+	mpz_t view;
+	size_t i;
+
+	for (i = 0; i < set->count; ++i) {
+		mpz_srcptr x = skey_set_x(set, i, view);
+		if (mpz_sgn(x) < 0 || mpz_cmp(x, field->p) >= 0)
+			return 0;
 	}
+	for (i = 0; i < set->count; ++i) {
+		mpz_srcptr y = skey_set_y(set, i, view);
+		if (mpz_sgn(y) < 0 || mpz_cmp(y, field->p) >= 0)
+			return 0;
+	}
+
+	return 1;
 }
 
-/* Initialize and seed the random state variable (randstate) */
-void skey_randinit(void)
+/* Print the i-th key of keys as "x,y", or as "x,y,e" if it belongs to the
+ * field GF(2^e - 1).
+ * All the numbers are written in hexadecimal, see skey_format(). */
+void skey_print(const skey_set *keys, size_t i, const sfield *field)
 {
-	char *number = getrandom_str((size_t) SKEY_COEFF_BITCNT);
-	mpz_t seed;
+	skey_fprint(stdout, keys, i, field);
+}
 
-	if (mpz_init_set_str(seed, number, 0) == -1) {
-		fputs("skey_randinit: mpz_init_set_str failed.\n", stderr);
-		abort();
+/* Same as skey_print(), but print to out */
+void skey_fprint(FILE *out, const skey_set *keys, size_t i, const sfield *field)
+{
+	char small[512];
+	const size_t size = skey_str_size(keys, field);
+	char *const buf = size <= sizeof small ? small : malloc(size);
+
+	if (!buf) {
+		perror("malloc");
+		return;
 	}
 
-	/* Choose one: */
-	/* gmp_randinit_default(randstate); */
-	/* gmp_randinit_mt(randstate); */
-	assert(gmp_randinit_lc_2exp_size(randstate, 128));
+	fwrite(buf, 1, skey_format(buf, keys, i, field), out);
 
-	/* Using time() to get a random numbe is not very good practice. */
-	gmp_randseed(randstate, seed);
+	if (buf != small)
+		free(buf);
+}
 
-	free(number);
-	mpz_clear(seed);
+/* Write "0x" and the hexadecimal digits of v to p, straight from its limbs.
+ * Returns a pointer past the last digit. */
+static char *put_hex(char *p, mpz_srcptr v)
+{
+	static const char hex_chars[] = "0123456789abcdef";
+	const mp_limb_t *const limbs = mpz_limbs_read(v);
+	size_t n = mpz_size(v);
+	mp_limb_t l;
+	int shift;
+
+	if (mpz_sgn(v) < 0)
+		*p++ = '-';
+	*p++ = '0';
+	*p++ = 'x';
+
+	if (n == 0) {
+		*p++ = '0';
+		return p;
+	}
+
+	/* No leading zeros in the most significant limb */
+	l = limbs[--n];
+	for (shift = GMP_NUMB_BITS - 4; shift > 0 && (l >> shift) == 0; shift -= 4)
+		;
+	for (; shift >= 0; shift -= 4)
+		*p++ = hex_chars[(l >> shift) & 0xfU];
+
+	while (n-- > 0) {
+		l = limbs[n];
+		for (shift = GMP_NUMB_BITS - 4; shift >= 0; shift -= 4)
+			*p++ = hex_chars[(l >> shift) & 0xfU];
+	}
+
+	return p;
 }
 
-/* Free all memory occupied by the random state variable (randstate) */
-void skey_randfree(void)
+/* The size of a buffer large enough for skey_format() to format any key of
+ * keys into */
+size_t skey_str_size(const skey_set *keys, const sfield *field)
 {
-	gmp_randclear(randstate);
+	/* Sign, "0x" and GMP_NUMB_BITS / 4 digits per limb */
+	const size_t xlen = 3 + (size_t) keys->xlimbs * (GMP_NUMB_BITS / 4);
+	const size_t ylen = 3 + (size_t) keys->ylimbs * (GMP_NUMB_BITS / 4);
+	const size_t elen = field ? 1 + 2 + 2 * sizeof(unsigned long) : 0;
+
+	return xlen + 1 + ylen + elen + 1;
 }
 
-void skey_print(const shamir_key *key)
+/* Format the i-th key of keys into buf, as "x,y\n" or "x,y,e\n" with all the
+ * numbers in hexadecimal. buf must hold skey_str_size() bytes. It isn't
+ * null-terminated.
+ * Returns the length of the key. */
+size_t skey_format(char *buf, const skey_set *keys, size_t i, const sfield *field)
 {
-	const int base = 62;
-	char *const x = mpz_get_str(NULL, base, key->x);
-	char *const y = mpz_get_str(NULL, base, key->y);
+	mpz_t xv, yv, e;
+	mp_limb_t e_limb;
+	char *p = buf;
+
+	p = put_hex(p, skey_set_x(keys, i, xv));
+	*p++ = ',';
+	p = put_hex(p, skey_set_y(keys, i, yv));
+
+	if (field) {
+		e_limb = (mp_limb_t) field->e;
+		*p++ = ',';
+		p = put_hex(p, mpz_roinit_n(e, &e_limb, 1));
+	}
+	*p++ = '\n';
+
+	return (size_t) (p - buf);
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		const ssize_t r = write(fd, buf, len);
+
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += r;
+		len -= (size_t) r;
+	}
+
+	return 0;
+}
+
+/* Write all the keys of keys to the file descriptor fd, one per line, in
+ * the format of skey_print().
+ * The keys are formatted into one large buffer, which is written out with
+ * a single write() whenever it fills up, rather than going through stdio
+ * key by key.
+ * Returns 0 on success. */
+int skey_write(int fd, const skey_set *keys, const sfield *field)
+{
+	const size_t line = skey_str_size(keys, field);
+	const size_t size = line > WRITE_BUFSIZE ? line : WRITE_BUFSIZE;
+	char *const buf = malloc(size);
+	size_t used = 0, i;
+	int ret = 0;
+
+	if (!buf) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (i = 0; i < keys->count && ret == 0; ++i) {
+		if (size - used < line) {
+			ret = write_all(fd, buf, used);
+			used = 0;
+		}
+		used += skey_format(buf + used, keys, i, field);
+	}
+	if (ret == 0)
+		ret = write_all(fd, buf, used);
+
+	if (ret == -1)
+		perror("write");
+
+	free(buf);
+	return ret;
+}
+
+/* Set n to the number in str, which is in hexadecimal if it starts with
+ * "0x", the way skey_format() prints numbers, and in base 62 otherwise, the
+ * way they used to be printed */
+static int set_key_str(mpz_t n, const char *str)
+{
+	const char *const p = str + (*str == '-');
+
+	return mpz_set_str(n, str, p[0] == '0' && p[1] == 'x' ? 0 : 62);
+}
+
+/* Parse the n keys in strs, printed by skey_print(), into *set.
+ * *set is reallocated if it is NULL or if its slots are too small, and
+ * reused otherwise, so parsing block after block doesn't allocate.
+ * *e is set to the Mersenne exponent of the keys' field, or to 0 if they
+ * were generated over the integers.
+ * Returns the number of keys parsed: if it is less than n, then
+ * strs[return value] is not a valid key, or doesn't belong to the same field
+ * as the ones before it. */
+size_t skey_set_parse(skey_set **set,
+		const char *const *strs,
+		size_t n,
+		mp_bitcnt_t *e)
+{
+	size_t i, len, max_len = 0;
+	mp_bitcnt_t bits;
+	mpz_t x, y, exp;
+	char *copy;
+
+	/* A base 62 digit is less than 6 bits, and a hexadecimal one 4 */
+	for (i = 0; i < n; ++i) {
+		len = strlen(strs[i]);
+		if (len > max_len)
+			max_len = len;
+	}
+	bits = 6 * (mp_bitcnt_t) max_len;
+
+	if (!*set || (*set)->capacity < n
+			|| LIMBS(bits) > (*set)->xlimbs
+			|| LIMBS(bits) > (*set)->ylimbs) {
+		skey_set_free(*set);
+		*set = skey_set_alloc(n, bits, bits);
+		if (!*set) {
+			perror("malloc");
+			return 0;
+		}
+	}
+	(*set)->count = n;
+
+	/* One copy of the key at a time, cut up at the commas */
+	copy = malloc(max_len + 1);
+	if (!copy) {
+		perror("malloc");
+		return 0;
+	}
+
+	mpz_inits(x, y, exp, NULL);
+
+	for (i = 0; i < n; ++i) {
+		const char *const str = strs[i];
+		const char *c1 = strchr(str, ',');
+		const char *c2 = c1 ? strchr(c1 + 1, ',') : NULL;
+		mp_bitcnt_t key_e = 0;
+
+		if (!c1 || (c2 && strchr(c2 + 1, ',')))
+			break;
+
+		strcpy(copy, str);
+		copy[c1 - str] = '\0';
+		if (c2)
+			copy[c2 - str] = '\0';
+
+		if (set_key_str(x, copy) == -1
+				|| set_key_str(y, copy + (c1 - str) + 1) == -1
+				|| (c2 && (set_key_str(exp, copy + (c2 - str) + 1) == -1
+					|| !mpz_fits_ulong_p(exp)
+					|| mpz_sgn(exp) <= 0)))
+			break;
+
+		if (c2)
+			key_e = mpz_get_ui(exp);
+		if (i == 0)
+			*e = key_e;
+		else if (key_e != *e)
+			break;
+
+		skey_set_store(*set, i, x, y);
+	}
 
-	printf("%s,%s\n", x, y);
+	mpz_clears(x, y, exp, NULL);
+	free(copy);
 
-	free(x);
-	free(y);
+	return i;
 }
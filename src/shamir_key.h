@@ -1,27 +1,115 @@
 #ifndef _8bb948bb_5c69_4aab_8f99_e2785279370a
 #define _8bb948bb_5c69_4aab_8f99_e2785279370a
 
+#include "shamir_field.h"
+#include "csprng.h"
+
 #include <gmp.h>
+#include <stddef.h> /* size_t */
+#include <stdio.h>  /* FILE */
+
 
+struct vss; /* See vss.h */
 
 /* The bitcount of the coefficients used to generate the keys */
 #define SKEY_COEFF_BITCNT ((mp_bitcnt_t) 256U)
 
-struct shamir_key {
-	mpz_t x;
-	mpz_t y;
+/* A set of keys, in struct-of-arrays form: all the x values, then all the y
+ * values, each one padded to the same number of limbs. The whole set lives
+ * in a single allocation, header included, and is freed with a single
+ * free().
+ * The values are read through the read-only views returned by skey_set_x()
+ * and skey_set_y(). */
+struct skey_set {
+	size_t count;       /* The number of keys */
+	size_t capacity;    /* The number of keys there is room for, which a
+	                       reused set keeps when count shrinks */
+	mp_size_t xlimbs;   /* The number of limbs reserved for every x */
+	mp_size_t ylimbs;   /* The number of limbs reserved for every y */
+	mp_size_t *xsize;   /* The signed size of every x, as in mpz_roinit_n() */
+	mp_size_t *ysize;   /* The signed size of every y */
+	mp_limb_t *x;       /* The i-th x starts at x + i * xlimbs */
+	mp_limb_t *y;       /* The i-th y starts at y + i * ylimbs */
+};
+typedef struct skey_set skey_set;
+
+/* The powers x, x^2, ..., x^(keys_req - 1) of the x values of num_keys keys,
+ * for sharing many secrets at the same x values.
+ * pow[k * (keys_req - 1) + i] is the (i + 1)-th power of the k-th x. */
+struct skey_powtab {
+	unsigned num_keys;
+	unsigned short keys_req;
+	mp_bitcnt_t xbits;  /* The size of the largest x */
+	mpz_t *pow;
 };
-typedef struct shamir_key shamir_key;
+typedef struct skey_powtab skey_powtab;
 
-shamir_key *skey_init(const mpz_t x, const mpz_t y);
-void skey_free(shamir_key *key);
-int skey_generate(shamir_key ***keys,
+skey_set *skey_set_alloc(size_t count, mp_bitcnt_t xbits, mp_bitcnt_t ybits);
+void skey_set_free(skey_set *set);
+void skey_set_store(skey_set *set, size_t i, const mpz_t x, const mpz_t y);
+mpz_srcptr skey_set_x(const skey_set *set, size_t i, mpz_t view);
+mpz_srcptr skey_set_y(const skey_set *set, size_t i, mpz_t view);
+int skey_set_y_fixed(const skey_set *set, size_t i, const sfield *field,
+		mp_limb_t *r);
+int skey_set_in_field(const skey_set *set, const sfield *field);
+size_t skey_set_parse(skey_set **set,
+		const char *const *strs,
+		size_t n,
+		mp_bitcnt_t *e);
+int skey_generate(skey_set **keys,
+		csprng *rng,
 		const mpz_t secret,
 		unsigned short keys_req,
-		unsigned num_keys);
-void skey_randinit(void);
-void skey_randfree(void);
-void skey_print(const shamir_key *key);
+		unsigned num_keys,
+		const sfield *field);
+int skey_generate_seq(skey_set **keys,
+		csprng *rng,
+		const mpz_t secret,
+		unsigned short keys_req,
+		unsigned num_keys,
+		const sfield *field);
+int skey_generate_vss(skey_set **keys,
+		csprng *rng,
+		const mpz_t secret,
+		unsigned short keys_req,
+		unsigned num_keys,
+		int seq,
+		const sfield *field,
+		struct vss *commit);
+int skey_generate_x(skey_set **keys,
+		csprng *rng,
+		const mpz_t secret,
+		unsigned short keys_req,
+		const mpz_t *x,
+		unsigned num_keys,
+		const sfield *field);
+int skey_generate_powtab(skey_set **keys,
+		csprng *rng,
+		const mpz_t secret,
+		const skey_powtab *tab,
+		const sfield *field);
+int skey_generate_poly(skey_set **keys,
+		const mpz_t *poly,
+		unsigned short keys_req,
+		const mpz_t *x,
+		unsigned num_keys,
+		const sfield *field);
+int skey_powtab_init(skey_powtab *tab,
+		const mpz_t *x,
+		unsigned num_keys,
+		unsigned short keys_req,
+		const sfield *field);
+void skey_powtab_clear(skey_powtab *tab);
+void skey_random_x(mpz_t *x,
+		csprng *rng,
+		unsigned num_keys,
+		const sfield *field);
+void skey_use_threads(unsigned threads);
+void skey_print(const skey_set *keys, size_t i, const sfield *field);
+void skey_fprint(FILE *out, const skey_set *keys, size_t i, const sfield *field);
+size_t skey_str_size(const skey_set *keys, const sfield *field);
+size_t skey_format(char *buf, const skey_set *keys, size_t i, const sfield *field);
+int skey_write(int fd, const skey_set *keys, const sfield *field);
 
 #endif /* !_8bb948bb_5c69_4aab_8f99_e2785279370a */
 
@@ -0,0 +1,298 @@
+/* My includes */
+#include "sharefile.h"
+
+/* Standard C includes */
+#include <limits.h> /* for CHAR_BIT */
+#include <stdlib.h> /* for realloc(), free() */
+#include <stdio.h>  /* for fread(), fwrite(), fseek() */
+#include <string.h> /* for memcmp(), memcpy(), memset() */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+static const unsigned char magic[4] = { 0x89, 'S', 'H', 'K' };
+
+/* The sign byte and the 32-bit length in front of every value */
+#define RECORD_PREFIX_SIZE 5U
+#define RECORD_MAX_LEN 0xffffffffUL
+
+
+static void put_be(unsigned char *p, uint64_t v, unsigned n)
+{
+	while (n-- > 0) {
+		p[n] = (unsigned char) (v & 0xffU);
+		v >>= CHAR_BIT;
+	}
+}
+
+static uint64_t get_be(const unsigned char *p, unsigned n)
+{
+	uint64_t v = 0;
+	unsigned i;
+
+	for (i = 0; i < n; ++i)
+		v = (v << CHAR_BIT) | p[i];
+
+	return v;
+}
+
+/* Make sure sf->buf holds at least size bytes */
+static int reserve(struct sharefile *sf, size_t size)
+{
+	unsigned char *b;
+
+	if (size <= sf->cap)
+		return 0;
+
+	b = realloc(sf->buf, size);
+	if (!b)
+		return -1;
+	sf->buf = b;
+	sf->cap = size;
+
+	return 0;
+}
+
+static int write_header(FILE *f, const struct sharefile_header *h)
+{
+	unsigned char b[SHAREFILE_HEADER_SIZE];
+
+	memset(b, 0, sizeof b);
+	memcpy(b, magic, sizeof magic);
+	b[4] = (unsigned char) h->version;
+	b[5] = (unsigned char) h->mode;
+	b[6] = (unsigned char) h->flags;
+	put_be(b + 8, h->keys_req, 2);
+	put_be(b + 12, h->index, 4);
+	put_be(b + 16, h->e, 4);
+	put_be(b + 24, h->payload_len, 8);
+	put_be(b + 32, h->block_count, 8);
+
+	return fwrite(b, 1, sizeof b, f) == sizeof b ? 0 : -1;
+}
+
+static int put_record(struct sharefile *sf,
+		int negative,
+		const unsigned char *bytes,
+		size_t len)
+{
+	unsigned char prefix[RECORD_PREFIX_SIZE];
+
+	if (len > RECORD_MAX_LEN)
+		return -1;
+
+	prefix[0] = negative ? 1U : 0U;
+	put_be(prefix + 1, len, 4);
+
+	if (fwrite(prefix, 1, sizeof prefix, sf->f) != sizeof prefix
+			|| fwrite(bytes, 1, len, sf->f) != len)
+		return -1;
+
+	sf->done += sizeof prefix + len;
+	return 0;
+}
+
+static int put_value(struct sharefile *sf, mpz_srcptr v)
+{
+	size_t len = (mpz_sizeinbase(v, 2) + CHAR_BIT - 1) / CHAR_BIT;
+
+	if (reserve(sf, len) == -1)
+		return -1;
+	mpz_export(sf->buf, &len, 1, 1, 0, 0, v);
+
+	return put_record(sf, mpz_sgn(v) < 0, sf->buf, len);
+}
+
+/* Read the next record into sf->buf. It must fit in what is left of the
+ * payload, which also keeps a corrupt length from making us allocate
+ * gigabytes. */
+static int get_record(struct sharefile *sf, int *negative, size_t *len)
+{
+	unsigned char prefix[RECORD_PREFIX_SIZE];
+	uint64_t l;
+
+	if (sf->h.payload_len - sf->done < sizeof prefix
+			|| fread(prefix, 1, sizeof prefix, sf->f) != sizeof prefix)
+		return -1;
+	sf->done += sizeof prefix;
+
+	l = get_be(prefix + 1, 4);
+	if (prefix[0] > 1U || l > sf->h.payload_len - sf->done)
+		return -1;
+
+	if (reserve(sf, (size_t) l) == -1
+			|| fread(sf->buf, 1, (size_t) l, sf->f) != (size_t) l)
+		return -1;
+	sf->done += l;
+
+	*negative = prefix[0];
+	*len = (size_t) l;
+	return 0;
+}
+
+static int get_value(struct sharefile *sf, mpz_t v)
+{
+	size_t len;
+	int negative;
+
+	if (get_record(sf, &negative, &len) == -1)
+		return -1;
+
+	mpz_import(v, len, 1, 1, 0, 0, sf->buf);
+	if (negative)
+		mpz_neg(v, v);
+
+	return 0;
+}
+
+
+/* Tell whether f starts like a key file in the binary format, without
+ * consuming anything from it.
+ * The first byte of the magic can't start a key in the text format. */
+int sharefile_probe(FILE *f)
+{
+	const int c = getc(f);
+
+	if (c == EOF)
+		return 0;
+	ungetc(c, f);
+
+	return c == magic[0];
+}
+
+/* Start writing a key file with the header h to f, and write the key's x.
+ * The payload length and block count in h are ignored; they are counted as
+ * the blocks are put, and filled in by sharefile_finish(), so f must be
+ * seekable.
+ * Returns 0 on success. */
+int sharefile_create(struct sharefile *sf,
+		FILE *f,
+		const struct sharefile_header *h,
+		mpz_srcptr x)
+{
+	sf->f = f;
+	sf->h = *h;
+	sf->h.version = SHAREFILE_VERSION;
+	sf->h.payload_len = 0;
+	sf->h.block_count = 0;
+	sf->done = 0;
+	sf->buf = NULL;
+	sf->cap = 0;
+
+	if (write_header(f, &sf->h) == -1)
+		return -1;
+
+	return put_value(sf, x);
+}
+
+/* Write y as the next block of the key */
+int sharefile_put(struct sharefile *sf, mpz_srcptr y)
+{
+	if (put_value(sf, y) == -1)
+		return -1;
+
+	++sf->h.block_count;
+	return 0;
+}
+
+/* Same as sharefile_put(), for the len bytes of a GF(2^8) block */
+int sharefile_put_bytes(struct sharefile *sf,
+		const unsigned char *y,
+		size_t len)
+{
+	if (put_record(sf, 0, y, len) == -1)
+		return -1;
+
+	++sf->h.block_count;
+	return 0;
+}
+
+/* Go back and fill in the header now that the payload is known, and release
+ * sf. f is left open.
+ * Returns 0 on success. */
+int sharefile_finish(struct sharefile *sf)
+{
+	int ret = 0;
+
+	sf->h.payload_len = sf->done;
+
+	if (fseek(sf->f, 0L, SEEK_SET) != 0
+			|| write_header(sf->f, &sf->h) == -1
+			|| fseek(sf->f, 0L, SEEK_END) != 0)
+		ret = -1;
+
+	sharefile_release(sf);
+	return ret;
+}
+
+/* Read the header of the key file f, and the key's x.
+ * Returns 0 on success, and -1 if f is not a key file we can read. */
+int sharefile_open(struct sharefile *sf, FILE *f, mpz_t x)
+{
+	unsigned char b[SHAREFILE_HEADER_SIZE];
+
+	sf->f = f;
+	sf->done = 0;
+	sf->buf = NULL;
+	sf->cap = 0;
+
+	if (fread(b, 1, sizeof b, f) != sizeof b
+			|| memcmp(b, magic, sizeof magic) != 0)
+		return -1;
+
+	sf->h.version = b[4];
+	sf->h.flags = b[6];
+	sf->h.keys_req = (unsigned) get_be(b + 8, 2);
+	sf->h.index = (unsigned long) get_be(b + 12, 4);
+	sf->h.e = (unsigned long) get_be(b + 16, 4);
+	sf->h.payload_len = get_be(b + 24, 8);
+	sf->h.block_count = get_be(b + 32, 8);
+
+	switch (b[5]) {
+	case PRIME_MODE:   sf->h.mode = PRIME_MODE;   break;
+	case INTEGER_MODE: sf->h.mode = INTEGER_MODE; break;
+	case GF256_MODE:   sf->h.mode = GF256_MODE;   break;
+	default:           return -1;
+	}
+
+	if (sf->h.version != SHAREFILE_VERSION
+			|| (sf->h.flags & ~SHAREFILE_MARKED) != 0)
+		return -1;
+
+	return get_value(sf, x);
+}
+
+/* Read the y of the next block of the key */
+int sharefile_get(struct sharefile *sf, mpz_t y)
+{
+	return get_value(sf, y);
+}
+
+/* Read the next GF(2^8) block of the key, and store its length in *len.
+ * The block is valid until the next call.
+ * Returns NULL on failure. */
+const unsigned char *sharefile_get_bytes(struct sharefile *sf, size_t *len)
+{
+	int negative;
+
+	if (get_record(sf, &negative, len) == -1 || negative)
+		return NULL;
+
+	return sf->buf;
+}
+
+/* Tell whether the whole payload has been read */
+int sharefile_at_end(const struct sharefile *sf)
+{
+	return sf->done == sf->h.payload_len;
+}
+
+void sharefile_release(struct sharefile *sf)
+{
+	if (sf->buf)
+		memset(sf->buf, 0, sf->cap);
+	free(sf->buf);
+	sf->buf = NULL;
+	sf->cap = 0;
+}
@@ -0,0 +1,77 @@
+#ifndef _96DC1253_E0C6_485C_B0CA_15D91048ACC9
+#define _96DC1253_E0C6_485C_B0CA_15D91048ACC9
+
+#include "main.h" /* enum sharemode */
+
+#include <gmp.h>
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint64_t */
+#include <stdio.h>  /* FILE */
+
+
+/* A key file in the binary format is a fixed-size header followed by the
+ * payload: the key's x, then its y for every block of the secret. Every
+ * value is a record made of a sign byte, a 32-bit length and the bytes of
+ * its absolute value, most significant first. All the numbers in the header
+ * and the records are big-endian.
+ *
+ * offset  size  field
+ *      0     4  magic, "\x89SHK"
+ *      4     1  version
+ *      5     1  mode (enum sharemode)
+ *      6     1  flags
+ *      7     1  reserved, 0
+ *      8     2  keys required to recover the secret
+ *     10     2  reserved, 0
+ *     12     4  index of the key, from 1
+ *     16     4  Mersenne exponent e of the field, 0 outside of prime mode
+ *     20     4  reserved, 0
+ *     24     8  payload length, in bytes
+ *     32     8  number of blocks */
+#define SHAREFILE_HEADER_SIZE 40U
+#define SHAREFILE_VERSION 1U
+
+/* Every block has the 0x01 byte of generate_mpz_blocks(), or of -g -f -B,
+ * in front */
+#define SHAREFILE_MARKED 0x01U
+
+struct sharefile_header {
+	unsigned version;
+	enum sharemode mode;
+	unsigned flags;
+	unsigned keys_req;
+	unsigned long index;
+	unsigned long e;
+	uint64_t payload_len;
+	uint64_t block_count;
+};
+
+/* A key file being written or read */
+struct sharefile {
+	FILE *f;
+	struct sharefile_header h;
+	uint64_t done;       /* The payload bytes written or read so far */
+	unsigned char *buf;  /* Scratch space for the records */
+	size_t cap;
+};
+
+int sharefile_probe(FILE *f);
+
+int sharefile_create(struct sharefile *sf,
+		FILE *f,
+		const struct sharefile_header *h,
+		mpz_srcptr x);
+int sharefile_put(struct sharefile *sf, mpz_srcptr y);
+int sharefile_put_bytes(struct sharefile *sf,
+		const unsigned char *y,
+		size_t len);
+int sharefile_finish(struct sharefile *sf);
+
+int sharefile_open(struct sharefile *sf, FILE *f, mpz_t x);
+int sharefile_get(struct sharefile *sf, mpz_t y);
+const unsigned char *sharefile_get_bytes(struct sharefile *sf, size_t *len);
+int sharefile_at_end(const struct sharefile *sf);
+
+void sharefile_release(struct sharefile *sf);
+
+#endif /* !_96DC1253_E0C6_485C_B0CA_15D91048ACC9 */
@@ -0,0 +1,180 @@
+/* My includes */
+#include "stats.h"
+
+/* Standard C includes */
+#include <stdlib.h> /* for malloc(), realloc(), free(), abort() */
+#include <stdio.h>  /* for fprintf(), fputs() */
+#include <time.h>   /* for clock_gettime() */
+#include <pthread.h> /* for pthread_mutex_lock() */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mp_set_memory_functions() */
+
+
+static const char *const phase_names[STATS_N_PHASES] = {
+	"Input read and encode",
+	"RNG init",
+	"Coefficient generation",
+	"Share evaluation",
+	"Combination",
+	"Share verification",
+	"Output encoding and write"
+};
+
+static int enabled;
+static uint64_t started;  /* When stats_enable() was called */
+
+/* The key generation threads and the workers of the server all count, so
+ * everything below is only touched with lock held */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t phase_ns[STATS_N_PHASES];
+static unsigned long phase_calls[STATS_N_PHASES];
+static uint64_t bytes;    /* See stats_add_bytes() */
+
+/* What GMP asked for, through the functions below */
+static unsigned long n_allocs, n_reallocs, n_frees;
+static size_t cur_bytes, peak_bytes;
+
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000U + (uint64_t) ts.tv_nsec;
+}
+
+/* lock must be held */
+static void note_alloc(size_t size)
+{
+	cur_bytes += size;
+	if (cur_bytes > peak_bytes)
+		peak_bytes = cur_bytes;
+}
+
+/* lock must be held */
+static void note_free(size_t size)
+{
+	/* Blocks handed out before stats_enable() weren't counted */
+	cur_bytes = size < cur_bytes ? cur_bytes - size : 0;
+}
+
+/* GMP can't handle failed allocations, so do as its own functions do */
+static void *out_of_memory(void)
+{
+	fputs("GNU MP: Cannot allocate memory.\n", stderr);
+	abort();
+}
+
+static void *gmp_alloc(size_t size)
+{
+	void *const p = malloc(size);
+
+	if (!p)
+		return out_of_memory();
+	pthread_mutex_lock(&lock);
+	++n_allocs;
+	note_alloc(size);
+	pthread_mutex_unlock(&lock);
+	return p;
+}
+
+static void *gmp_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+	void *const p = realloc(ptr, new_size);
+
+	if (!p)
+		return out_of_memory();
+	pthread_mutex_lock(&lock);
+	++n_reallocs;
+	note_free(old_size);
+	note_alloc(new_size);
+	pthread_mutex_unlock(&lock);
+	return p;
+}
+
+static void gmp_free(void *ptr, size_t size)
+{
+	free(ptr);
+	pthread_mutex_lock(&lock);
+	++n_frees;
+	note_free(size);
+	pthread_mutex_unlock(&lock);
+}
+
+
+/* Start counting. GMP's allocations are only seen from here on, so this
+ * should come before the first mpz_init(). */
+void stats_enable(void)
+{
+	mp_set_memory_functions(gmp_alloc, gmp_realloc, gmp_free);
+	started = now_ns();
+	enabled = 1;
+}
+
+/* The start of a phase, to be passed to stats_stop() */
+uint64_t stats_start(void)
+{
+	return enabled ? now_ns() : 0;
+}
+
+/* Add the time since start to phase */
+void stats_stop(enum stats_phase phase, uint64_t start)
+{
+	uint64_t t;
+
+	if (!enabled)
+		return;
+
+	t = now_ns() - start;
+	pthread_mutex_lock(&lock);
+	phase_ns[phase] += t;
+	++phase_calls[phase];
+	pthread_mutex_unlock(&lock);
+}
+
+/* Count n more bytes processed: the bytes of the secret read when
+ * generating, and those of the secret written out when combining */
+void stats_add_bytes(size_t n)
+{
+	if (!enabled)
+		return;
+
+	pthread_mutex_lock(&lock);
+	bytes += n;
+	pthread_mutex_unlock(&lock);
+}
+
+/* Print the statistics gathered since stats_enable() to out */
+void stats_report(FILE *out)
+{
+	const uint64_t total = now_ns() - started;
+	unsigned p;
+
+	if (!enabled)
+		return;
+
+	pthread_mutex_lock(&lock);
+	fputs("\nStatistics:\n", out);
+	for (p = 0; p < STATS_N_PHASES; ++p) {
+		if (phase_calls[p] == 0)
+			continue;
+		fprintf(out, "\t%-26s %12.6f s (%lu time%s)\n",
+			phase_names[p], (double) phase_ns[p] / 1e9,
+			phase_calls[p], phase_calls[p] == 1 ? "" : "s");
+	}
+	fprintf(out, "\t%-26s %12.6f s\n", "Total", (double) total / 1e9);
+
+	fprintf(out, "\t%-26s %12lu\n", "Bytes processed",
+		(unsigned long) bytes);
+	if (total > 0)
+		fprintf(out, "\t%-26s %12.3f MB/s\n", "Throughput",
+			(double) bytes * 1e3 / (double) total);
+
+	fprintf(out, "\t%-26s %12lu (%lu reallocations, %lu frees)\n",
+		"GMP allocations", n_allocs, n_reallocs, n_frees);
+	fprintf(out, "\t%-26s %12lu\n", "GMP peak bytes",
+		(unsigned long) peak_bytes);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,33 @@
+#ifndef _9B3E6D21_4C7A_4F08_B5E2_61D0A8F3C94E
+#define _9B3E6D21_4C7A_4F08_B5E2_61D0A8F3C94E
+
+#include <stddef.h> /* size_t */
+#include <stdint.h> /* uint64_t */
+#include <stdio.h>  /* FILE */
+
+
+/* Where the time of a run goes, and how much memory GMP asks for (--stats).
+ * The statistics are kept for the whole process, by every thread: they are
+ * meant for the command line, and cost nothing until stats_enable() is
+ * called. Past that, every count takes a lock. */
+
+enum stats_phase {
+	STATS_INPUT,    /* Reading the secret or the keys, and decoding them */
+	STATS_RNG_INIT, /* Seeding the random number generator */
+	STATS_COEFFS,   /* Drawing the coefficients of the polynomial */
+	STATS_EVAL,     /* Evaluating the polynomial at the x of every key */
+	STATS_COMBINE,  /* Interpolating the secret from the keys */
+	STATS_VERIFY,   /* Checking the keys against their commitments */
+	STATS_OUTPUT,   /* Formatting and writing the keys, or the secret */
+	STATS_N_PHASES
+};
+
+void stats_enable(void);
+
+uint64_t stats_start(void);
+void stats_stop(enum stats_phase phase, uint64_t start);
+void stats_add_bytes(size_t n);
+
+void stats_report(FILE *out);
+
+#endif /* !_9B3E6D21_4C7A_4F08_B5E2_61D0A8F3C94E */
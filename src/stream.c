@@ -0,0 +1,875 @@
+/* My includes */
+#include "stream.h"
+#include "shamir.h"
+#include "shamir_key.h"
+#include "shamir_field.h"
+#include "shamir_gf256.h"
+#include "sharefile.h"
+#include "stats.h"
+
+/* Standard C includes */
+#include <limits.h> /* for CHAR_BIT */
+#include <stdlib.h> /* for malloc(), free(), EXIT_FAILURE */
+#include <stdio.h>  /* for fread(), perror() */
+#include <string.h> /* for memset(), strchr(), strcspn() */
+#include <sys/types.h> /* for ssize_t */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+/* Large secrets are shared block by block, in constant memory: a block is
+ * read, shared on its own, and its keys are written before the next block
+ * is read. Every key keeps the same x for all the blocks, and key i's
+ * blocks all go to out[i], one line per block, in the same format as the
+ * keys printed by -g.
+ * Combining works the same way in reverse: the key files are read in
+ * lockstep, one line from each, and every block is written out as soon as it
+ * has been recovered. Only one block of every key is held at any time.
+ * In the binary format, each key file is a sharefile with one record per
+ * block instead of one line. */
+
+
+/* Where the blocks of the keys go: out, or sf if they are written in the
+ * binary format */
+struct block_out {
+	FILE *const *out;
+	struct sharefile *sf;
+};
+
+static int emit_block(unsigned i,
+		unsigned char x,
+		const unsigned char *y,
+		size_t len,
+		void *data)
+{
+	const struct block_out *const bo = data;
+
+	if (bo->sf)
+		return sharefile_put_bytes(&bo->sf[i], y, len);
+	return gf256_fprint_key(bo->out[i], x, y, len);
+}
+
+/* Start a key file in the binary format for each of the num_keys keys,
+ * at the x values in x.
+ * Returns the sharefiles, or NULL on failure. */
+static struct sharefile *create_sharefiles(FILE *const *out,
+		const mpz_t *x,
+		unsigned num_keys,
+		unsigned keys_req,
+		enum sharemode mode,
+		const sfield *field)
+{
+	struct sharefile_header h;
+	struct sharefile *sf = malloc(num_keys * sizeof *sf);
+	unsigned i;
+
+	if (!sf) {
+		perror("malloc");
+		return NULL;
+	}
+
+	h.mode = mode;
+	h.flags = mode == GF256_MODE ? 0U : SHAREFILE_MARKED;
+	h.keys_req = keys_req;
+	h.e = field ? (unsigned long) field->e : 0UL;
+
+	for (i = 0; i < num_keys; ++i) {
+		h.index = i + 1UL;
+		if (sharefile_create(&sf[i], out[i], &h, x[i]) == -1) {
+			fprintf(stderr, "stream_generate: failed to write key %u.\n",
+				i + 1U);
+			while (i-- > 0)
+				sharefile_release(&sf[i]);
+			free(sf);
+			return NULL;
+		}
+	}
+
+	return sf;
+}
+
+/* Fill in the headers of the key files started by create_sharefiles(), and
+ * free sf */
+static int finish_sharefiles(struct sharefile *sf, unsigned num_keys)
+{
+	unsigned i;
+	int ret = 0;
+
+	for (i = 0; i < num_keys; ++i) {
+		if (sharefile_finish(&sf[i]) == -1) {
+			fprintf(stderr, "stream_generate: failed to finish key %u.\n",
+				i + 1U);
+			ret = EXIT_FAILURE;
+		}
+	}
+	free(sf);
+
+	return ret;
+}
+
+static int generate_gf256_blocks(csprng *rng,
+		FILE *in,
+		FILE *const *out,
+		unsigned keys_req,
+		unsigned num_keys,
+		size_t block_size,
+		unsigned flags)
+{
+	unsigned char x[GF256_MAX_KEYS];
+	struct block_out bo;
+	unsigned char *block;
+	size_t r;
+	unsigned i;
+	int ret = 0;
+
+	if (num_keys > GF256_MAX_KEYS) {
+		fprintf(stderr, "stream_generate: at most %u keys can be generated.\n",
+			GF256_MAX_KEYS);
+		return EXIT_FAILURE;
+	}
+
+	block = malloc(block_size);
+	if (!block) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+
+	if (flags & STREAM_SEQ_X)
+		for (i = 0; i < num_keys; ++i)
+			x[i] = (unsigned char) (i + 1U);
+	else
+		gf256_random_x(x, rng, num_keys);
+
+	bo.out = out;
+	bo.sf = NULL;
+	if (flags & STREAM_BINARY) {
+		mpz_t *xz = malloc(num_keys * sizeof *xz);
+
+		if (!xz) {
+			perror("malloc");
+			free(block);
+			return EXIT_FAILURE;
+		}
+		for (i = 0; i < num_keys; ++i)
+			mpz_init_set_ui(xz[i], x[i]);
+
+		bo.sf = create_sharefiles(out, (const mpz_t *) xz, num_keys,
+			keys_req, GF256_MODE, NULL);
+
+		for (i = 0; i < num_keys; ++i)
+			mpz_clear(xz[i]);
+		free(xz);
+
+		if (!bo.sf) {
+			free(block);
+			return EXIT_FAILURE;
+		}
+	}
+
+	while (ret == 0 && (r = fread(block, 1, block_size, in)) > 0) {
+		stats_add_bytes(r);
+		ret = gf256_generate_x(rng, block, r, keys_req, x, num_keys,
+			emit_block, &bo);
+	}
+
+	if (bo.sf && finish_sharefiles(bo.sf, num_keys) != 0)
+		ret = EXIT_FAILURE;
+
+	memset(block, 0, block_size);
+	free(block);
+
+	return ret;
+}
+
+/* Share the blocks as numbers, in field, or over the integers if field is
+ * NULL. A 0x01 byte is put in front of every block before it is turned into
+ * a number, so that its leading zero bytes survive and its length can be
+ * recovered. */
+static int generate_mpz_blocks(csprng *rng,
+		FILE *in,
+		FILE *const *out,
+		unsigned keys_req,
+		unsigned num_keys,
+		const sfield *field,
+		size_t block_size,
+		unsigned flags)
+{
+	unsigned char *block;
+	skey_set *keys = NULL;
+	skey_powtab tab;
+	struct sharefile *sf = NULL;
+	char *line = NULL;
+	mpz_t *x, secret, view;
+	size_t r, i, line_cap = 0;
+	int ret, tab_initialized;
+
+	block = malloc(block_size + 1);
+	x = malloc(num_keys * sizeof *x);
+	if (!block || !x) {
+		perror("malloc");
+		free(block);
+		free(x);
+		return EXIT_FAILURE;
+	}
+	block[0] = 0x01;
+
+	for (i = 0; i < num_keys; ++i)
+		mpz_init(x[i]);
+	mpz_init(secret);
+
+	if (flags & STREAM_SEQ_X) {
+		/* Small x values are cheaper to multiply by than their
+		 * precomputed powers */
+		for (i = 0; i < num_keys; ++i)
+			mpz_set_ui(x[i], (unsigned long) i + 1UL);
+		ret = 0;
+		tab_initialized = 0;
+	} else {
+		skey_random_x(x, rng, num_keys, field);
+
+		/* Every block is shared at the same x values, so their
+		 * powers are only calculated once */
+		ret = skey_powtab_init(&tab, (const mpz_t *) x, num_keys,
+			(unsigned short) keys_req, field);
+		tab_initialized = ret == 0;
+	}
+
+	if (ret == 0 && (flags & STREAM_BINARY)) {
+		sf = create_sharefiles(out, (const mpz_t *) x, num_keys, keys_req,
+			field ? PRIME_MODE : INTEGER_MODE, field);
+		if (!sf)
+			ret = EXIT_FAILURE;
+	}
+
+	while (ret == 0 && (r = fread(block + 1, 1, block_size, in)) > 0) {
+		stats_add_bytes(r);
+		mpz_import(secret, r + 1, 1, 1, 0, 0, block);
+
+		if (flags & STREAM_SEQ_X)
+			ret = skey_generate_seq(&keys, rng, secret,
+				(unsigned short) keys_req, num_keys, field);
+		else
+			ret = skey_generate_powtab(&keys, rng, secret, &tab,
+				field);
+		if (ret != 0)
+			break;
+
+		/* One line buffer for all the blocks, rather than letting
+		 * skey_fprint() allocate one for every key */
+		if (!sf && skey_str_size(keys, field) > line_cap) {
+			char *l = realloc(line, skey_str_size(keys, field));
+
+			if (!l) {
+				perror("realloc");
+				ret = EXIT_FAILURE;
+				break;
+			}
+			line = l;
+			line_cap = skey_str_size(keys, field);
+		}
+
+		for (i = 0; i < num_keys; ++i) {
+			if (!sf) {
+				fwrite(line, 1, skey_format(line, keys, i, field),
+					out[i]);
+			} else if (sharefile_put(&sf[i],
+					skey_set_y(keys, i, view)) == -1) {
+				ret = EXIT_FAILURE;
+				break;
+			}
+		}
+	}
+	skey_set_free(keys);
+	free(line);
+
+	if (sf && finish_sharefiles(sf, num_keys) != 0)
+		ret = EXIT_FAILURE;
+
+	if (tab_initialized)
+		skey_powtab_clear(&tab);
+
+	memset(block, 0, block_size + 1);
+	free(block);
+	for (i = 0; i < num_keys; ++i)
+		mpz_clear(x[i]);
+	free(x);
+	mpz_clear(secret);
+
+	return ret;
+}
+
+/* Share the contents of in block by block, and write the blocks of the
+ * i-th key to out[i].
+ * flags is a combination of STREAM_BINARY, to write the keys in the binary
+ * format, and STREAM_SEQ_X, to use the x values 1, ..., num_keys.
+ * Returns 0 on success. */
+int stream_generate(csprng *rng,
+		FILE *in,
+		FILE *const *out,
+		unsigned keys_req,
+		unsigned num_keys,
+		enum sharemode mode,
+		size_t block_size,
+		unsigned flags)
+{
+	sfield field;
+	unsigned i;
+	int ret;
+
+	switch (mode) {
+	case GF256_MODE:
+		ret = generate_gf256_blocks(rng, in, out, keys_req, num_keys,
+			block_size, flags);
+		break;
+
+	case PRIME_MODE:
+		if (sfield_init(&field, (mp_bitcnt_t) block_size * CHAR_BIT + 1U) == -1) {
+			fputs("stream_generate: the block size is too large for prime mode.\n",
+				stderr);
+			return EXIT_FAILURE;
+		}
+		ret = generate_mpz_blocks(rng, in, out, keys_req, num_keys,
+			&field, block_size, flags);
+		sfield_clear(&field);
+		break;
+
+	case INTEGER_MODE:
+		ret = generate_mpz_blocks(rng, in, out, keys_req, num_keys,
+			NULL, block_size, flags);
+		break;
+
+	default: /* Can't happen */
+		return EXIT_FAILURE;
+	}
+
+	if (ferror(in)) {
+		perror("fread");
+		ret = EXIT_FAILURE;
+	}
+	for (i = 0; i < num_keys; ++i) {
+		if (ferror(out[i])) {
+			fprintf(stderr, "stream_generate: failed to write key %u.\n",
+				i + 1U);
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	return ret;
+}
+
+/* Read the next line of each of the n key files into lines.
+ * Returns 1 if a block was read, 0 if all the files have ended, and -1 if
+ * only some of them have, or on a read error. */
+static int read_block(char **lines, size_t *caps, FILE *const *in, unsigned n)
+{
+	unsigned i, ended = 0;
+
+	for (i = 0; i < n; ++i) {
+		const ssize_t r = getline(&lines[i], &caps[i], in[i]);
+
+		if (r == -1) {
+			if (ferror(in[i])) {
+				perror("getline");
+				return -1;
+			}
+			++ended;
+			continue;
+		}
+		lines[i][strcspn(lines[i], "\r\n")] = '\0';
+	}
+
+	if (ended == 0)
+		return 1;
+	if (ended == n)
+		return 0;
+
+	fputs("stream_combine: the key files do not have the same number of blocks.\n",
+		stderr);
+	return -1;
+}
+
+static int combine_gf256_blocks(char **lines,
+		size_t *caps,
+		FILE *const *in,
+		unsigned n,
+		FILE *out)
+{
+	unsigned char x[GF256_MAX_KEYS];
+	const unsigned char **y;
+	unsigned char *data = NULL;
+	size_t len, data_len = 0;
+	unsigned i;
+	int r, ret = EXIT_FAILURE;
+
+	if (n > GF256_MAX_KEYS) {
+		fprintf(stderr, "stream_combine: at most %u GF(2^8) keys can be combined.\n",
+			GF256_MAX_KEYS);
+		return EXIT_FAILURE;
+	}
+
+	y = malloc(n * sizeof *y);
+	if (!y) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+
+	do {
+		len = gf256_key_len(lines[0]);
+
+		/* Only the last block may be shorter than the first one, so
+		 * this only allocates once */
+		if (len > data_len) {
+			unsigned char *d = realloc(data, (n + 1) * len);
+
+			if (!d) {
+				perror("realloc");
+				goto out;
+			}
+			data = d;
+			data_len = len;
+		}
+
+		for (i = 0; i < n; ++i) {
+			if (gf256_key_len(lines[i]) != len
+					|| gf256_parse_key(lines[i], x + i,
+						data + i * len, len) == -1) {
+				fprintf(stderr, "stream_combine: invalid GF(2^8) block in key %u.\n",
+					i + 1U);
+				goto out;
+			}
+			y[i] = data + i * len;
+		}
+
+		if (gf256_combine(data + n * len, x, y, len, n) == -1) {
+			fputs("stream_combine: two of the keys are the same.\n", stderr);
+			goto out;
+		}
+
+		if (fwrite(data + n * len, 1, len, out) != len) {
+			perror("fwrite");
+			goto out;
+		}
+		stats_add_bytes(len);
+	} while ((r = read_block(lines, caps, in, n)) == 1);
+
+	if (r == 0)
+		ret = 0;
+
+out:
+	if (data)
+		memset(data, 0, (n + 1) * data_len);
+	free(data);
+	free(y);
+	return ret;
+}
+
+/* Write the bytes of the recovered block secret to out. If marked is not 0,
+ * the 0x01 byte generate_mpz_blocks() put in front is checked and stripped.
+ * *bytes is a buffer of *cap bytes, grown as needed.
+ * Returns 0 on success. */
+static int write_block(mpz_srcptr secret,
+		int marked,
+		unsigned char **bytes,
+		size_t *cap,
+		FILE *out)
+{
+	size_t count = (mpz_sizeinbase(secret, 2) + CHAR_BIT - 1) / CHAR_BIT;
+	size_t skip = marked ? 1 : 0;
+
+	if (mpz_sgn(secret) < 0) {
+		fputs("stream_combine: the secret is negative, and can't be written as bytes.\n",
+			stderr);
+		return -1;
+	}
+
+	if (count > *cap) {
+		unsigned char *b = realloc(*bytes, count);
+
+		if (!b) {
+			perror("realloc");
+			return -1;
+		}
+		*bytes = b;
+		*cap = count;
+	}
+	mpz_export(*bytes, &count, 1, 1, 0, 0, secret);
+	if (marked && (count == 0 || (*bytes)[0] != 0x01)) {
+		fputs("stream_combine: a block did not decode correctly.\n", stderr);
+		return -1;
+	}
+
+	if (fwrite(*bytes + skip, 1, count - skip, out) != count - skip) {
+		perror("fwrite");
+		return -1;
+	}
+	stats_add_bytes(count - skip);
+
+	return 0;
+}
+
+/* Combine blocks generated by generate_mpz_blocks() */
+static int combine_mpz_blocks(char **lines,
+		size_t *caps,
+		FILE *const *in,
+		unsigned n,
+		FILE *out)
+{
+	skey_set *keys = NULL;
+	unsigned char *bytes = NULL;
+	size_t bytes_len = 0, parsed;
+	mp_bitcnt_t e = 0, key_e;
+	sfield field;
+	int field_initialized = 0, first = 1;
+	shamir_weights_cache wc;
+	mpz_t secret;
+	int r = 1, ret = EXIT_FAILURE;
+
+	mpz_init(secret);
+	shamir_weights_cache_init(&wc);
+
+	for (; r == 1; r = read_block(lines, caps, in, n)) {
+		parsed = skey_set_parse(&keys, (const char *const *) lines, n,
+			&key_e);
+		if (parsed < n) {
+			fprintf(stderr, "stream_combine: invalid block in key %lu.\n",
+				(long unsigned) parsed + 1U);
+			goto out;
+		}
+
+		if (first) {
+			first = 0;
+			e = key_e;
+			if (e) {
+				if (sfield_init_exp(&field, e) == -1) {
+					fprintf(stderr, "2^%lu - 1 is not a known Mersenne prime.\n",
+						(unsigned long) e);
+					goto out;
+				}
+				field_initialized = 1;
+			}
+		}
+		if (key_e != e || (e && !skey_set_in_field(keys, &field))) {
+			fputs("stream_combine: a block is out of range.\n", stderr);
+			goto out;
+		}
+
+		/* Every block comes from the same keys */
+		if (shamir_calculate_secret_cached(secret, keys,
+				field_initialized ? &field : NULL, &wc) == -1) {
+			fputs(field_initialized
+				? "stream_combine: two of the keys are the same.\n"
+				: "stream_combine: two of the keys are the same, or the keys are inconsistent.\n",
+				stderr);
+			goto out;
+		}
+
+		if (write_block(secret, 1, &bytes, &bytes_len, out) == -1)
+			goto out;
+	}
+
+	if (r == 0)
+		ret = 0;
+
+out:
+	skey_set_free(keys);
+	if (bytes)
+		memset(bytes, 0, bytes_len);
+	free(bytes);
+	mpz_clear(secret);
+	shamir_weights_cache_clear(&wc);
+	if (field_initialized)
+		sfield_clear(&field);
+	return ret;
+}
+
+/* Recover a secret generated by stream_generate() from the n_keys key files
+ * in, and write it to out block by block.
+ * Returns 0 on success. */
+int stream_combine(FILE *const *in, unsigned n_keys, FILE *out)
+{
+	char **lines = calloc(n_keys, sizeof *lines);
+	size_t *caps = calloc(n_keys, sizeof *caps);
+	unsigned i;
+	int ret;
+
+	if (!lines || !caps) {
+		perror("calloc");
+		free(lines);
+		free(caps);
+		return EXIT_FAILURE;
+	}
+
+	/* The first block tells us which mode the keys were generated in */
+	ret = read_block(lines, caps, in, n_keys);
+	if (ret == 1)
+		ret = strchr(lines[0], ':')
+			? combine_gf256_blocks(lines, caps, in, n_keys, out)
+			: combine_mpz_blocks(lines, caps, in, n_keys, out);
+	else if (ret == -1)
+		ret = EXIT_FAILURE;
+
+	for (i = 0; i < n_keys; ++i)
+		free(lines[i]);
+	free(lines);
+	free(caps);
+
+	if (ret == 0 && fflush(out) == EOF) {
+		perror("fflush");
+		ret = EXIT_FAILURE;
+	}
+
+	return ret;
+}
+
+static int combine_gf256_sharefiles(struct sharefile *sf,
+		const mpz_t *xz,
+		unsigned n,
+		FILE *out)
+{
+	unsigned char x[GF256_MAX_KEYS];
+	const unsigned char **y;
+	unsigned char *secret = NULL;
+	size_t len, first_len = 0, cap = 0;
+	uint64_t block;
+	unsigned i;
+	int ret = EXIT_FAILURE;
+
+	if (n > GF256_MAX_KEYS) {
+		fprintf(stderr, "stream_combine: at most %u GF(2^8) keys can be combined.\n",
+			GF256_MAX_KEYS);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < n; ++i) {
+		if (mpz_sgn(xz[i]) <= 0 || mpz_cmp_ui(xz[i], 255U) > 0) {
+			fprintf(stderr, "stream_combine: key %u is out of range.\n",
+				i + 1U);
+			return EXIT_FAILURE;
+		}
+		x[i] = (unsigned char) mpz_get_ui(xz[i]);
+	}
+
+	y = malloc(n * sizeof *y);
+	if (!y) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+
+	for (block = 0; block < sf[0].h.block_count; ++block) {
+		for (i = 0; i < n; ++i) {
+			y[i] = sharefile_get_bytes(&sf[i], &len);
+			if (i == 0)
+				first_len = len;
+			if (!y[i] || len != first_len) {
+				fprintf(stderr, "stream_combine: invalid GF(2^8) block in key %u.\n",
+					i + 1U);
+				goto out;
+			}
+		}
+
+		if (len > cap) {
+			unsigned char *s = realloc(secret, len);
+
+			if (!s) {
+				perror("realloc");
+				goto out;
+			}
+			secret = s;
+			cap = len;
+		}
+
+		if (gf256_combine(secret, x, y, len, n) == -1) {
+			fputs("stream_combine: two of the keys are the same.\n", stderr);
+			goto out;
+		}
+
+		if (fwrite(secret, 1, len, out) != len) {
+			perror("fwrite");
+			goto out;
+		}
+		stats_add_bytes(len);
+	}
+	ret = 0;
+
+out:
+	if (secret)
+		memset(secret, 0, cap);
+	free(secret);
+	free(y);
+	return ret;
+}
+
+static int combine_mpz_sharefiles(struct sharefile *sf,
+		const mpz_t *x,
+		unsigned n,
+		FILE *out)
+{
+	skey_set *keys = NULL;
+	unsigned char *bytes = NULL;
+	size_t bytes_len = 0;
+	mp_size_t xlimbs = 0, ylimbs;
+	mpz_t *y, secret;
+	sfield field;
+	int field_initialized = 0;
+	shamir_weights_cache wc;
+	uint64_t block;
+	unsigned i;
+	int ret = EXIT_FAILURE;
+
+	if (sf[0].h.mode == PRIME_MODE) {
+		if (sfield_init_exp(&field, sf[0].h.e) == -1) {
+			fprintf(stderr, "2^%lu - 1 is not a known Mersenne prime.\n",
+				sf[0].h.e);
+			return EXIT_FAILURE;
+		}
+		field_initialized = 1;
+	}
+
+	y = malloc(n * sizeof *y);
+	if (!y) {
+		perror("malloc");
+		goto out_field;
+	}
+	for (i = 0; i < n; ++i) {
+		mpz_init(y[i]);
+		if ((mp_size_t) mpz_size(x[i]) > xlimbs)
+			xlimbs = (mp_size_t) mpz_size(x[i]);
+	}
+	mpz_init(secret);
+	shamir_weights_cache_init(&wc);
+
+	for (block = 0; block < sf[0].h.block_count; ++block) {
+		ylimbs = 0;
+		for (i = 0; i < n; ++i) {
+			if (sharefile_get(&sf[i], y[i]) == -1) {
+				fprintf(stderr, "stream_combine: invalid block in key %u.\n",
+					i + 1U);
+				goto out;
+			}
+			if ((mp_size_t) mpz_size(y[i]) > ylimbs)
+				ylimbs = (mp_size_t) mpz_size(y[i]);
+		}
+
+		if (!keys || ylimbs > keys->ylimbs) {
+			skey_set_free(keys);
+			keys = skey_set_alloc(n,
+				(mp_bitcnt_t) xlimbs * GMP_NUMB_BITS,
+				(mp_bitcnt_t) ylimbs * GMP_NUMB_BITS);
+			if (!keys) {
+				perror("malloc");
+				goto out;
+			}
+		}
+		for (i = 0; i < n; ++i)
+			skey_set_store(keys, i, x[i], y[i]);
+
+		if (field_initialized && !skey_set_in_field(keys, &field)) {
+			fputs("stream_combine: a block is out of range.\n", stderr);
+			goto out;
+		}
+
+		/* Every block comes from the same keys */
+		if (shamir_calculate_secret_cached(secret, keys,
+				field_initialized ? &field : NULL, &wc) == -1) {
+			fputs(field_initialized
+				? "stream_combine: two of the keys are the same.\n"
+				: "stream_combine: two of the keys are the same, or the keys are inconsistent.\n",
+				stderr);
+			goto out;
+		}
+
+		if (write_block(secret, sf[0].h.flags & SHAREFILE_MARKED,
+				&bytes, &bytes_len, out) == -1)
+			goto out;
+	}
+	ret = 0;
+
+out:
+	skey_set_free(keys);
+	if (bytes)
+		memset(bytes, 0, bytes_len);
+	free(bytes);
+	for (i = 0; i < n; ++i)
+		mpz_clear(y[i]);
+	free(y);
+	mpz_clear(secret);
+	shamir_weights_cache_clear(&wc);
+out_field:
+	if (field_initialized)
+		sfield_clear(&field);
+	return ret;
+}
+
+/* Recover a secret from the n_keys key files in, which are in the binary
+ * format, and write it to out block by block. Key files written without -S
+ * simply hold a single block.
+ * Returns 0 on success. */
+int stream_combine_binary(FILE *const *in, unsigned n_keys, FILE *out)
+{
+	struct sharefile *sf = malloc(n_keys * sizeof *sf);
+	mpz_t *x = malloc(n_keys * sizeof *x);
+	unsigned i, opened = 0;
+	int ret = EXIT_FAILURE;
+
+	if (!sf || !x) {
+		perror("malloc");
+		free(sf);
+		free(x);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < n_keys; ++i)
+		mpz_init(x[i]);
+
+	for (; opened < n_keys; ++opened) {
+		if (sharefile_open(&sf[opened], in[opened], x[opened]) == -1) {
+			fprintf(stderr, "stream_combine: key %u is not a valid key file.\n",
+				opened + 1U);
+			++opened; /* Its buffer still needs to be released */
+			goto out;
+		}
+	}
+
+	/* The headers tell us whether the keys can be combined at all */
+	for (i = 1; i < n_keys; ++i) {
+		if (sf[i].h.mode != sf[0].h.mode
+				|| sf[i].h.flags != sf[0].h.flags
+				|| sf[i].h.keys_req != sf[0].h.keys_req
+				|| sf[i].h.e != sf[0].h.e
+				|| sf[i].h.block_count != sf[0].h.block_count) {
+			fprintf(stderr, "stream_combine: key %u was not generated with key 1.\n",
+				i + 1U);
+			goto out;
+		}
+	}
+	if (n_keys < sf[0].h.keys_req) {
+		fprintf(stderr, "stream_combine: %u keys are needed, only %u were given.\n",
+			sf[0].h.keys_req, n_keys);
+		goto out;
+	}
+
+	ret = sf[0].h.mode == GF256_MODE
+		? combine_gf256_sharefiles(sf, (const mpz_t *) x, n_keys, out)
+		: combine_mpz_sharefiles(sf, (const mpz_t *) x, n_keys, out);
+
+	for (i = 0; ret == 0 && i < n_keys; ++i) {
+		if (!sharefile_at_end(&sf[i])) {
+			fprintf(stderr, "stream_combine: key %u has trailing data.\n",
+				i + 1U);
+			ret = EXIT_FAILURE;
+		}
+	}
+
+	if (ret == 0 && fflush(out) == EOF) {
+		perror("fflush");
+		ret = EXIT_FAILURE;
+	}
+
+out:
+	for (i = 0; i < opened; ++i)
+		sharefile_release(&sf[i]);
+	for (i = 0; i < n_keys; ++i)
+		mpz_clear(x[i]);
+	free(sf);
+	free(x);
+	return ret;
+}
@@ -0,0 +1,31 @@
+#ifndef B68EA298_28F9_4307_B334_E83E8AB10216
+#define B68EA298_28F9_4307_B334_E83E8AB10216
+
+#include "main.h" /* enum sharemode */
+#include "csprng.h"
+
+#include <stddef.h> /* size_t */
+#include <stdio.h>  /* FILE */
+
+
+/* Default block sizes, in bytes.
+ * A 64-byte block plus its marker byte fits in GF(2^521 - 1). */
+#define STREAM_MPZ_BLOCK_SIZE   ((size_t) 64U)
+#define STREAM_GF256_BLOCK_SIZE ((size_t) 65536U)
+
+/* Flags for stream_generate() */
+#define STREAM_BINARY 0x1U  /* Write the keys in the binary format */
+#define STREAM_SEQ_X  0x2U  /* Use the x values 1, ..., num_keys */
+
+int stream_generate(csprng *rng,
+		FILE *in,
+		FILE *const *out,
+		unsigned keys_req,
+		unsigned num_keys,
+		enum sharemode mode,
+		size_t block_size,
+		unsigned flags);
+int stream_combine(FILE *const *in, unsigned n_keys, FILE *out);
+int stream_combine_binary(FILE *const *in, unsigned n_keys, FILE *out);
+
+#endif /* !B68EA298_28F9_4307_B334_E83E8AB10216 */
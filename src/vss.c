@@ -0,0 +1,503 @@
+/* My includes */
+#include "vss.h"
+#include "shamir_key.h"
+#include "shamir_field.h"
+#include "csprng.h"
+
+/* Standard C includes */
+#include <stdlib.h> /* for malloc(), realloc(), free() */
+#include <stdio.h>  /* for getline(), fputs(), perror() */
+#include <string.h> /* for memset(), strcmp(), strpbrk() */
+#include <sys/types.h> /* for ssize_t */
+
+/* Third-party includes */
+#include <gmp.h>    /* for mpz_* */
+
+
+/* The candidates for P are sieved with the primes below this before being
+ * tested */
+#define SIEVE_LIMIT 4096U
+
+/* The window of the multi-exponentiation, in bits */
+#define WINDOW 4U
+#define WINDOW_SIZE (1U << WINDOW)
+
+/* The Miller-Rabin rounds P must pass */
+#define PRIME_REPS 25
+
+
+/* Returns the odd primes below SIEVE_LIMIT, and their number in *n */
+static unsigned *small_primes(size_t *n)
+{
+	unsigned char *composite = calloc(SIEVE_LIMIT, 1);
+	unsigned *primes = malloc(SIEVE_LIMIT / 2 * sizeof *primes);
+	unsigned i, j;
+
+	if (!composite || !primes) {
+		perror("malloc");
+		abort();
+	}
+
+	*n = 0;
+	for (i = 3; i < SIEVE_LIMIT; i += 2) {
+		if (composite[i])
+			continue;
+		primes[(*n)++] = i;
+		for (j = i * i; j < SIEVE_LIMIT; j += 2 * i)
+			composite[j] = 1;
+	}
+
+	free(composite);
+	return primes;
+}
+
+/* Find P, the first prime r * q + 1 with r >= 2^(VSS_P_BITS - e) and even,
+ * and g, the first h^((P - 1) / q) that isn't 1, for h = 2, 3, ...
+ * The residues of the candidates modulo the small primes are updated as
+ * they go, so that most candidates are thrown away without a division. */
+static void find_group(vss *v)
+{
+	const mpz_srcptr q = v->field.p;
+	size_t n, i;
+	unsigned *const primes = small_primes(&n);
+	unsigned *res = malloc(n * sizeof *res);
+	unsigned *step = malloc(n * sizeof *step);
+	unsigned long h;
+	mpz_t two_q, exp;
+
+	if (!res || !step) {
+		perror("malloc");
+		abort();
+	}
+	mpz_inits(two_q, exp, NULL);
+	mpz_mul_2exp(two_q, q, 1U);
+
+	mpz_set_ui(v->P, 0U);
+	mpz_setbit(v->P, VSS_P_BITS - v->field.e);
+	mpz_mul(v->P, v->P, q);
+	mpz_add_ui(v->P, v->P, 1U);
+
+	for (i = 0; i < n; ++i) {
+		res[i] = (unsigned) mpz_fdiv_ui(v->P, primes[i]);
+		step[i] = (unsigned) mpz_fdiv_ui(two_q, primes[i]);
+	}
+
+	for (;;) {
+		for (i = 0; i < n && res[i] != 0; ++i)
+			;
+		if (i == n && mpz_probab_prime_p(v->P, PRIME_REPS))
+			break;
+
+		mpz_add(v->P, v->P, two_q);
+		for (i = 0; i < n; ++i) {
+			res[i] += step[i];
+			if (res[i] >= primes[i])
+				res[i] -= primes[i];
+		}
+	}
+
+	mpz_sub_ui(exp, v->P, 1U);
+	mpz_divexact(exp, exp, q);
+	for (h = 2; ; ++h) {
+		mpz_set_ui(v->g, h);
+		mpz_powm(v->g, v->g, exp, v->P);
+		if (mpz_cmp_ui(v->g, 1U) != 0)
+			break;
+	}
+
+	mpz_clears(two_q, exp, NULL);
+	free(primes);
+	free(res);
+	free(step);
+}
+
+static void alloc_commitments(vss *v, size_t count)
+{
+	size_t j;
+
+	v->c = malloc(count * sizeof *v->c);
+	if (!v->c) {
+		perror("malloc");
+		abort();
+	}
+	for (j = 0; j < count; ++j)
+		mpz_init(v->c[j]);
+	v->count = count;
+}
+
+/* Prepare v for the count commitments of keys generated in field, which
+ * must be between 2^VSS_MIN_E - 1 and 2^VSS_MAX_E - 1.
+ * This looks for P, which takes a fraction of a second.
+ * Returns -1 if the field is out of range. */
+int vss_init(vss *v, const sfield *field, size_t count)
+{
+	if (field->e < VSS_MIN_E || field->e > VSS_MAX_E)
+		return -1;
+
+	sfield_init_exp(&v->field, field->e);
+	mpz_inits(v->P, v->g, NULL);
+	find_group(v);
+	alloc_commitments(v, count);
+
+	return 0;
+}
+
+void vss_clear(vss *v)
+{
+	size_t j;
+
+	for (j = 0; j < v->count; ++j)
+		mpz_clear(v->c[j]);
+	free(v->c);
+	mpz_clears(v->P, v->g, NULL);
+	sfield_clear(&v->field);
+}
+
+/* Commit to the j-th coefficient a of the polynomial, a[0] being the
+ * secret: c[j] = g^a mod P */
+void vss_commit(vss *v, size_t j, const mpz_t a)
+{
+	/* mpz_powm_sec() wants a positive exponent */
+	if (mpz_sgn(a) == 0)
+		mpz_set_ui(v->c[j], 1U);
+	else
+		mpz_powm_sec(v->c[j], v->g, a, v->P);
+}
+
+static int write_number(FILE *out, mpz_srcptr n)
+{
+	return fputs("0x", out) == EOF || mpz_out_str(out, 16, n) == 0
+		|| fputc('\n', out) == EOF ? -1 : 0;
+}
+
+/* Write the commitments of v to out.
+ * Returns 0 on success. */
+int vss_write(FILE *out, const vss *v)
+{
+	size_t j;
+
+	if (fputs(VSS_MAGIC "\n", out) == EOF
+			|| fprintf(out, "0x%lx\n", (unsigned long) v->field.e) < 0
+			|| write_number(out, v->P) == -1
+			|| write_number(out, v->g) == -1)
+		return -1;
+
+	for (j = 0; j < v->count; ++j)
+		if (write_number(out, v->c[j]) == -1)
+			return -1;
+
+	return 0;
+}
+
+/* Returns non-zero if 0 < a < P and a^q = 1 (mod P): a is in the subgroup */
+static int in_subgroup(const vss *v, mpz_srcptr a, mpz_t tmp)
+{
+	if (mpz_sgn(a) <= 0 || mpz_cmp(a, v->P) >= 0)
+		return 0;
+
+	mpz_powm(tmp, a, v->field.p, v->P);
+	return mpz_cmp_ui(tmp, 1U) == 0;
+}
+
+/* Make sure the group of v is one that vss_init() could have found, and
+ * that the commitments are in it. P is only checked to be a prime of the
+ * right form, not to be the first one: that would mean looking for it. */
+static int check_group(const vss *v)
+{
+	mpz_t tmp;
+	size_t j;
+	int ret = -1;
+
+	mpz_init(tmp);
+
+	mpz_sub_ui(tmp, v->P, 1U);
+	if (mpz_sizeinbase(v->P, 2) < VSS_P_BITS
+			|| !mpz_divisible_p(tmp, v->field.p)
+			|| !mpz_probab_prime_p(v->P, PRIME_REPS)) {
+		fputs("vss: the modulus of the commitments is not a suitable prime.\n",
+			stderr);
+		goto out;
+	}
+
+	if (mpz_cmp_ui(v->g, 1U) == 0 || !in_subgroup(v, v->g, tmp)) {
+		fputs("vss: the generator of the commitments is not of order 2^e - 1.\n",
+			stderr);
+		goto out;
+	}
+
+	for (j = 0; j < v->count; ++j) {
+		if (!in_subgroup(v, v->c[j], tmp)) {
+			fprintf(stderr, "vss: commitment %lu is not in the group.\n",
+				(unsigned long) j);
+			goto out;
+		}
+	}
+	ret = 0;
+
+out:
+	mpz_clear(tmp);
+	return ret;
+}
+
+/* Read commitments written by vss_write() into v, which must not be
+ * initialized, and check them. v must be cleared with vss_clear() if this
+ * succeeds.
+ * Returns 0 on success. */
+int vss_read(FILE *in, vss *v)
+{
+	char *line = NULL, *nl;
+	size_t cap = 0, n = 0, alloc = 0, i;
+	mpz_t *num = NULL;
+	ssize_t len;
+	unsigned long e;
+	int ret = -1;
+
+	if (getline(&line, &cap, in) == -1
+			|| strcmp(line, VSS_MAGIC "\n") != 0) {
+		fputs("vss: this is not a file of commitments written by -g -c.\n",
+			stderr);
+		free(line);
+		return -1;
+	}
+
+	/* e, P, g, then the commitments */
+	while ((len = getline(&line, &cap, in)) != -1) {
+		nl = strpbrk(line, "\r\n");
+		if (nl)
+			*nl = '\0';
+		if (*line == '\0')
+			continue;
+
+		if (n == alloc) {
+			mpz_t *a;
+
+			alloc = alloc ? 2 * alloc : 16U;
+			a = realloc(num, alloc * sizeof *a);
+			if (!a) {
+				perror("realloc");
+				goto out;
+			}
+			num = a;
+		}
+		if (mpz_init_set_str(num[n], line, 0) == -1) {
+			mpz_clear(num[n]);
+			fprintf(stderr, "vss: invalid number: %s.\n", line);
+			goto out;
+		}
+		++n;
+	}
+	if (ferror(in)) {
+		perror("getline");
+		goto out;
+	}
+
+	if (n < 5) {
+		fputs("vss: the file of commitments was cut short.\n", stderr);
+		goto out;
+	}
+
+	e = mpz_fits_ulong_p(num[0]) ? mpz_get_ui(num[0]) : 0UL;
+	if (e < VSS_MIN_E || e > VSS_MAX_E
+			|| sfield_init_exp(&v->field, e) == -1) {
+		fputs("vss: the commitments are not for a field -g -c uses.\n",
+			stderr);
+		goto out;
+	}
+
+	mpz_init_set(v->P, num[1]);
+	mpz_init_set(v->g, num[2]);
+	alloc_commitments(v, n - 3);
+	for (i = 3; i < n; ++i)
+		mpz_swap(v->c[i - 3], num[i]);
+
+	if (check_group(v) == -1) {
+		vss_clear(v);
+		goto out;
+	}
+	ret = 0;
+
+out:
+	for (i = 0; i < n; ++i)
+		mpz_clear(num[i]);
+	free(num);
+	free(line);
+	return ret;
+}
+
+
+/* What the batches of keys are checked with */
+struct verifier {
+	const vss *v;
+	const skey_set *keys;
+	csprng *rng;
+	size_t nbases;     /* g, then the commitments */
+	mpz_t *table;      /* table[b * WINDOW_SIZE + d] = base[b]^d mod P */
+	mpz_t *exp;        /* The exponent of every base */
+	mpz_t rho, t, acc, tmp;
+};
+
+static void mulmod(mpz_t r, const mpz_t a, const mpz_t b, const vss *v)
+{
+	mpz_mul(r, a, b);
+	mpz_tdiv_r(r, r, v->P);
+}
+
+/* acc = prod(base[b]^exp[b]) mod P, the exponents being less than q, by
+ * Straus's method: the bases share the squarings, and every one of them
+ * costs one multiplication per WINDOW bits of its exponent */
+static void multiexp(struct verifier *ver)
+{
+	const vss *const v = ver->v;
+	const mp_bitcnt_t bits = (v->field.e + WINDOW - 1) / WINDOW * WINDOW;
+	mp_bitcnt_t pos, k;
+	unsigned d;
+	size_t b;
+
+	mpz_set_ui(ver->acc, 1U);
+
+	for (pos = bits; pos > 0; pos -= WINDOW) {
+		if (mpz_cmp_ui(ver->acc, 1U) != 0)
+			for (k = 0; k < WINDOW; ++k)
+				mulmod(ver->acc, ver->acc, ver->acc, v);
+
+		for (b = 0; b < ver->nbases; ++b) {
+			d = 0;
+			for (k = WINDOW; k-- > 0; )
+				d = d << 1 | (unsigned) mpz_tstbit(ver->exp[b],
+					pos - WINDOW + k);
+			if (d)
+				mulmod(ver->acc, ver->acc,
+					ver->table[b * WINDOW_SIZE + d], v);
+		}
+	}
+}
+
+/* Check the keys first, ..., last - 1 all at once. With random weights
+ * rho[i], a single equation stands for all of them:
+ *
+ *   g^(sum rho[i] y[i]) = prod(c[j]^(sum rho[i] x[i]^j))  (mod P)
+ *
+ * which is checked as g^Y * prod(c[j]^(q - X[j])) = 1 in one
+ * multi-exponentiation, whatever the number of keys. A single key is
+ * checked with rho = 1, which is exact.
+ * Returns non-zero if the equation holds. */
+static int check_batch(struct verifier *ver, size_t first, size_t last)
+{
+	const vss *const v = ver->v;
+	const sfield *const f = &v->field;
+	mpz_t xv, yv;
+	size_t i, j;
+
+	for (j = 0; j < ver->nbases; ++j)
+		mpz_set_ui(ver->exp[j], 0U);
+
+	for (i = first; i < last; ++i) {
+		mpz_srcptr x = skey_set_x(ver->keys, i, xv);
+
+		if (last - first == 1)
+			mpz_set_ui(ver->rho, 1U);
+		else
+			csprng_urandomb(ver->rho, ver->rng, VSS_BATCH_BITS);
+
+		mpz_addmul(ver->exp[0], ver->rho, skey_set_y(ver->keys, i, yv));
+
+		/* t = rho * x^j */
+		mpz_set(ver->t, ver->rho);
+		for (j = 0; j < v->count; ++j) {
+			mpz_add(ver->exp[j + 1], ver->exp[j + 1], ver->t);
+			if (j + 1 < v->count) {
+				mpz_mul(ver->t, ver->t, x);
+				sfield_reduce(f, ver->t, ver->tmp);
+			}
+		}
+	}
+
+	sfield_reduce(f, ver->exp[0], ver->tmp);
+	for (j = 1; j < ver->nbases; ++j) {
+		sfield_reduce(f, ver->exp[j], ver->tmp);
+		if (mpz_sgn(ver->exp[j]) != 0)
+			mpz_sub(ver->exp[j], f->p, ver->exp[j]);
+	}
+
+	multiexp(ver);
+	return mpz_cmp_ui(ver->acc, 1U) == 0;
+}
+
+/* Check the keys first, ..., last - 1, and if they don't all pass, find
+ * the ones that don't by halving the batch.
+ * Returns the number of invalid keys, which are flagged in bad. */
+static size_t check_range(struct verifier *ver,
+		size_t first,
+		size_t last,
+		unsigned char *bad)
+{
+	const size_t mid = first + (last - first) / 2;
+
+	if (check_batch(ver, first, last))
+		return 0;
+
+	if (last - first == 1) {
+		bad[first] = 1;
+		return 1;
+	}
+
+	return check_range(ver, first, mid, bad)
+		+ check_range(ver, mid, last, bad);
+}
+
+/* Check every key of keys against the commitments of v. The keys must be
+ * elements of v->field.
+ * Valid keys cost about as much as a single one, whatever their number: they
+ * are checked in one batch, with random weights drawn from rng. Only if the
+ * batch fails is it split up, to find out which keys are invalid.
+ * bad[i] is set to 1 if the i-th key is invalid, and to 0 otherwise.
+ * Returns the number of invalid keys. */
+size_t vss_verify(const vss *v,
+		const skey_set *keys,
+		csprng *rng,
+		unsigned char *bad)
+{
+	struct verifier ver;
+	size_t b, d, n_bad;
+
+	memset(bad, 0, keys->count);
+	if (keys->count == 0)
+		return 0;
+
+	ver.v = v;
+	ver.keys = keys;
+	ver.rng = rng;
+	ver.nbases = v->count + 1;
+	ver.table = malloc(ver.nbases * WINDOW_SIZE * sizeof *ver.table);
+	ver.exp = malloc(ver.nbases * sizeof *ver.exp);
+	if (!ver.table || !ver.exp) {
+		perror("malloc");
+		abort();
+	}
+	mpz_inits(ver.rho, ver.t, ver.acc, ver.tmp, NULL);
+
+	/* The powers of the bases are the same for every batch */
+	for (b = 0; b < ver.nbases; ++b) {
+		mpz_t *const row = ver.table + b * WINDOW_SIZE;
+
+		mpz_init(ver.exp[b]);
+		mpz_init_set_ui(row[0], 1U);
+		mpz_init_set(row[1], b == 0 ? v->g : v->c[b - 1]);
+		for (d = 2; d < WINDOW_SIZE; ++d) {
+			mpz_init(row[d]);
+			mulmod(row[d], row[d - 1], row[1], v);
+		}
+	}
+
+	n_bad = check_range(&ver, 0, keys->count, bad);
+
+	for (b = 0; b < ver.nbases * WINDOW_SIZE; ++b)
+		mpz_clear(ver.table[b]);
+	for (b = 0; b < ver.nbases; ++b)
+		mpz_clear(ver.exp[b]);
+	free(ver.table);
+	free(ver.exp);
+	mpz_clears(ver.rho, ver.t, ver.acc, ver.tmp, NULL);
+
+	return n_bad;
+}
@@ -0,0 +1,69 @@
+#ifndef _5D20A7E3_91C4_4E6B_8F1A_3B6C0D94E72F
+#define _5D20A7E3_91C4_4E6B_8F1A_3B6C0D94E72F
+
+#include "shamir_key.h"
+#include "shamir_field.h"
+#include "csprng.h"
+
+#include <gmp.h>
+#include <stddef.h> /* size_t */
+#include <stdio.h>  /* FILE */
+
+
+/* Feldman's verifiable secret sharing, for keys generated in GF(q), where
+ * q = 2^e - 1.
+ *
+ * The commitments live in the subgroup of order q of the integers modulo a
+ * prime P, with q dividing P - 1, generated by g. For the polynomial
+ * a[0] + a[1] x + ... + a[k-1] x^(k-1), a[0] being the secret, they are
+ * c[j] = g^a[j] mod P, and a key (x, y) is valid if and only if
+ *
+ *   g^y = c[0] * c[1]^x * c[2]^(x^2) * ... * c[k-1]^(x^(k-1))  (mod P)
+ *
+ * P is the first prime of the form r * q + 1 from r = 2^(VSS_P_BITS - e)
+ * on, so it only depends on the field.
+ *
+ * c[0] = g^secret is public: the commitments hide the secret only as well
+ * as the secret is random. A secret that can be guessed, such as a
+ * password, is found by computing g^guess for every guess until one matches
+ * c[0]. Commitments are only meant for high-entropy secrets, such as the
+ * data key of hybrid sharing (-H).
+ *
+ * The commitments are written as text, one number per line:
+ *   VSS_MAGIC, e, P, g, c[0], ..., c[k-1] */
+
+#define VSS_MAGIC "SHAMIR-VSS1"
+
+/* The size of P. The discrete logarithm modulo P must be out of reach. */
+#define VSS_P_BITS 2048U
+
+/* The smallest and largest fields the commitments are made in: below
+ * 2^127 - 1, the discrete logarithm in the subgroup of order q is easy,
+ * and above 2^1279 - 1, P would hardly be larger than q */
+#define VSS_MIN_E 127U
+#define VSS_MAX_E 1279U
+
+/* The bits of the random weights of batch verification: a batch with an
+ * invalid key passes with a probability of at most 2^-VSS_BATCH_BITS */
+#define VSS_BATCH_BITS 128U
+
+struct vss {
+	sfield field;    /* The field of the keys: field.p is q */
+	mpz_t P;         /* The prime the commitments are reduced modulo */
+	mpz_t g;         /* The generator of the subgroup of order q */
+	size_t count;    /* The number of commitments, KEYS_REQ */
+	mpz_t *c;        /* c[j] = g^a[j] mod P */
+};
+typedef struct vss vss;
+
+int vss_init(vss *v, const sfield *field, size_t count);
+void vss_clear(vss *v);
+void vss_commit(vss *v, size_t j, const mpz_t a);
+int vss_write(FILE *out, const vss *v);
+int vss_read(FILE *in, vss *v);
+size_t vss_verify(const vss *v,
+		const skey_set *keys,
+		csprng *rng,
+		unsigned char *bad);
+
+#endif /* !_5D20A7E3_91C4_4E6B_8F1A_3B6C0D94E72F */